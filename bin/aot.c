@@ -0,0 +1,205 @@
+/* Generated by qspc, do not edit. */
+#include "qsp.h"
+#include <limits.h>
+
+#define QSPC_MAX_DEPTH 4096
+#define QSPC_BAIL { ctx->failed = 1; goto done; }
+
+static long qspc_18(long* args, ljit_ctx* ctx);
+static long qspc_29(long* args, ljit_ctx* ctx);
+static long qspc_30(long* args, ljit_ctx* ctx);
+static long qspc_31(long* args, ljit_ctx* ctx);
+static long qspc_34(long* args, ljit_ctx* ctx);
+
+/* not */
+static long qspc_18(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = 1L;
+	t1 = args[0];
+	if (__builtin_sub_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_18_syms[] = {
+  { "not", NULL, 4046182697u },
+  { "-", builtin_sub, 0u },
+};
+
+/* ev */
+static long qspc_29(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 0L;
+	t2 = t0 == t1;
+	if (t2) {
+	t4 = 1L;
+	t3 = t4;
+	} else {
+	t5 = args[0];
+	t6 = 1L;
+	if (__builtin_sub_overflow(t5, t6, &t7)) QSPC_BAIL;
+	{
+	long a[2] = { t7, 0 };
+	t8 = qspc_30(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	t3 = t8;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_29_syms[] = {
+  { "ev", NULL, 3950936113u },
+  { "if", builtin_if, 0u },
+  { "==", builtin_eq, 0u },
+  { "od", NULL, 4200677559u },
+  { "-", builtin_sub, 0u },
+  { "if", builtin_if, 0u },
+  { "==", builtin_eq, 0u },
+  { "-", builtin_sub, 0u },
+};
+
+/* od */
+static long qspc_30(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 0L;
+	t2 = t0 == t1;
+	if (t2) {
+	t4 = 0L;
+	t3 = t4;
+	} else {
+	t5 = args[0];
+	t6 = 1L;
+	if (__builtin_sub_overflow(t5, t6, &t7)) QSPC_BAIL;
+	{
+	long a[2] = { t7, 0 };
+	t8 = qspc_29(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	t3 = t8;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_30_syms[] = {
+  { "od", NULL, 4200677559u },
+  { "if", builtin_if, 0u },
+  { "==", builtin_eq, 0u },
+  { "-", builtin_sub, 0u },
+  { "if", builtin_if, 0u },
+  { "==", builtin_eq, 0u },
+  { "ev", NULL, 3950936113u },
+  { "-", builtin_sub, 0u },
+};
+
+/* dv */
+static long qspc_31(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[1];
+	if (t1 == 0 || (t0 == LONG_MIN && t1 == -1)) QSPC_BAIL;
+	t2 = t0 / t1;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_31_syms[] = {
+  { "dv", NULL, 939153u },
+  { "/", builtin_div, 0u },
+};
+
+/* fl */
+static long qspc_34(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 2L;
+	if (__builtin_mul_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_34_syms[] = {
+  { "fl", NULL, 1462742697u },
+  { "*", builtin_mul, 0u },
+};
+
+static const ljit_native QSPC_NATIVES[] = {
+  { "not", qspc_18, qspc_18_syms, sizeof(qspc_18_syms) / sizeof(ljit_sym) },
+  { "ev", qspc_29, qspc_29_syms, sizeof(qspc_29_syms) / sizeof(ljit_sym) },
+  { "od", qspc_30, qspc_30_syms, sizeof(qspc_30_syms) / sizeof(ljit_sym) },
+  { "dv", qspc_31, qspc_31_syms, sizeof(qspc_31_syms) / sizeof(ljit_sym) },
+  { "fl", qspc_34, qspc_34_syms, sizeof(qspc_34_syms) / sizeof(ljit_sym) },
+  { NULL, NULL, NULL, 0 }
+};
+
+static const qsp_source QSPC_SOURCES[] = {
+  { "./src/corelib/core.qsp",
+    "(def {false} 0)\n"
+    "(def {true} 1)\n"
+    "(def {nil} {})\n"
+    "(def {ok} ())\n"
+    "(def {otherwise} true)\n"
+    "(def {fun} (\\ {args body} {def (head args) (\\ (tail args) body)}))\n"
+    "(fun {fst l} {eval (head l)})\n"
+    "(fun {snd l} {eval (head (tail l))})\n"
+    "(fun {trd l} {eval (head (tail (tail l)))})\n"
+    "(fun {unpack f xs} {eval (join (list f) xs)})\n"
+    "(fun {pack f & xs} {f xs})\n"
+    "(def {curry} {unpack})\n"
+    "(def {uncurry} {pack})\n"
+    "(fun {rev l} {if (== l nil) {nil} {join (rev (tail l)) (head l)}})\n"
+    "(fun {nth n l} {if (== n 0) {head l} {nth (- n 1) (tail l)}})\n"
+    "(fun {last l} {if (== 1 (len l)) {head l} {last (tail l)}})\n"
+    "(fun {flip f x y} {f y x})\n"
+    "(fun {ghost & xs} {eval xs})\n"
+    "(fun {comp f g x} {f (g x)})\n"
+    "(fun {not x} {- 1 x})\n"
+    "(defmacro {let b} {list (sexpr (join {\\ {_}} (list b))) ()})\n"
+    "(fun {take n l} {if (== n 0) {nil} {join (head l) (take (- n 1) (tail l))}})\n"
+    "(fun {drop n l} {if (== n 0) {l} {drop (- n 1) (tail l)}})\n"
+    "(fun {split n l} {list (take n l) (drop n l)})\n"
+    "(fun {elem x l} {if (== l nil) {false} {if (== x (fst l)) {true} {elem x (tail l)}}})\n"
+    "(fun {map f l} {if (== l nil) {nil} {join (list (f (fst l))) (map f (tail l))}})\n"
+    "(fun {filter f l} {if (== l nil) {nil} {join (if (f (fst l)) {head l} {nil}) (filter f (tail l))}})\n"
+    "(fun {foldl f z l} {if (== l nil) {z} {foldl f (f z (fst l)) (tail l)}})\n"
+    "(fun {sum l} {foldl + 0 l})\n"
+    "(fun {product l} {foldl + 1 l})\n" },
+  { "/tmp/aot.qsp",
+    "(fun {ev n} {if (== n 0) {1} {od (- n 1)}})\n"
+    "(fun {od n} {if (== n 0) {0} {ev (- n 1)}})\n"
+    "(print (ev 1000) (od 7) (ev 7))\n"
+    "(fun {dv a b} {/ a b})\n"
+    "(print (dv 7 2) (dv -9223372036854775808 -1))\n"
+    "(print (dv 1 0))\n"
+    "(fun {sh +} {+ 1})\n"
+    "(fun {usesh x} {sh x})\n"
+    "(print (map (\\ {x} {ev x}) {1 2 3}))\n"
+    "(fun {fl x} {* x 2})\n"
+    "(print (fl 2.5) (fl 4))\n" },
+};
+
+int main(int argc, char** argv) {
+  qsp_vm* vm = qsp_new();
+  int status = qsp_run_compiled(vm, QSPC_SOURCES, 2, QSPC_NATIVES, 5);
+  qsp_del(vm);
+  return status;
+}
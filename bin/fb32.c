@@ -0,0 +1,162 @@
+/* Generated by qspc, do not edit. */
+#include "qsp.h"
+#include <limits.h>
+
+#define QSPC_MAX_DEPTH 4096
+#define QSPC_BAIL { ctx->failed = 1; goto done; }
+
+static long qspc_18(long* args, ljit_ctx* ctx);
+static long qspc_19(long* args, ljit_ctx* ctx);
+static long qspc_20(long* args, ljit_ctx* ctx);
+static long qspc_31(long* args, ljit_ctx* ctx);
+
+/* not */
+static long qspc_18(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = 1L;
+	t1 = args[0];
+	if (__builtin_sub_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_18_syms[] = {
+  { "not", NULL, 4046182697u },
+  { "-", builtin_sub, 0u },
+};
+
+/* or */
+static long qspc_19(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[1];
+	if (__builtin_add_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_19_syms[] = {
+  { "or", NULL, 935053u },
+  { "+", builtin_add, 0u },
+};
+
+/* and */
+static long qspc_20(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[1];
+	if (__builtin_mul_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_20_syms[] = {
+  { "and", NULL, 935756u },
+  { "*", builtin_mul, 0u },
+};
+
+/* fib */
+static long qspc_31(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 2L;
+	t2 = t0 < t1;
+	if (t2) {
+	t4 = args[0];
+	t3 = t4;
+	} else {
+	t5 = args[0];
+	t6 = 1L;
+	if (__builtin_sub_overflow(t5, t6, &t7)) QSPC_BAIL;
+	{
+	long a[2] = { t7, 0 };
+	t8 = qspc_31(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	t9 = args[0];
+	t10 = 2L;
+	if (__builtin_sub_overflow(t9, t10, &t11)) QSPC_BAIL;
+	{
+	long a[2] = { t11, 0 };
+	t12 = qspc_31(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	if (__builtin_add_overflow(t8, t12, &t13)) QSPC_BAIL;
+	t3 = t13;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_31_syms[] = {
+  { "fib", NULL, 2730966493u },
+  { "if", builtin_if, 0u },
+  { "<", builtin_lt, 0u },
+  { "+", builtin_add, 0u },
+  { "-", builtin_sub, 0u },
+};
+
+static const ljit_native QSPC_NATIVES[] = {
+  { "not", qspc_18, qspc_18_syms, sizeof(qspc_18_syms) / sizeof(ljit_sym) },
+  { "or", qspc_19, qspc_19_syms, sizeof(qspc_19_syms) / sizeof(ljit_sym) },
+  { "and", qspc_20, qspc_20_syms, sizeof(qspc_20_syms) / sizeof(ljit_sym) },
+  { "fib", qspc_31, qspc_31_syms, sizeof(qspc_31_syms) / sizeof(ljit_sym) },
+  { NULL, NULL, NULL, 0 }
+};
+
+static const qsp_source QSPC_SOURCES[] = {
+  { "./src/corelib/core.qsp",
+    "(def {false} 0)\n"
+    "(def {true} 1)\n"
+    "(def {nil} {})\n"
+    "(def {ok} ())\n"
+    "(def {otherwise} true)\n"
+    "(def {fun} (\\ {args body} {def (head args) (\\ (tail args) body)}))\n"
+    "(fun {fst l} {eval (head l)})\n"
+    "(fun {snd l} {eval (head (tail l))})\n"
+    "(fun {trd l} {eval (head (tail (tail l)))})\n"
+    "(fun {unpack f xs} {eval (join (list f) xs)})\n"
+    "(fun {pack f & xs} {f xs})\n"
+    "(def {curry} {unpack})\n"
+    "(def {uncurry} {pack})\n"
+    "(fun {rev l} {if (== l nil) {nil} {join (rev (tail l)) (head l)}})\n"
+    "(fun {nth n l} {if (== n 0) {head l} {nth (- n 1) (tail l)}})\n"
+    "(fun {last l} {if (== 1 (len l)) {head l} {last (tail l)}})\n"
+    "(fun {flip f x y} {f y x})\n"
+    "(fun {ghost & xs} {eval xs})\n"
+    "(fun {comp f g x} {f (g x)})\n"
+    "(fun {not x} {- 1 x})\n"
+    "(fun {or x y} {+ x y})\n"
+    "(fun {and x y} {* x y})\n"
+    "(defmacro {let b} {list (sexpr (join {\\ {_}} (list b))) ()})\n"
+    "(fun {take n l} {if (== n 0) {nil} {join (head l) (take (- n 1) (tail l))}})\n"
+    "(fun {drop n l} {if (== n 0) {l} {drop (- n 1) (tail l)}})\n"
+    "(fun {split n l} {list (take n l) (drop n l)})\n"
+    "(fun {elem x l} {if (== l nil) {false} {if (== x (fst l)) {true} {elem x (tail l)}}})\n"
+    "(fun {map f l} {if (== l nil) {nil} {join (list (f (fst l))) (map f (tail l))}})\n"
+    "(fun {filter f l} {if (== l nil) {nil} {join (if (f (fst l)) {head l} {nil}) (filter f (tail l))}})\n"
+    "(fun {foldl f z l} {if (== l nil) {z} {foldl f (f z (fst l)) (tail l)}})\n"
+    "(fun {sum l} {foldl + 0 l})\n"
+    "(fun {product l} {foldl + 1 l})\n" },
+  { "/tmp/fb32.qsp",
+    "(fun {fib n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}) (print (fib 32))\n" },
+};
+
+int main(int argc, char** argv) {
+  qsp_vm* vm = qsp_new();
+  int status = qsp_run_compiled(vm, QSPC_SOURCES, 2, QSPC_NATIVES, 4);
+  qsp_del(vm);
+  return status;
+}
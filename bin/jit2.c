@@ -0,0 +1,421 @@
+/* Generated by qspc, do not edit. */
+#include "qsp.h"
+#include <limits.h>
+
+#define QSPC_MAX_DEPTH 4096
+#define QSPC_BAIL { ctx->failed = 1; goto done; }
+
+static long qspc_18(long* args, ljit_ctx* ctx);
+static long qspc_19(long* args, ljit_ctx* ctx);
+static long qspc_20(long* args, ljit_ctx* ctx);
+static long qspc_31(long* args, ljit_ctx* ctx);
+static long qspc_32(long* args, ljit_ctx* ctx);
+static long qspc_33(long* args, ljit_ctx* ctx);
+static long qspc_34(long* args, ljit_ctx* ctx);
+static long qspc_35(long* args, ljit_ctx* ctx);
+static long qspc_36(long* args, ljit_ctx* ctx);
+static long qspc_37(long* args, ljit_ctx* ctx);
+static long qspc_38(long* args, ljit_ctx* ctx);
+
+/* not */
+static long qspc_18(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = 1L;
+	t1 = args[0];
+	if (__builtin_sub_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_18_syms[] = {
+  { "not", NULL, 4046182697u },
+  { "-", builtin_sub, 0u },
+};
+
+/* or */
+static long qspc_19(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[1];
+	if (__builtin_add_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_19_syms[] = {
+  { "or", NULL, 935053u },
+  { "+", builtin_add, 0u },
+};
+
+/* and */
+static long qspc_20(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[1];
+	if (__builtin_mul_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_20_syms[] = {
+  { "and", NULL, 935756u },
+  { "*", builtin_mul, 0u },
+};
+
+/* fib */
+static long qspc_31(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 2L;
+	t2 = t0 < t1;
+	if (t2) {
+	t4 = args[0];
+	t3 = t4;
+	} else {
+	t5 = args[0];
+	t6 = 1L;
+	if (__builtin_sub_overflow(t5, t6, &t7)) QSPC_BAIL;
+	{
+	long a[2] = { t7, 0 };
+	t8 = qspc_31(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	t9 = args[0];
+	t10 = 2L;
+	if (__builtin_sub_overflow(t9, t10, &t11)) QSPC_BAIL;
+	{
+	long a[2] = { t11, 0 };
+	t12 = qspc_31(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	if (__builtin_add_overflow(t8, t12, &t13)) QSPC_BAIL;
+	t3 = t13;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_31_syms[] = {
+  { "fib", NULL, 2730966493u },
+  { "if", builtin_if, 0u },
+  { "<", builtin_lt, 0u },
+  { "+", builtin_add, 0u },
+  { "-", builtin_sub, 0u },
+};
+
+/* sq */
+static long qspc_32(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[0];
+	if (__builtin_mul_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_32_syms[] = {
+  { "sq", NULL, 966674u },
+  { "*", builtin_mul, 0u },
+};
+
+/* neg */
+static long qspc_33(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	if (t0 == LONG_MIN) QSPC_BAIL;
+	t1 = -t0;
+	r = t1;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_33_syms[] = {
+  { "neg", NULL, 32371u },
+  { "-", builtin_sub, 0u },
+};
+
+/* cmp */
+static long qspc_34(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19, t20, t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31, t32;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = args[1];
+	t2 = t0 < t1;
+	t3 = 2L;
+	t4 = args[0];
+	t5 = args[1];
+	t6 = t4 <= t5;
+	if (__builtin_mul_overflow(t3, t6, &t7)) QSPC_BAIL;
+	if (__builtin_add_overflow(t2, t7, &t8)) QSPC_BAIL;
+	t9 = 4L;
+	t10 = args[0];
+	t11 = args[1];
+	t12 = t10 > t11;
+	if (__builtin_mul_overflow(t9, t12, &t13)) QSPC_BAIL;
+	if (__builtin_add_overflow(t8, t13, &t14)) QSPC_BAIL;
+	t15 = 8L;
+	t16 = args[0];
+	t17 = args[1];
+	t18 = t16 >= t17;
+	if (__builtin_mul_overflow(t15, t18, &t19)) QSPC_BAIL;
+	if (__builtin_add_overflow(t14, t19, &t20)) QSPC_BAIL;
+	t21 = 16L;
+	t22 = args[0];
+	t23 = args[1];
+	t24 = t22 == t23;
+	if (__builtin_mul_overflow(t21, t24, &t25)) QSPC_BAIL;
+	if (__builtin_add_overflow(t20, t25, &t26)) QSPC_BAIL;
+	t27 = 32L;
+	t28 = args[0];
+	t29 = args[1];
+	t30 = t28 != t29;
+	if (__builtin_mul_overflow(t27, t30, &t31)) QSPC_BAIL;
+	if (__builtin_add_overflow(t26, t31, &t32)) QSPC_BAIL;
+	r = t32;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_34_syms[] = {
+  { "cmp", NULL, 954524287u },
+  { "+", builtin_add, 0u },
+  { "<", builtin_lt, 0u },
+  { "*", builtin_mul, 0u },
+  { "<=", builtin_le, 0u },
+  { ">", builtin_gt, 0u },
+  { ">=", builtin_ge, 0u },
+  { "==", builtin_eq, 0u },
+  { "!=", builtin_ne, 0u },
+};
+
+/* down */
+static long qspc_35(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 0L;
+	t2 = t0 == t1;
+	if (t2) {
+	t4 = 0L;
+	t3 = t4;
+	} else {
+	t5 = 1L;
+	t6 = args[0];
+	t7 = 1L;
+	if (__builtin_sub_overflow(t6, t7, &t8)) QSPC_BAIL;
+	{
+	long a[2] = { t8, 0 };
+	t9 = qspc_35(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	if (__builtin_add_overflow(t5, t9, &t10)) QSPC_BAIL;
+	t3 = t10;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_35_syms[] = {
+  { "down", NULL, 4047567858u },
+  { "if", builtin_if, 0u },
+  { "==", builtin_eq, 0u },
+  { "+", builtin_add, 0u },
+  { "-", builtin_sub, 0u },
+};
+
+/* tri */
+static long qspc_36(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 0L;
+	t2 = t0 <= t1;
+	if (t2) {
+	t4 = args[1];
+	t3 = t4;
+	} else {
+	t5 = args[0];
+	t6 = 1L;
+	if (__builtin_sub_overflow(t5, t6, &t7)) QSPC_BAIL;
+	t8 = args[1];
+	t9 = args[0];
+	if (__builtin_add_overflow(t8, t9, &t10)) QSPC_BAIL;
+	{
+	long a[3] = { t7, t10, 0 };
+	t11 = qspc_36(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	t3 = t11;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_36_syms[] = {
+  { "tri", NULL, 2692221297u },
+  { "if", builtin_if, 0u },
+  { "<=", builtin_le, 0u },
+  { "-", builtin_sub, 0u },
+  { "+", builtin_add, 0u },
+};
+
+/* big */
+static long qspc_37(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 1L;
+	t2 = t0 < t1;
+	if (t2) {
+	t4 = 9223372036854775807L;
+	t3 = t4;
+	} else {
+	t5 = 1L;
+	t6 = args[0];
+	t7 = 1L;
+	if (__builtin_sub_overflow(t6, t7, &t8)) QSPC_BAIL;
+	{
+	long a[2] = { t8, 0 };
+	t9 = qspc_37(a, ctx);
+	}
+	if (ctx->failed) QSPC_BAIL;
+	if (__builtin_add_overflow(t5, t9, &t10)) QSPC_BAIL;
+	t3 = t10;
+	}
+	r = t3;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_37_syms[] = {
+  { "big", NULL, 3959409151u },
+  { "if", builtin_if, 0u },
+  { "<", builtin_lt, 0u },
+  { "+", builtin_add, 0u },
+  { "-", builtin_sub, 0u },
+};
+
+/* k */
+static long qspc_38(long* args, ljit_ctx* ctx) {
+	long r = 0, t0, t1, t2;
+	if (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;
+	t0 = args[0];
+	t1 = 1L;
+	if (__builtin_add_overflow(t0, t1, &t2)) QSPC_BAIL;
+	r = t2;
+done:
+	ctx->depth--;
+	return r;
+}
+
+static const ljit_sym qspc_38_syms[] = {
+  { "k", NULL, 1378384435u },
+  { "+", builtin_add, 0u },
+};
+
+static const ljit_native QSPC_NATIVES[] = {
+  { "not", qspc_18, qspc_18_syms, sizeof(qspc_18_syms) / sizeof(ljit_sym) },
+  { "or", qspc_19, qspc_19_syms, sizeof(qspc_19_syms) / sizeof(ljit_sym) },
+  { "and", qspc_20, qspc_20_syms, sizeof(qspc_20_syms) / sizeof(ljit_sym) },
+  { "fib", qspc_31, qspc_31_syms, sizeof(qspc_31_syms) / sizeof(ljit_sym) },
+  { "sq", qspc_32, qspc_32_syms, sizeof(qspc_32_syms) / sizeof(ljit_sym) },
+  { "neg", qspc_33, qspc_33_syms, sizeof(qspc_33_syms) / sizeof(ljit_sym) },
+  { "cmp", qspc_34, qspc_34_syms, sizeof(qspc_34_syms) / sizeof(ljit_sym) },
+  { "down", qspc_35, qspc_35_syms, sizeof(qspc_35_syms) / sizeof(ljit_sym) },
+  { "tri", qspc_36, qspc_36_syms, sizeof(qspc_36_syms) / sizeof(ljit_sym) },
+  { "big", qspc_37, qspc_37_syms, sizeof(qspc_37_syms) / sizeof(ljit_sym) },
+  { "k", qspc_38, qspc_38_syms, sizeof(qspc_38_syms) / sizeof(ljit_sym) },
+  { NULL, NULL, NULL, 0 }
+};
+
+static const qsp_source QSPC_SOURCES[] = {
+  { "./src/corelib/core.qsp",
+    "(def {false} 0)\n"
+    "(def {true} 1)\n"
+    "(def {nil} {})\n"
+    "(def {ok} ())\n"
+    "(def {otherwise} true)\n"
+    "(def {fun} (\\ {args body} {def (head args) (\\ (tail args) body)}))\n"
+    "(fun {fst l} {eval (head l)})\n"
+    "(fun {snd l} {eval (head (tail l))})\n"
+    "(fun {trd l} {eval (head (tail (tail l)))})\n"
+    "(fun {unpack f xs} {eval (join (list f) xs)})\n"
+    "(fun {pack f & xs} {f xs})\n"
+    "(def {curry} {unpack})\n"
+    "(def {uncurry} {pack})\n"
+    "(fun {rev l} {if (== l nil) {nil} {join (rev (tail l)) (head l)}})\n"
+    "(fun {nth n l} {if (== n 0) {head l} {nth (- n 1) (tail l)}})\n"
+    "(fun {last l} {if (== 1 (len l)) {head l} {last (tail l)}})\n"
+    "(fun {flip f x y} {f y x})\n"
+    "(fun {ghost & xs} {eval xs})\n"
+    "(fun {comp f g x} {f (g x)})\n"
+    "(fun {not x} {- 1 x})\n"
+    "(fun {or x y} {+ x y})\n"
+    "(fun {and x y} {* x y})\n"
+    "(defmacro {let b} {list (sexpr (join {\\ {_}} (list b))) ()})\n"
+    "(fun {take n l} {if (== n 0) {nil} {join (head l) (take (- n 1) (tail l))}})\n"
+    "(fun {drop n l} {if (== n 0) {l} {drop (- n 1) (tail l)}})\n"
+    "(fun {split n l} {list (take n l) (drop n l)})\n"
+    "(fun {elem x l} {if (== l nil) {false} {if (== x (fst l)) {true} {elem x (tail l)}}})\n"
+    "(fun {map f l} {if (== l nil) {nil} {join (list (f (fst l))) (map f (tail l))}})\n"
+    "(fun {filter f l} {if (== l nil) {nil} {join (if (f (fst l)) {head l} {nil}) (filter f (tail l))}})\n"
+    "(fun {foldl f z l} {if (== l nil) {z} {foldl f (f z (fst l)) (tail l)}})\n"
+    "(fun {sum l} {foldl + 0 l})\n"
+    "(fun {product l} {foldl + 1 l})\n" },
+  { "/tmp/jit2.qsp",
+    "(fun {fib n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})\n"
+    "(print (fib 22))\n"
+    "(print (fib 22.0))\n"
+    "(fun {sq x} {* x x})\n"
+    "(print (last (map sq (collect (range 0 1500)))))\n"
+    "(print (sq 4000000000))\n"
+    "(print (sq 3037000499))\n"
+    "(print (sq 3037000500))\n"
+    "(fun {neg x} {- x})\n"
+    "(print (map neg {1 2 3}))\n"
+    "(print (last (map neg (collect (range 0 1500)))))\n"
+    "(print (neg -9223372036854775808))\n"
+    "(fun {cmp a b} {+ (< a b) (* 2 (<= a b)) (* 4 (> a b)) (* 8 (>= a b)) (* 16 (== a b)) (* 32 (!= a b))})\n"
+    "(print (take 5 (drop 997 (map (\\ {x} {cmp x 1000}) (collect (range 0 1200))))))\n"
+    "(fun {down n} {if (== n 0) {0} {+ 1 (down (- n 1))}})\n"
+    "(print (map down {1 10 100}))\n"
+    "(print (down 2000))\n"
+    "(fun {tri n acc} {if (<= n 0) {acc} {tri (- n 1) (+ acc n)}})\n"
+    "(print (tri 1000 0))\n"
+    "(print (tri 2000 0))\n"
+    "(fun {big n} {if (< n 1) {9223372036854775807} {+ 1 (big (- n 1))}})\n"
+    "(print (map big {0 1 2}))\n"
+    "(print (last (map (\\ {x} {big (- x x -3)}) (collect (range 0 1100)))))\n"
+    "(fun {k x} {+ x 1})\n"
+    "(print (last (map k (collect (range 0 1100)))))\n" },
+};
+
+int main(int argc, char** argv) {
+  qsp_vm* vm = qsp_new();
+  int status = qsp_run_compiled(vm, QSPC_SOURCES, 2, QSPC_NATIVES, 11);
+  qsp_del(vm);
+  return status;
+}
@@ -1,5 +1,4 @@
-#include "proto/mpc.h"
-#include "rt/lval.h"
+#include "rt/qsp.h"
 
 #ifdef _WIN32
 
@@ -23,165 +22,126 @@ void add_history(char* unused) {}
 
 #endif
 
-mpc_parser_t* Number;
-mpc_parser_t* String;
-mpc_parser_t* Symbol;
-mpc_parser_t* Comment;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* Qsp;
+#define BANNER "Qsp Version 0.0.3.0\nPress Ctrl+c to Exit\n\n"
 
-mem_heap* HEAP;
-
-lval* lval_read_num(mpc_ast_t* t) {
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+/* Evaluates forms given on command line, printing the error if any. Returns exit status. */
+int run_string(qsp_vm* vm, const char* src) {
+  lval* x = qsp_eval_string(vm, src);
+  int status = x->type == LVAL_ERR;
+  if (status) { lval_println(x); }
+  lval_del(x);
+  return status;
 }
 
-lval* lval_read_str(mpc_ast_t* t) {
-	t->contents[strlen(t->contents) - 1] = '\0'; // cut off final '"' character
-	char* unesc = (char*)malloc(strlen(t->contents)+1);
-	strcpy(unesc, t->contents+1);
+int run_script(qsp_vm* vm, const char* path) {
+  lval* x = qsp_eval_file(vm, path);
+  int status = x->type == LVAL_ERR;
+  if (status) { lval_println(x); }
+  lval_del(x);
+  return status;
+}
 
-	unesc = mpcf_unescape(unesc);
+void repl(qsp_vm* vm) {
+  while (1) {
+	//heap_print(HEAP);
+    lout_flush();
+    char* input = readline("qsp> ");
+    if (!input) { break; }
+    add_history(input);
 
-	lval* str = lval_str(unesc);
+    // whole line is evaluated as a single S-Expression
+    lval* x = qsp_read(vm, "<stdin>", input);
+    if (x->type != LVAL_ERR) {
+      x = qsp_eval(vm, x);
+    }
+    lval_println(x);
+    lval_del(x);
 
-	free(unesc);
-	return str;
+    free(input);
+  }
 }
 
-lval* lval_read(mpc_ast_t* t){
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
-  if (strstr(t->tag, "string")) { return lval_read_str(t); }
-
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-  else if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
-  else if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
-
-  for (int i = 0; i < t->children_num; ++i)
-  {
-	mpc_ast_t* child = t->children[i];
-
-    if (strcmp(child->contents, "(") == 0) { continue; }
-    if (strcmp(child->contents, ")") == 0) { continue; }
-    if (strcmp(child->contents, "}") == 0) { continue; }
-    if (strcmp(child->contents, "{") == 0) { continue; }
-    if (strcmp(child->tag,  "regex") == 0) { continue; }
-    if (strcmp(child->tag,  "comment") == 0) { continue; }
-
-    lval* parsed = lval_read(child);
-    x = lval_add(x, parsed);
+/*
+ * Usage: qsp [--no-jit] [--max-heap N] [--compact] [FILE...] [-e EXPR] [--script FILE] [-]
+ *
+ * Files are loaded in order. Without any of the options below the REPL is
+ * started afterwards, otherwise qsp exits once they're done:
+ *   -e EXPR        evaluates forms of EXPR
+ *   --script FILE  evaluates FILE, stopping at the first error
+ *   -              evaluates forms read from stdin as they arrive
+ *
+ * --no-jit keeps hot lambdas interpreted instead of compiling them.
+ * --max-heap N limits the heap to N values, 0 lifts the limit; running
+ * out raises an error. QSP_MAX_HEAP sets the same limit.
+ * --compact moves live values together between top level forms once the
+ * heap has grown, the same as setting QSP_COMPACT.
+ */
+int main(int argc, char** argv) {
+  int batch = 0;
+  for(int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--script") == 0 || strcmp(argv[i], "-") == 0) { batch = 1; }
+    if (strcmp(argv[i], "--no-jit") == 0) { ljit_enable(0); }
+    if (strcmp(argv[i], "--compact") == 0) { heap_compact_enable(1); }
+    if (strcmp(argv[i], "--max-heap") == 0 && i + 1 < argc) {
+      char* end;
+      long cells = strtol(argv[i + 1], &end, 10);
+      if (*end || end == argv[i + 1] || cells < 0) {
+        fprintf(stderr, "qsp: option --max-heap expects a number of values, got %s\n", argv[i + 1]);
+        return 2;
+      }
+      heap_set_default_max(cells);
+      i++;
+    }
   }
 
-  return x;
-}
+  if (!batch) {
+    lout_write(BANNER, strlen(BANNER));
+  }
 
-lval* builtin_load(lenv* e, lval* a) {
-	LASSERT_NUM("load", a, 1);
-	LASSERT_TYPE("load", a, 0, LVAL_STR);
-
-	// parse file given by string name
-	mpc_result_t r;
-	if(mpc_parse_contents(a->as.list.cell[0]->as.str, Qsp, &r)) {
-		// read contents
-		lval* expr = lval_read(r.output);
-		mpc_ast_delete(r.output);
-
-		while(expr->as.list.count) {
-			lval* x = lval_eval(e, lval_pop(expr, 0));
-			if(x->type == LVAL_ERR) { lval_print(x); }
-			lval_del(x);
-		}
-		// delete expressions and arguments
-		lval_del(expr);
-		lval_del(a);
-		return lval_sexpr();
-	} else {
-		// get parse error
-		char* err_msg = mpc_err_string(r.error);
-		mpc_err_delete(r.error);
-
-		lval* err = lval_err("Could not load library %s", err_msg);
-		free(err_msg);
-		lval_del(a);
-
-		return err;
-	}
-}
+  qsp_vm* vm = qsp_new();
+  lenv* e = qsp_env(vm);
+
+  int status = 0;
+  for(int i = 1; i < argc && status == 0; i++) {
+    if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--script") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "qsp: option %s requires an argument\n", argv[i]);
+        status = 2;
+        break;
+      }
+      status = argv[i][1] == 'e' ? run_string(vm, argv[i + 1]) : run_script(vm, argv[i + 1]);
+      i++;
+      continue;
+    }
 
-int main(int argc, char** argv) {
-  Number 	= mpc_new("number");
-  String 	= mpc_new("string");
-  Symbol 	= mpc_new("symbol");
-  Comment 	= mpc_new("comment");
-  Qexpr 	= mpc_new("qexpr");
-  Sexpr 	= mpc_new("sexpr");
-  Expr 		= mpc_new("expr");
-  Qsp 		= mpc_new("qsp");
-
-  mpca_lang(MPC_LANG_DEFAULT,
-		  "                                              \
-		    number  : /-?[0-9]+/ ;                       \
-		    symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; \
-		    string  : /\"(\\\\.|[^\"])*\"/ ;             \
-		    comment : /;[^\\r\\n]*/ ;                    \
-		    sexpr   : '(' <expr>* ')' ;                  \
-		    qexpr   : '{' <expr>* '}' ;                  \
-		    expr    : <number>  | <symbol> | <string>    \
-		            | <comment> | <sexpr>  | <qexpr>;    \
-		    qsp  : /^/ <expr>* /$/ ;                     \
-		  ",
-    Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Qsp);
-
-  puts("Qsp Version 0.0.3.0");
-  puts("Press Ctrl+c to Exit\n");
-  
-  HEAP = heap_new();
-  lenv* e = lenv_new();
-  lenv_add_builtins(e);
-  lenv_add_builtin(e, "load", builtin_load);
-
-  if(argc >= 2) {
-	  for(int i = 1; i < argc; i++) {
-		  // create argument list with a single argument being filename
-		  lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
-		  // pass to builtin load and get the result
-		  lval* x = builtin_load(e, args);
-
-		  if(x->type == LVAL_ERR) { lval_println(x); }
-
-		  lval_del(x);
-	  }
-  }
+    if (strcmp(argv[i], "-") == 0) {
+      status = qsp_eval_stream(vm, stdin) > 0;
+      continue;
+    }
 
-  while (1) {
-	//heap_print(HEAP);
-    char* input = readline("qsp> ");
-    add_history(input);
-    
-    mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Qsp, &r)) {
-      lval* x = lval_eval(e, lval_read(r.output));
-      lval_println(x);
-      lval_del(x);
-
-      mpc_ast_delete(r.output);
-      
-    } else {    
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+    if (strcmp(argv[i], "--no-jit") == 0 || strcmp(argv[i], "--compact") == 0) { continue; }
+    if (strcmp(argv[i], "--max-heap") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "qsp: option %s requires an argument\n", argv[i]);
+        status = 2;
+        break;
+      }
+      i++;
+      continue;
     }
-    
-    free(input);
+
+    // create argument list with a single argument being filename
+    lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
+    // pass to builtin load and get the result
+    lval* x = builtin_load(e, args);
+
+    if(x->type == LVAL_ERR) { lval_println(x); }
+
+    lval_del(x);
   }
-  lenv_del(e);
-  heap_del(HEAP);
-  
-  mpc_cleanup(8, Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Qsp);
-  
-  return 0;
+
+  if (!batch) { repl(vm); }
+
+  qsp_del(vm);
+  return status;
 }
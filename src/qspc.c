@@ -0,0 +1,526 @@
+#include "rt/qsp.h"
+#include <limits.h>
+#include <stdarg.h>
+
+/*
+ * Usage: qspc [-o OUT] FILE...
+ *
+ * Translates qsp files into C source of a standalone program, to be linked
+ * against libqsp. The program evaluates the files in order like
+ * 'qsp FILE... --script LAST' would, so every form keeps its exact meaning.
+ * On top of that, global functions doing only integer arithmetic - made of
+ * integer literals, formals, '+ - * /', comparisons, 'if' and calls to other
+ * such functions - are compiled to C functions on unboxed integers calling
+ * each other directly. These are attached to their lambdas once defined and
+ * handled like code compiled by the JIT: when they can't produce the same
+ * result as the interpreter (big integers, division by zero, arguments which
+ * aren't integers) the call is evaluated by the interpreter instead.
+ *
+ * Definitions are evaluated while compiling to get the very lambdas the
+ * program will define. The compiled code is only attached to a lambda of the
+ * same structural hash, so anything defined differently at runtime stays
+ * interpreted.
+ */
+
+#define QSPC_MAX_DEPTH 4096
+
+typedef struct {
+  const char* c;
+  lbuiltin    b;
+} qspc_op;
+
+static const qspc_op QSPC_OPS[] = {
+  { "builtin_add", builtin_add }, { "builtin_sub", builtin_sub },
+  { "builtin_mul", builtin_mul }, { "builtin_div", builtin_div },
+  { "builtin_lt", builtin_lt }, { "builtin_le", builtin_le },
+  { "builtin_gt", builtin_gt }, { "builtin_ge", builtin_ge },
+  { "builtin_eq", builtin_eq }, { "builtin_ne", builtin_ne },
+  { "builtin_if", builtin_if }
+};
+
+#define QSPC_NOPS (int)(sizeof(QSPC_OPS) / sizeof(QSPC_OPS[0]))
+
+/* Global function being compiled. */
+typedef struct {
+  char*   name;
+  lval*   f;
+  int     ok;
+  lbuf    code;     /* statements of the body */
+  int     temps;
+  int*    calls;    /* functions called, as indices */
+  int     ncalls;
+  char**  syms;     /* names called */
+  int     nsyms;
+} qspc_fn;
+
+typedef struct {
+  qspc_fn*  fns;
+  int       nfns;
+  lenv*     e;
+} qspc_prog;
+
+static void qspc_printf(lbuf* b, const char* fmt, ...) {
+  char s[512];
+  va_list va;
+  va_start(va, fmt);
+  vsnprintf(s, sizeof(s), fmt, va);
+  va_end(va);
+  lbuf_puts(b, s);
+}
+
+static int qspc_find(qspc_prog* p, const char* name) {
+  for (int i = 0; i < p->nfns; i++) {
+    if (strcmp(p->fns[i].name, name) == 0) { return i; }
+  }
+  return -1;
+}
+
+static const char* qspc_op_name(lbuiltin b) {
+  for (int i = 0; i < QSPC_NOPS; i++) {
+    if (QSPC_OPS[i].b == b) { return QSPC_OPS[i].c; }
+  }
+  return NULL;
+}
+
+static int qspc_formal(lval* f, const char* name) {
+  int r = -1;
+  for (int i = 0; i < f->as.fun->arity; i++) {
+    if (strcmp(LVAL_CELLS(f->as.fun->formals)[i]->as.sym, name) == 0) { r = i; }
+  }
+  return r;
+}
+
+static void qspc_add_sym(qspc_fn* fn, const char* name) {
+  for (int i = 0; i < fn->nsyms; i++) {
+    if (strcmp(fn->syms[i], name) == 0) { return; }
+  }
+  fn->syms = (char**)realloc(fn->syms, sizeof(char*) * (fn->nsyms + 1));
+  fn->syms[fn->nsyms++] = (char*)name;
+}
+
+static void qspc_add_call(qspc_fn* fn, int k) {
+  for (int i = 0; i < fn->ncalls; i++) {
+    if (fn->calls[i] == k) { return; }
+  }
+  fn->calls = (int*)realloc(fn->calls, sizeof(int) * (fn->ncalls + 1));
+  fn->calls[fn->ncalls++] = k;
+}
+
+static int qspc_expr(qspc_prog* p, qspc_fn* fn, lval* x);
+static int qspc_apply(qspc_prog* p, qspc_fn* fn, lval* x);
+
+/* Block evaluated the way 'eval' does, or a plain expression as a branch of 'if'. Returns temporary holding the value or -1. */
+static int qspc_block(qspc_prog* p, qspc_fn* fn, lval* b) {
+  if (b->type != LVAL_QEXPR) { return qspc_expr(p, fn, b); }
+  if (b->as.list.count == 1) { return qspc_expr(p, fn, LVAL_CELLS(b)[0]); }
+  return qspc_apply(p, fn, b);
+}
+
+static int qspc_expr(qspc_prog* p, qspc_fn* fn, lval* x) {
+  int t;
+  switch (x->type) {
+  case LVAL_NUM:
+    t = fn->temps++;
+    if (x->as.num == LONG_MIN) {
+      qspc_printf(&fn->code, "\tt%d = LONG_MIN;\n", t);
+    } else {
+      qspc_printf(&fn->code, "\tt%d = %ldL;\n", t, x->as.num);
+    }
+    return t;
+  case LVAL_SYM: {
+    int i = qspc_formal(fn->f, x->as.sym);
+    if (i < 0) { return -1; }
+    t = fn->temps++;
+    qspc_printf(&fn->code, "\tt%d = args[%d];\n", t, i);
+    return t;
+  }
+  case LVAL_SEXPR:
+    if (x->as.list.count == 1) { return qspc_expr(p, fn, LVAL_CELLS(x)[0]); }
+    return qspc_apply(p, fn, x);
+  }
+  return -1;
+}
+
+/* Left fold of arithmetic [op], giving up where the interpreter would need big integers or fail. */
+static int qspc_fold(qspc_prog* p, qspc_fn* fn, lval* x, lbuiltin op) {
+  int n = x->as.list.count;
+  int a = qspc_expr(p, fn, LVAL_CELLS(x)[1]);
+  if (a < 0) { return -1; }
+
+  if (n == 2 && op == builtin_sub) {
+    int t = fn->temps++;
+    qspc_printf(&fn->code, "\tif (t%d == LONG_MIN) QSPC_BAIL;\n\tt%d = -t%d;\n", a, t, a);
+    return t;
+  }
+
+  for (int i = 2; i < n; i++) {
+    int b = qspc_expr(p, fn, LVAL_CELLS(x)[i]);
+    if (b < 0) { return -1; }
+    int t = fn->temps++;
+    if (op == builtin_div) {
+      qspc_printf(&fn->code, "\tif (t%d == 0 || (t%d == LONG_MIN && t%d == -1)) QSPC_BAIL;\n\tt%d = t%d / t%d;\n",
+        b, a, b, t, a, b);
+    } else {
+      const char* f = op == builtin_add ? "add" : op == builtin_sub ? "sub" : "mul";
+      qspc_printf(&fn->code, "\tif (__builtin_%s_overflow(t%d, t%d, &t%d)) QSPC_BAIL;\n", f, a, b, t);
+    }
+    a = t;
+  }
+  return a;
+}
+
+static int qspc_compare(qspc_prog* p, qspc_fn* fn, lval* x, const char* op) {
+  if (x->as.list.count != 3) { return -1; }
+  int a = qspc_expr(p, fn, LVAL_CELLS(x)[1]);
+  if (a < 0) { return -1; }
+  int b = qspc_expr(p, fn, LVAL_CELLS(x)[2]);
+  if (b < 0) { return -1; }
+  int t = fn->temps++;
+  qspc_printf(&fn->code, "\tt%d = t%d %s t%d;\n", t, a, op, b);
+  return t;
+}
+
+static int qspc_if(qspc_prog* p, qspc_fn* fn, lval* x) {
+  if (x->as.list.count != 4) { return -1; }
+  int c = qspc_expr(p, fn, LVAL_CELLS(x)[1]);
+  if (c < 0) { return -1; }
+  int t = fn->temps++;
+  qspc_printf(&fn->code, "\tif (t%d) {\n", c);
+  int a = qspc_block(p, fn, LVAL_CELLS(x)[2]);
+  if (a < 0) { return -1; }
+  qspc_printf(&fn->code, "\tt%d = t%d;\n\t} else {\n", t, a);
+  int b = qspc_block(p, fn, LVAL_CELLS(x)[3]);
+  if (b < 0) { return -1; }
+  qspc_printf(&fn->code, "\tt%d = t%d;\n\t}\n", t, b);
+  return t;
+}
+
+/* Direct call of compiled function [k]. */
+static int qspc_call(qspc_prog* p, qspc_fn* fn, lval* x, int k) {
+  int n = x->as.list.count - 1;
+  if (n != p->fns[k].f->as.fun->arity) { return -1; }
+
+  int* a = (int*)malloc(sizeof(int) * (n + 1));
+  for (int i = 0; i < n; i++) {
+    a[i] = qspc_expr(p, fn, LVAL_CELLS(x)[i + 1]);
+    if (a[i] < 0) {
+      free(a);
+      return -1;
+    }
+  }
+
+  int t = fn->temps++;
+  qspc_printf(&fn->code, "\t{\n\tlong a[%d] = {", n + 1);
+  for (int i = 0; i < n; i++) { qspc_printf(&fn->code, " t%d,", a[i]); }
+  qspc_printf(&fn->code, " 0 };\n\tt%d = qspc_%d(a, ctx);\n\t}\n\tif (ctx->failed) QSPC_BAIL;\n", t, k);
+  free(a);
+  qspc_add_call(fn, k);
+  return t;
+}
+
+static int qspc_apply(qspc_prog* p, qspc_fn* fn, lval* x) {
+  if (x->as.list.count < 2) { return -1; }
+  lval* h = LVAL_CELLS(x)[0];
+  if (h->type != LVAL_SYM || qspc_formal(fn->f, h->as.sym) >= 0) { return -1; }
+
+  lval* v = lenv_get(p->e, h);
+  int k = qspc_find(p, h->as.sym);
+  lbuiltin b = (v->type == LVAL_FUN && !v->as.fun->macro) ? v->as.fun->builtin : NULL;
+  int lambda = k >= 0 && p->fns[k].f == v;
+  lval_del(v);
+  if (!lambda && !qspc_op_name(b)) { return -1; }
+  qspc_add_sym(fn, h->as.sym);
+
+  if (lambda) { return qspc_call(p, fn, x, k); }
+  if (b == builtin_add || b == builtin_sub || b == builtin_mul || b == builtin_div) { return qspc_fold(p, fn, x, b); }
+  if (b == builtin_lt) { return qspc_compare(p, fn, x, "<"); }
+  if (b == builtin_le) { return qspc_compare(p, fn, x, "<="); }
+  if (b == builtin_gt) { return qspc_compare(p, fn, x, ">"); }
+  if (b == builtin_ge) { return qspc_compare(p, fn, x, ">="); }
+  if (b == builtin_eq) { return qspc_compare(p, fn, x, "=="); }
+  if (b == builtin_ne) { return qspc_compare(p, fn, x, "!="); }
+  return qspc_if(p, fn, x);
+}
+
+static void qspc_compile(qspc_prog* p, qspc_fn* fn) {
+  lval* f = fn->f;
+  if (f->as.fun->variadic || f->as.fun->macro || f->as.fun->env->map->len != 0) { return; }
+
+  // names the body was optimized for are checked on entry like the ones it calls
+  lval* as = f->as.fun->assumed;
+  for (int i = 0; as && i < as->as.list.count; i += 2) {
+    lval* v = LVAL_CELLS(as)[i + 1];
+    if (v->type != LVAL_FUN || !qspc_op_name(v->as.fun->builtin)) { return; }
+    qspc_add_sym(fn, LVAL_CELLS(as)[i]->as.sym);
+  }
+
+  int r = qspc_block(p, fn, f->as.fun->body);
+  if (r >= 0) {
+    qspc_printf(&fn->code, "\tr = t%d;\n", r);
+    fn->ok = 1;
+  }
+}
+
+/* Marks [k] and every compiled function it calls in [seen]. */
+static void qspc_reach(qspc_prog* p, int k, char* seen) {
+  if (seen[k]) { return; }
+  seen[k] = 1;
+  for (int i = 0; i < p->fns[k].ncalls; i++) { qspc_reach(p, p->fns[k].calls[i], seen); }
+}
+
+/*
+ * Drops functions calling ones which weren't compiled, and functions where
+ * code running natively could see a name bound differently than on entry.
+ * Names are resolved dynamically, through formals of all callers, so no
+ * formal of a function on the way may shadow a name called further on.
+ */
+static int qspc_check(qspc_prog* p, int k, char* seen) {
+  memset(seen, 0, p->nfns);
+  qspc_reach(p, k, seen);
+  for (int i = 0; i < p->nfns; i++) {
+    if (seen[i] && !p->fns[i].ok) { return 0; }
+  }
+  for (int i = 0; i < p->nfns; i++) {
+    if (!seen[i]) { continue; }
+    for (int s = 0; s < p->fns[i].nsyms; s++) {
+      for (int j = 0; j < p->nfns; j++) {
+        if (seen[j] && qspc_formal(p->fns[j].f, p->fns[i].syms[s]) >= 0) { return 0; }
+      }
+    }
+  }
+  return 1;
+}
+
+/* Writes [s] as C string literal, continued on a new line after each line of [s] if [lines] is set. */
+static void qspc_emit_string(FILE* out, const char* s, int lines) {
+  fputs("\"", out);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '\n' && lines) {
+      fputs(s[1] ? "\\n\"\n    \"" : "\\n", out);
+    } else if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 32 || c > 126) {
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputs("\"", out);
+}
+
+static void qspc_emit_sym(FILE* out, const char* name, const char* builtin, unsigned int hash) {
+  fputs("  { ", out);
+  qspc_emit_string(out, name, 0);
+  fprintf(out, ", %s, %uu },\n", builtin ? builtin : "NULL", hash);
+}
+
+static void qspc_emit(qspc_prog* p, FILE* out, char** names, char** srcs, int nsrcs) {
+  char* seen = (char*)malloc(p->nfns + 1);
+
+  fputs("/* Generated by qspc, do not edit. */\n", out);
+  fputs("#include \"qsp.h\"\n#include <limits.h>\n\n", out);
+  fprintf(out, "#define QSPC_MAX_DEPTH %d\n", QSPC_MAX_DEPTH);
+  fputs("#define QSPC_BAIL { ctx->failed = 1; goto done; }\n\n", out);
+
+  for (int k = 0; k < p->nfns; k++) {
+    if (p->fns[k].ok) { fprintf(out, "static long qspc_%d(long* args, ljit_ctx* ctx);\n", k); }
+  }
+
+  int nnatives = 0;
+  for (int k = 0; k < p->nfns; k++) {
+    qspc_fn* fn = &p->fns[k];
+    if (!fn->ok) { continue; }
+    nnatives++;
+
+    if (!strstr(fn->name, "*/")) { fprintf(out, "\n/* %s */", fn->name); }
+    fprintf(out, "\nstatic long qspc_%d(long* args, ljit_ctx* ctx) {\n\tlong r = 0", k);
+    for (int t = 0; t < fn->temps; t++) { fprintf(out, ", t%d", t); }
+    fputs(";\n\tif (++ctx->depth > QSPC_MAX_DEPTH) QSPC_BAIL;\n", out);
+    fwrite(fn->code.data, 1, fn->code.len, out);
+    fputs("done:\n\tctx->depth--;\n\treturn r;\n}\n", out);
+
+    // names of everything reachable are checked on entry
+    fprintf(out, "\nstatic const ljit_sym qspc_%d_syms[] = {\n", k);
+    memset(seen, 0, p->nfns);
+    qspc_reach(p, k, seen);
+    qspc_emit_sym(out, fn->name, NULL, lval_hash(fn->f));
+    for (int i = 0; i < p->nfns; i++) {
+      if (!seen[i]) { continue; }
+      for (int s = 0; s < p->fns[i].nsyms; s++) {
+        const char* name = p->fns[i].syms[s];
+        int c = qspc_find(p, name);
+        lval* sym = lval_sym((char*)name);
+        lval* v = lenv_get(p->e, sym);
+        if (c >= 0 && p->fns[c].f == v) {
+          if (c != k) { qspc_emit_sym(out, name, NULL, lval_hash(v)); }
+        } else {
+          qspc_emit_sym(out, name, qspc_op_name(v->as.fun->builtin), 0);
+        }
+        lval_del(v);
+        lval_del(sym);
+      }
+    }
+    fputs("};\n", out);
+  }
+
+  fputs("\nstatic const ljit_native QSPC_NATIVES[] = {\n", out);
+  for (int k = 0; k < p->nfns; k++) {
+    if (p->fns[k].ok) {
+      fputs("  { ", out);
+      qspc_emit_string(out, p->fns[k].name, 0);
+      fprintf(out, ", qspc_%d, qspc_%d_syms, sizeof(qspc_%d_syms) / sizeof(ljit_sym) },\n", k, k, k);
+    }
+  }
+  fputs("  { NULL, NULL, NULL, 0 }\n};\n\nstatic const qsp_source QSPC_SOURCES[] = {\n", out);
+  for (int i = 0; i < nsrcs; i++) {
+    fputs("  { ", out);
+    qspc_emit_string(out, names[i], 0);
+    fputs(",\n    ", out);
+    qspc_emit_string(out, srcs[i], 1);
+    fputs(" },\n", out);
+  }
+  fputs("};\n\n", out);
+
+  fputs("int main(int argc, char** argv) {\n  qsp_vm* vm = qsp_new();\n", out);
+  fprintf(out, "  int status = qsp_run_compiled(vm, QSPC_SOURCES, %d, QSPC_NATIVES, %d);\n", nsrcs, nnatives);
+  fputs("  qsp_del(vm);\n  return status;\n}\n", out);
+
+  free(seen);
+}
+
+static char* qspc_slurp(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) { return NULL; }
+  int cap = 4096, len = 0, n;
+  char* s = (char*)malloc(cap);
+  while ((n = (int)fread(s + len, 1, cap - len - 1, f)) > 0) {
+    len += n;
+    if (len + 1 == cap) { cap *= 2; s = (char*)realloc(s, cap); }
+  }
+  fclose(f);
+  s[len] = '\0';
+  return s;
+}
+
+/* Value of a 'def' known to be evaluable without side effects. */
+static int qspc_pure(lval* x) {
+  if (x->type == LVAL_NUM || x->type == LVAL_FLOAT || x->type == LVAL_STR || x->type == LVAL_QEXPR) { return 1; }
+  return x->type == LVAL_SEXPR && x->as.list.count == 0;
+}
+
+/* Returns name defined by top level [form] if it's a definition to evaluate while compiling. */
+static lval* qspc_definition(lval* form) {
+  if (form->type != LVAL_SEXPR || form->as.list.count != 3) { return NULL; }
+  lval* h = LVAL_CELLS(form)[0];
+  lval* names = LVAL_CELLS(form)[1];
+  lval* v = LVAL_CELLS(form)[2];
+  if (h->type != LVAL_SYM || names->type != LVAL_QEXPR || names->as.list.count < 1) { return NULL; }
+  lval* name = LVAL_CELLS(names)[0];
+  if (name->type != LVAL_SYM) { return NULL; }
+
+  if ((strcmp(h->as.sym, "fun") == 0 || strcmp(h->as.sym, "defmacro") == 0) && v->type == LVAL_QEXPR) { return name; }
+  if (strcmp(h->as.sym, "def") == 0 && names->as.list.count == 1) {
+    int lambda = v->type == LVAL_SEXPR && v->as.list.count == 3 && LVAL_CELLS(v)[0]->type == LVAL_SYM
+      && strcmp(LVAL_CELLS(v)[0]->as.sym, "\\") == 0;
+    if (lambda || qspc_pure(v)) { return name; }
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  const char* path = NULL;
+  char** names = (char**)malloc(sizeof(char*) * argc);
+  char** srcs = (char**)malloc(sizeof(char*) * argc);
+  int nsrcs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      path = argv[++i];
+      continue;
+    }
+    srcs[nsrcs] = qspc_slurp(argv[i]);
+    if (!srcs[nsrcs]) {
+      fprintf(stderr, "qspc: can't read %s\n", argv[i]);
+      return 2;
+    }
+    names[nsrcs++] = argv[i];
+  }
+  if (nsrcs == 0) {
+    fprintf(stderr, "usage: qspc [-o OUT] FILE...\n");
+    return 2;
+  }
+
+  qsp_vm* vm = qsp_new();
+  qspc_prog p = { NULL, 0, qsp_env(vm) };
+  lval** files = (lval**)malloc(sizeof(lval*) * nsrcs);
+
+  // evaluate definitions to get the lambdas the program will define
+  for (int s = 0; s < nsrcs; s++) {
+    files[s] = qsp_read(vm, names[s], srcs[s]);
+    if (files[s]->type == LVAL_ERR) {
+      lval_println(files[s]);
+      lout_flush();
+      return 1;
+    }
+    for (int i = 0; i < files[s]->as.list.count; i++) {
+      lval* form = LVAL_CELLS(files[s])[i];
+      lval* name = qspc_definition(form);
+      if (!name) { continue; }
+      lval_del(lval_eval(p.e, lval_cp(form)));
+      if (qspc_find(&p, name->as.sym) < 0) {
+        p.fns = (qspc_fn*)realloc(p.fns, sizeof(qspc_fn) * (p.nfns + 1));
+        memset(&p.fns[p.nfns], 0, sizeof(qspc_fn));
+        p.fns[p.nfns++].name = name->as.sym;
+      }
+    }
+  }
+
+  for (int k = 0; k < p.nfns; k++) {
+    lval* sym = lval_sym(p.fns[k].name);
+    p.fns[k].f = lenv_get(p.e, sym);
+    lval_del(sym);
+  }
+  for (int k = 0; k < p.nfns; k++) {
+    lval* f = p.fns[k].f;
+    if (f->type == LVAL_FUN && !f->as.fun->builtin) { qspc_compile(&p, &p.fns[k]); }
+  }
+
+  // dropping a function may invalidate its callers, repeat until nothing changes
+  char* seen = (char*)malloc(p.nfns + 1);
+  for (int changed = 1; changed; ) {
+    changed = 0;
+    for (int k = 0; k < p.nfns; k++) {
+      if (p.fns[k].ok && !qspc_check(&p, k, seen)) {
+        p.fns[k].ok = 0;
+        changed = 1;
+      }
+    }
+  }
+  free(seen);
+
+  FILE* out = path ? fopen(path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "qspc: can't write %s\n", path);
+    return 2;
+  }
+  qspc_emit(&p, out, names, srcs, nsrcs);
+  if (path) { fclose(out); }
+
+  for (int k = 0; k < p.nfns; k++) {
+    lval_del(p.fns[k].f);
+    free(p.fns[k].code.data);
+    free(p.fns[k].calls);
+    free(p.fns[k].syms);
+  }
+  for (int s = 0; s < nsrcs; s++) {
+    lval_del(files[s]);
+    free(srcs[s]);
+  }
+  free(p.fns);
+  free(files);
+  free(names);
+  free(srcs);
+  qsp_del(vm);
+  return 0;
+}
@@ -0,0 +1,420 @@
+#include "bignum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+/* Below this many limbs schoolbook multiplication beats Karatsuba. */
+#define KARATSUBA_THRESHOLD 32
+
+#define LIMB_BITS 32
+#define DEC_BASE 1000000000u
+#define DEC_DIGITS 9
+
+lbig* lbig_alloc(int sign, int len) {
+	lbig* a = (lbig*)malloc(sizeof(lbig));
+	a->sign = sign;
+	a->len = len;
+	a->d = (uint32_t*)calloc(len > 0 ? len : 1, sizeof(uint32_t));
+	return a;
+}
+
+/* Drops leading zero limbs. */
+lbig* lbig_trim(lbig* a) {
+	while(a->len > 0 && a->d[a->len - 1] == 0) { a->len--; }
+	if(a->len == 0) { a->sign = 0; }
+	return a;
+}
+
+int mag_len(const uint32_t* a, int n) {
+	while(n > 0 && a[n - 1] == 0) { n--; }
+	return n;
+}
+
+int mag_cmp(const uint32_t* a, int an, const uint32_t* b, int bn) {
+	if(an != bn) { return an < bn ? -1 : 1; }
+	for(int i = an - 1; i >= 0; i--) {
+		if(a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+	}
+	return 0;
+}
+
+/* Adds [x] into [r], carry is propagated up to [rn] limbs. */
+void mag_add_into(uint32_t* r, int rn, const uint32_t* x, int xn) {
+	uint64_t carry = 0;
+	int i = 0;
+	for(; i < xn; i++) {
+		carry += (uint64_t)r[i] + x[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+	for(; carry && i < rn; i++) {
+		carry += r[i];
+		r[i] = (uint32_t)carry;
+		carry >>= LIMB_BITS;
+	}
+}
+
+/* Subtracts [x] from [r], [r] must not be smaller than [x]. */
+void mag_sub_into(uint32_t* r, int rn, const uint32_t* x, int xn) {
+	int64_t borrow = 0;
+	int i = 0;
+	for(; i < xn; i++) {
+		int64_t t = (int64_t)r[i] - x[i] - borrow;
+		borrow = t < 0;
+		r[i] = (uint32_t)t;
+	}
+	for(; borrow && i < rn; i++) {
+		borrow = r[i] == 0;
+		r[i]--;
+	}
+}
+
+/* Schoolbook multiplication, [out] must have an+bn zeroed limbs. */
+void mag_mul_school(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+	for(int i = 0; i < an; i++) {
+		uint64_t carry = 0;
+		uint64_t ai = a[i];
+		if(ai == 0) { continue; }
+		for(int j = 0; j < bn; j++) {
+			carry += ai * b[j] + out[i + j];
+			out[i + j] = (uint32_t)carry;
+			carry >>= LIMB_BITS;
+		}
+		out[i + bn] = (uint32_t)carry;
+	}
+}
+
+/* Multiplies magnitudes into zeroed [out] of an+bn limbs, using Karatsuba for large operands. */
+void mag_mul(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+	if(an < bn) {
+		const uint32_t* t = a; a = b; b = t;
+		int tn = an; an = bn; bn = tn;
+	}
+	if(bn < KARATSUBA_THRESHOLD) {
+		mag_mul_school(a, an, b, bn, out);
+		return;
+	}
+
+	int m = an / 2;
+	int n = an + bn;
+
+	if(bn <= m) {
+		// unbalanced operands: split the longer one only
+		uint32_t* t = (uint32_t*)calloc(n, sizeof(uint32_t));
+		mag_mul(a, m, b, bn, out);
+		mag_mul(a + m, an - m, b, bn, t);
+		mag_add_into(out + m, n - m, t, mag_len(t, an - m + bn));
+		free(t);
+		return;
+	}
+
+	// a = a1*B^m + a0, b = b1*B^m + b0
+	// a*b = z2*B^2m + (z1 - z2 - z0)*B^m + z0 where z1 = (a0+a1)*(b0+b1)
+	int sn = an - m + 1;
+	uint32_t* sa = (uint32_t*)calloc(sn, sizeof(uint32_t));
+	uint32_t* sb = (uint32_t*)calloc(sn, sizeof(uint32_t));
+	memcpy(sa, a + m, sizeof(uint32_t) * (an - m));
+	mag_add_into(sa, sn, a, m);
+	memcpy(sb, b + m, sizeof(uint32_t) * (bn - m));
+	mag_add_into(sb, sn, b, m);
+
+	uint32_t* z0 = (uint32_t*)calloc(2 * m, sizeof(uint32_t));
+	uint32_t* z1 = (uint32_t*)calloc(2 * sn, sizeof(uint32_t));
+	uint32_t* z2 = (uint32_t*)calloc(n - 2 * m, sizeof(uint32_t));
+	mag_mul(a, m, b, m, z0);
+	mag_mul(sa, mag_len(sa, sn), sb, mag_len(sb, sn), z1);
+	mag_mul(a + m, an - m, b + m, bn - m, z2);
+
+	int z0n = mag_len(z0, 2 * m);
+	int z2n = mag_len(z2, n - 2 * m);
+	mag_sub_into(z1, 2 * sn, z0, z0n);
+	mag_sub_into(z1, 2 * sn, z2, z2n);
+
+	memcpy(out, z0, sizeof(uint32_t) * z0n);
+	memcpy(out + 2 * m, z2, sizeof(uint32_t) * z2n);
+	mag_add_into(out + m, n - m, z1, mag_len(z1, 2 * sn));
+
+	free(sa); free(sb);
+	free(z0); free(z1); free(z2);
+}
+
+/* Divides [a] in place by a single limb, returning the remainder. */
+uint32_t mag_div_small(uint32_t* a, int an, uint32_t v) {
+	uint64_t rem = 0;
+	for(int i = an - 1; i >= 0; i--) {
+		uint64_t cur = (rem << LIMB_BITS) | a[i];
+		a[i] = (uint32_t)(cur / v);
+		rem = cur % v;
+	}
+	return (uint32_t)rem;
+}
+
+/* Knuth's algorithm D. Stores un/vn limbs of the quotient in [q], requires vn >= 2 and un >= vn. */
+void mag_divmod(const uint32_t* u, int un, const uint32_t* v, int vn, uint32_t* q) {
+	int s = __builtin_clz(v[vn - 1]);
+
+	// normalize so that the top bit of the divisor is set
+	uint32_t* nv = (uint32_t*)malloc(sizeof(uint32_t) * vn);
+	uint32_t* nu = (uint32_t*)malloc(sizeof(uint32_t) * (un + 1));
+	for(int i = vn - 1; i > 0; i--) {
+		nv[i] = (v[i] << s) | (s ? v[i - 1] >> (LIMB_BITS - s) : 0);
+	}
+	nv[0] = v[0] << s;
+	nu[un] = s ? u[un - 1] >> (LIMB_BITS - s) : 0;
+	for(int i = un - 1; i > 0; i--) {
+		nu[i] = (u[i] << s) | (s ? u[i - 1] >> (LIMB_BITS - s) : 0);
+	}
+	nu[0] = u[0] << s;
+
+	const uint64_t base = (uint64_t)1 << LIMB_BITS;
+	for(int j = un - vn; j >= 0; j--) {
+		uint64_t num = ((uint64_t)nu[j + vn] << LIMB_BITS) | nu[j + vn - 1];
+		uint64_t qhat = num / nv[vn - 1];
+		uint64_t rhat = num % nv[vn - 1];
+
+		while(qhat >= base || qhat * nv[vn - 2] > ((rhat << LIMB_BITS) | nu[j + vn - 2])) {
+			qhat--;
+			rhat += nv[vn - 1];
+			if(rhat >= base) { break; }
+		}
+
+		// multiply and subtract
+		int64_t k = 0, t;
+		for(int i = 0; i < vn; i++) {
+			uint64_t p = qhat * nv[i];
+			t = (int64_t)nu[i + j] - k - (int64_t)(p & 0xFFFFFFFF);
+			nu[i + j] = (uint32_t)t;
+			k = (int64_t)(p >> LIMB_BITS) - (t >> LIMB_BITS);
+		}
+		t = (int64_t)nu[j + vn] - k;
+		nu[j + vn] = (uint32_t)t;
+
+		q[j] = (uint32_t)qhat;
+		if(t < 0) {
+			// estimate was one too large, add the divisor back
+			q[j]--;
+			uint64_t c = 0;
+			for(int i = 0; i < vn; i++) {
+				c += (uint64_t)nu[i + j] + nv[i];
+				nu[i + j] = (uint32_t)c;
+				c >>= LIMB_BITS;
+			}
+			nu[j + vn] += (uint32_t)c;
+		}
+	}
+
+	free(nv);
+	free(nu);
+}
+
+lbig* lbig_from_ulong(int sign, unsigned long x) {
+	lbig* a = lbig_alloc(sign, (int)((sizeof(unsigned long) + 3) / 4));
+	for(int i = 0; i < a->len; i++) {
+		a->d[i] = (uint32_t)x;
+		x = sizeof(unsigned long) > 4 ? x >> 16 >> 16 : 0;
+	}
+	return lbig_trim(a);
+}
+
+lbig* lbig_from_long(long x) {
+	// negate in unsigned arithmetic, so LONG_MIN does not overflow
+	return x < 0 ? lbig_from_ulong(-1, 0UL - (unsigned long)x) : lbig_from_ulong(1, (unsigned long)x);
+}
+
+lbig* lbig_from_double(double x) {
+	if(isnan(x) || isinf(x) || fabs(x) < 1.0) { return lbig_alloc(0, 0); }
+
+	int exp;
+	double m = frexp(fabs(x), &exp);
+	if(exp <= 53) { return lbig_from_long((long)x); }
+
+	// x = mant * 2^(exp - 53)
+	uint64_t mant = (uint64_t)ldexp(m, 53);
+	int shift = exp - 53;
+	int words = shift / LIMB_BITS;
+	int bits = shift % LIMB_BITS;
+
+	lbig* a = lbig_alloc(x < 0 ? -1 : 1, words + 3);
+	a->d[words] = (uint32_t)(mant << bits);
+	a->d[words + 1] = (uint32_t)((mant << bits) >> LIMB_BITS);
+	a->d[words + 2] = bits ? (uint32_t)(mant >> (64 - bits)) : 0;
+	return lbig_trim(a);
+}
+
+lbig* lbig_from_str(const char* s) {
+	int sign = 1;
+	if(*s == '-') { sign = -1; s++; }
+	else if(*s == '+') { s++; }
+
+	int ndigits = (int)strlen(s);
+	lbig* a = lbig_alloc(sign, ndigits / DEC_DIGITS + 2);
+	int n = 0;
+
+	// consume digits in chunks of 9: a = a * 10^k + chunk
+	int first = ndigits % DEC_DIGITS ? ndigits % DEC_DIGITS : DEC_DIGITS;
+	for(int i = 0; i < ndigits; ) {
+		int k = i == 0 ? first : DEC_DIGITS;
+		uint32_t chunk = 0, scale = 1;
+		for(int j = 0; j < k; j++, i++) {
+			chunk = chunk * 10 + (uint32_t)(s[i] - '0');
+			scale *= 10;
+		}
+
+		uint64_t carry = chunk;
+		for(int j = 0; j < n; j++) {
+			carry += (uint64_t)a->d[j] * scale;
+			a->d[j] = (uint32_t)carry;
+			carry >>= LIMB_BITS;
+		}
+		if(carry) { a->d[n++] = (uint32_t)carry; }
+	}
+
+	a->len = n;
+	return lbig_trim(a);
+}
+
+lbig* lbig_copy(lbig* a) {
+	lbig* b = lbig_alloc(a->sign, a->len);
+	memcpy(b->d, a->d, sizeof(uint32_t) * a->len);
+	return b;
+}
+
+void lbig_del(lbig* a) {
+	free(a->d);
+	free(a);
+}
+
+lbig* lbig_neg(lbig* a) {
+	lbig* b = lbig_copy(a);
+	b->sign = -b->sign;
+	return b;
+}
+
+/* Adds magnitudes of [a] and [b] with signs [as] and [bs]. */
+lbig* lbig_add_signed(lbig* a, int as, lbig* b, int bs) {
+	if(as == 0) { lbig* r = lbig_copy(b); r->sign = bs; return r; }
+	if(bs == 0) { lbig* r = lbig_copy(a); r->sign = as; return r; }
+
+	if(as == bs) {
+		int n = (a->len > b->len ? a->len : b->len) + 1;
+		lbig* r = lbig_alloc(as, n);
+		memcpy(r->d, a->d, sizeof(uint32_t) * a->len);
+		mag_add_into(r->d, n, b->d, b->len);
+		return lbig_trim(r);
+	}
+
+	int c = mag_cmp(a->d, a->len, b->d, b->len);
+	if(c == 0) { return lbig_alloc(0, 0); }
+	if(c < 0) {
+		lbig* t = a; a = b; b = t;
+		as = bs;
+	}
+	lbig* r = lbig_copy(a);
+	r->sign = as;
+	mag_sub_into(r->d, r->len, b->d, b->len);
+	return lbig_trim(r);
+}
+
+lbig* lbig_add(lbig* a, lbig* b) {
+	return lbig_add_signed(a, a->sign, b, b->sign);
+}
+
+lbig* lbig_sub(lbig* a, lbig* b) {
+	return lbig_add_signed(a, a->sign, b, -b->sign);
+}
+
+lbig* lbig_mul(lbig* a, lbig* b) {
+	if(a->sign == 0 || b->sign == 0) { return lbig_alloc(0, 0); }
+
+	lbig* r = lbig_alloc(a->sign * b->sign, a->len + b->len);
+	mag_mul(a->d, a->len, b->d, b->len, r->d);
+	return lbig_trim(r);
+}
+
+lbig* lbig_div(lbig* a, lbig* b) {
+	if(mag_cmp(a->d, a->len, b->d, b->len) < 0) { return lbig_alloc(0, 0); }
+
+	lbig* q = lbig_alloc(a->sign * b->sign, a->len - b->len + 1);
+	if(b->len == 1) {
+		memcpy(q->d, a->d, sizeof(uint32_t) * a->len);
+		q->len = a->len;
+		mag_div_small(q->d, q->len, b->d[0]);
+	} else {
+		mag_divmod(a->d, a->len, b->d, b->len, q->d);
+	}
+	return lbig_trim(q);
+}
+
+int lbig_cmp(lbig* a, lbig* b) {
+	if(a->sign != b->sign) { return a->sign < b->sign ? -1 : 1; }
+	return a->sign * mag_cmp(a->d, a->len, b->d, b->len);
+}
+
+int lbig_to_long(lbig* a, long* out) {
+	if(a->len * 4 > (int)sizeof(unsigned long)) { return 0; }
+
+	unsigned long m = 0;
+	for(int i = a->len - 1; i >= 0; i--) {
+		m = (sizeof(unsigned long) > 4 ? m << 16 << 16 : 0) | a->d[i];
+	}
+
+	if(a->sign >= 0) {
+		if(m > (unsigned long)LONG_MAX) { return 0; }
+		*out = (long)m;
+	} else {
+		if(m > (unsigned long)LONG_MAX + 1) { return 0; }
+		*out = m == (unsigned long)LONG_MAX + 1 ? LONG_MIN : -(long)m;
+	}
+	return 1;
+}
+
+double lbig_to_double(lbig* a) {
+	double x = 0.0;
+	for(int i = a->len - 1; i >= 0; i--) {
+		x = x * 4294967296.0 + a->d[i];
+	}
+	return a->sign < 0 ? -x : x;
+}
+
+char* lbig_to_str(lbig* a) {
+	if(a->sign == 0) {
+		char* s = (char*)malloc(2);
+		strcpy(s, "0");
+		return s;
+	}
+
+	// split into base 10^9 chunks, least significant first
+	uint32_t* t = (uint32_t*)malloc(sizeof(uint32_t) * a->len);
+	memcpy(t, a->d, sizeof(uint32_t) * a->len);
+	int tn = a->len;
+
+	int cap = a->len * 10 / DEC_DIGITS + 2;
+	uint32_t* chunks = (uint32_t*)malloc(sizeof(uint32_t) * cap);
+	int n = 0;
+	while(tn > 0) {
+		chunks[n++] = mag_div_small(t, tn, DEC_BASE);
+		tn = mag_len(t, tn);
+	}
+
+	char* s = (char*)malloc(n * DEC_DIGITS + 2);
+	char* p = s;
+	if(a->sign < 0) { *p++ = '-'; }
+	p += sprintf(p, "%u", chunks[n - 1]);
+	for(int i = n - 2; i >= 0; i--) {
+		p += sprintf(p, "%09u", chunks[i]);
+	}
+
+	free(chunks);
+	free(t);
+	return s;
+}
+
+unsigned int lbig_hash(lbig* a) {
+	unsigned int h = 2166136261u ^ (unsigned int)a->sign;
+	for(int i = 0; i < a->len; i++) {
+		h = (h ^ a->d[i]) * 16777619u;
+	}
+	return h;
+}
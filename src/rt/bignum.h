@@ -0,0 +1,49 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stdint.h>
+
+/*
+ * Arbitrary precision integers. Magnitude is kept as little endian array of
+ * 32-bit limbs without leading zero limbs, zero has no limbs at all.
+ * All operations return newly allocated values and never modify arguments.
+ */
+
+struct lbig;
+typedef struct lbig lbig;
+
+struct lbig {
+	int 		sign;	/* -1, 0 or 1 */
+	int 		len;
+	uint32_t* 	d;
+};
+
+lbig* lbig_from_long(long x);
+lbig* lbig_from_double(double x);
+
+/* Parses decimal integer with optional leading '-'. */
+lbig* lbig_from_str(const char* s);
+
+lbig* lbig_copy(lbig* a);
+void lbig_del(lbig* a);
+
+lbig* lbig_neg(lbig* a);
+lbig* lbig_add(lbig* a, lbig* b);
+lbig* lbig_sub(lbig* a, lbig* b);
+lbig* lbig_mul(lbig* a, lbig* b);
+
+/* Divides [a] by non-zero [b], truncating towards zero. */
+lbig* lbig_div(lbig* a, lbig* b);
+
+int lbig_cmp(lbig* a, lbig* b);
+
+/* Returns 1 and stores value in [out] if [a] fits into a machine word. */
+int lbig_to_long(lbig* a, long* out);
+double lbig_to_double(lbig* a);
+
+/* Returns malloc'ed decimal representation of [a]. */
+char* lbig_to_str(lbig* a);
+
+unsigned int lbig_hash(lbig* a);
+
+#endif
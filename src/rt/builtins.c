@@ -2,6 +2,7 @@
 #include "hmap.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
 
 
 lval* builtin_lambda(lenv* e, lval* a) {
@@ -13,16 +14,24 @@ lval* builtin_lambda(lenv* e, lval* a) {
 	lval* formals = a->as.list.cell[0];
 
 	for(int i = 0; i < formals->as.list.count; i++) {
-		LASSERT(a, (formals->as.list.cell[i]->type == LVAL_SYM),
+		LASSERT(a, (LVAL_CELLS(formals)[i]->type == LVAL_SYM),
 			"Cannot define non-symbol. Got %s, expected %s.",
-			ltype_name(formals->as.list.cell[i]->type), ltype_name(LVAL_SYM));
+			ltype_name(LVAL_CELLS(formals)[i]->type), ltype_name(LVAL_SYM));
+	}
+
+	// '&' should always be followed by exactly one another symbol
+	for(int i = 0; i < formals->as.list.count; i++) {
+		LASSERT(a, (strcmp(LVAL_CELLS(formals)[i]->as.sym, "&") != 0 || i == formals->as.list.count - 2),
+			"Function format invalid. Symbol '&' not followed by single symbol.");
 	}
 
 	formals = lval_pop(a, 0);
-	lval* body = lval_pop(a, 0);
+	lval* source = lval_pop(a, 0);
+	lval* assumed;
+	lval* body = lval_optimize(e, formals, lval_cp(source), &assumed);
 	lval_del(a);
 
-	return lval_lambda(formals, body);
+	return lval_lambda_assume(lval_lambda(formals, body), source, assumed);
 }
 
 lval* builtin_head(lenv* e, lval* a) {
@@ -32,7 +41,8 @@ lval* builtin_head(lenv* e, lval* a) {
 	LASSERT_NOT_EMPTY("head", a, 0);
 
 	lval* h = lval_take(a, 0);
-	lval* head = lval_cp(h->as.list.cell[0]);
+	lval* head = lval_nth(h, 0);
+	lval_del(h);
 
 	// create new Q-Expression with head of previous one as only element
 	lval* q = lval_qexpr();
@@ -49,15 +59,13 @@ lval* builtin_tail(lenv* e, lval* a) {
 	LASSERT_NOT_EMPTY("tail", a, 0);
 
 	//take first
-	h = lval_take(a, 0);
+	h = lval_own(lval_take(a, 0));
 
-	// copy all elements except first to new Q-Expression
-	lval* q = lval_qexpr();
-	for(int i=1; i < h->as.list.count; i++) {
-		lval_add(q, lval_cp(h->as.list.cell[i]));
-	}
+	// delete first element and return
+	lval_del(lval_pop(h, 0));
+	lval_list_rehash(h);
 
-	return q;
+	return h;
 }
 
 lval* builtin_init(lenv* e, lval* a) {
@@ -69,7 +77,7 @@ lval* builtin_init(lenv* e, lval* a) {
 	LASSERT_NOT_EMPTY("init", a, 0);
 
 	//take first
-	h = lval_take(a, 0);
+	h = lval_own(lval_take(a, 0));
 
 	// delete first element and return
 	lval_del(lval_pop(h, h->as.list.count - 1));
@@ -79,7 +87,7 @@ lval* builtin_init(lenv* e, lval* a) {
 
 lval* builtin_list(lenv* e, lval* a) {
 	a->type = LVAL_QEXPR;
-	return a;
+	return lval_pack(a);
 }
 
 lval* builtin_eval(lenv* e, lval* a) {
@@ -87,7 +95,7 @@ lval* builtin_eval(lenv* e, lval* a) {
 	lval* h = a->as.list.cell[0];
 	LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-	h = lval_take(a, 0);
+	h = lval_own(lval_take(a, 0));
 	h->type = LVAL_SEXPR;
 	return lval_eval(e, h);
 }
@@ -95,15 +103,38 @@ lval* builtin_eval(lenv* e, lval* a) {
 
 lval* builtin_ord(lenv* e, lval* a, char* op) {
 	LASSERT_NUM(op, a, 2);
-	LASSERT_TYPE(op, a, 0, LVAL_NUM);
-	LASSERT_TYPE(op, a, 1, LVAL_NUM);
+	LASSERT_NUMERIC(op, a, 0);
+	LASSERT_NUMERIC(op, a, 1);
 
 	int r;
-
-	if(strcmp(op, ">") == 0) { r = (a->as.list.cell[0]->as.num > a->as.list.cell[1]->as.num); }
-	else if(strcmp(op, "<") == 0) { r = (a->as.list.cell[0]->as.num < a->as.list.cell[1]->as.num); }
-	else if(strcmp(op, ">=") == 0) { r = (a->as.list.cell[0]->as.num >= a->as.list.cell[1]->as.num); }
-	else if(strcmp(op, "<=") == 0) { r = (a->as.list.cell[0]->as.num <= a->as.list.cell[1]->as.num); }
+	lval* x = a->as.list.cell[0];
+	lval* y = a->as.list.cell[1];
+
+	if(x->type == LVAL_NUM && y->type == LVAL_NUM) {
+		if(strcmp(op, ">") == 0) { r = (x->as.num > y->as.num); }
+		else if(strcmp(op, "<") == 0) { r = (x->as.num < y->as.num); }
+		else if(strcmp(op, ">=") == 0) { r = (x->as.num >= y->as.num); }
+		else { r = (x->as.num <= y->as.num); }
+	} else if(x->type != LVAL_FLOAT && y->type != LVAL_FLOAT) {
+		lbig* xb = lval_to_big(x);
+		lbig* yb = lval_to_big(y);
+		int c = lbig_cmp(xb, yb);
+		lbig_del(xb);
+		lbig_del(yb);
+
+		if(strcmp(op, ">") == 0) { r = (c > 0); }
+		else if(strcmp(op, "<") == 0) { r = (c < 0); }
+		else if(strcmp(op, ">=") == 0) { r = (c >= 0); }
+		else { r = (c <= 0); }
+	} else {
+		// mixed comparisons are done on floats
+		double xf = lval_to_double(x);
+		double yf = lval_to_double(y);
+		if(strcmp(op, ">") == 0) { r = (xf > yf); }
+		else if(strcmp(op, "<") == 0) { r = (xf < yf); }
+		else if(strcmp(op, ">=") == 0) { r = (xf >= yf); }
+		else { r = (xf <= yf); }
+	}
 
 	lval_del(a);
 	return lval_num(r);
@@ -114,37 +145,26 @@ lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, "<="); }
 lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, ">"); }
 lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, ">="); }
 
+/* Special form of short circuiting [op] - 'and' stops at the first false operand, 'or' at the first true one. */
 lval* builtin_bool(lenv* e, lval* a, char* op) {
-	LASSERT_NUM(op, a, 2);
-	LASSERT_TYPE(op, a, 0, LVAL_NUM);
-	LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-	if(strcmp(op, "&&") == 0) {
-		lval* x = lval_pop(a, 0);
-		if(x->as.num != 0){
-			lval* y = lval_pop(a, 0);
-			lval_del(a);
+	int stop = strcmp(op, "&&") == 0 ? 0 : 1;
+	lval* h = LVAL_CELLS(a)[0];
+	char* name = h->type == LVAL_SYM ? h->as.sym : op;
+
+	lval* x = lval_num(!stop);
+	for(int i = 1; i < a->as.list.count; i++) {
+		lval_del(x);
+		x = lval_eval(e, lval_nth(a, i));
+		if(x->type == LVAL_ERR) { return x; }
+		if(x->type != LVAL_NUM) {
+			lval* err = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, expected %s.",
+				name, i - 1, ltype_name(x->type), ltype_name(LVAL_NUM));
 			lval_del(x);
-			return y;
-		} else {
-			lval_del(a);
-			return x;
+			return err;
 		}
+		if((x->as.num != 0) == stop) { break; }
 	}
-	else if(strcmp(op, "||") == 0) {
-		lval* x = lval_pop(a, 0);
-		if(x->as.num == 0){
-			lval* y = lval_pop(a, 0);
-			lval_del(a);
-			lval_del(x);
-			return y;
-		} else {
-			lval_del(a);
-			return x;
-		}
-	}
-
-	return lval_err("Unsupported logical operator '%s'.", op);
+	return x;
 }
 
 lval* builtin_and(lenv* e, lval* a) { return builtin_bool(e, a, "&&"); }
@@ -160,13 +180,31 @@ lval* builtin_neq(lenv* e, lval* a) {
 }
 
 
+int lval_is_numeric(lval* x) {
+	return x->type == LVAL_NUM || x->type == LVAL_FLOAT || x->type == LVAL_BIGNUM;
+}
+
+/* Compares numbers by value, promoting them the way 'builtin_ord' does. */
+int lval_num_eq(lval* x, lval* y) {
+	if(x->type == LVAL_FLOAT || y->type == LVAL_FLOAT) { return lval_to_double(x) == lval_to_double(y); }
+
+	lbig* xb = lval_to_big(x);
+	lbig* yb = lval_to_big(y);
+	int c = lbig_cmp(xb, yb);
+	lbig_del(xb);
+	lbig_del(yb);
+	return c == 0;
+}
+
 lval* lval_cmp(lenv* e, lval* a, char* op) {
 	LASSERT_NUM(op, a, 2);
 
-	int r;
+	lval* x = a->as.list.cell[0];
+	lval* y = a->as.list.cell[1];
 
-	if(strcmp(op, "==") == 0) { r = lval_eq(a->as.list.cell[0], a->as.list.cell[1]); }
-	else if(strcmp(op, "!=") == 0) { r = !lval_eq(a->as.list.cell[0], a->as.list.cell[1]); }
+	// numbers of different types are equal when their values are, anything else structurally
+	int r = x->type != y->type && lval_is_numeric(x) && lval_is_numeric(y) ? lval_num_eq(x, y) : lval_eq(x, y);
+	if(strcmp(op, "!=") == 0) { r = !r; }
 
 	lval_del(a);
 	return lval_num(r);
@@ -190,24 +228,47 @@ lval* builtin_join(lenv* e, lval* a) {
 	return x;
 }
 
-lval* builtin_if(lval* e, lval* a) {
-	LASSERT_NUM("if", a, 3);
-	LASSERT_TYPE("if", a, 0, LVAL_NUM);
-	LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
-	LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+/* Evaluates the condition of special form [a], leaving it in [c]. Returns an error or NULL. */
+lval* lval_eval_cond(lenv* e, lval* a, char* func, long* c) {
+	lval* x = lval_eval(e, lval_nth(a, 1));
+	if(x->type == LVAL_ERR) { return x; }
+	if(x->type != LVAL_NUM) {
+		lval* err = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, expected %s.",
+			func, 0, ltype_name(x->type), ltype_name(LVAL_NUM));
+		lval_del(x);
+		return err;
+	}
 
-	// mark both expressions as evaluable
-	lval* x;
-	a->as.list.cell[1]->type = LVAL_SEXPR;
-	a->as.list.cell[2]->type = LVAL_SEXPR;
+	*c = x->as.num;
+	lval_del(x);
+	return NULL;
+}
 
-	if(a->as.list.cell[0]->as.num) {
-		x = lval_eval(e, lval_pop(a, 1));
-	} else {
-		x = lval_eval(e, lval_pop(a, 2));
+lval* builtin_if(lenv* e, lval* a) {
+	if(a->as.list.count != 4) {
+		return lval_err("Function 'if' passed incorrect number of arguments. Got %i, expected %i.",
+			a->as.list.count - 1, 3);
 	}
 
-	lval_del(a);
+	long c;
+	lval* err = lval_eval_cond(e, a, "if", &c);
+	if(err) { return err; }
+
+	// only the chosen branch is evaluated
+	return lval_eval_branch(e, LVAL_CELLS(a)[c ? 2 : 3]);
+}
+
+lval* builtin_when(lenv* e, lval* a) {
+	long c;
+	lval* err = lval_eval_cond(e, a, "when", &c);
+	if(err) { return err; }
+
+	lval* x = lval_sexpr();
+	for(int i = 2; c && i < a->as.list.count; i++) {
+		lval_del(x);
+		x = lval_eval_branch(e, LVAL_CELLS(a)[i]);
+		if(x->type == LVAL_ERR) { break; }
+	}
 	return x;
 }
 
@@ -220,21 +281,22 @@ lval* builtin_cons(lenv* e, lval* a) {
 	lval* list = lval_qexpr();
 	lval_add(list, x);
 
-	lval* y = lval_join(list, lval_pop(a, 1));
+	lval* y = lval_join(list, lval_pop(a, 0));
 	lval_del(a);
 	return y;
 }
 
 lval* builtin_len(lenv* e, lval* a) {
 	LASSERT_NUM("len", a, 1);
-	LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
+	int t = a->as.list.cell[0]->type;
+	LASSERT(a, t == LVAL_QEXPR || t == LVAL_MAP || t == LVAL_I64VEC || t == LVAL_F64VEC,
+		"Function 'len' passed incorrect type for argument 0. Got %s, expected %s.",
+		ltype_name(a->as.list.cell[0]->type), ltype_name(LVAL_QEXPR));
 
 	lval* h = lval_take(a, 0);
-	int len = h->as.list.count;
-	// delete all non-head elements
-	while(h->as.list.count > 0) {
-		lval_del(lval_pop(h, 0));
-	}
+	int len = h->type == LVAL_MAP ? lmap_count(h->as.map)
+		: (t == LVAL_QEXPR ? h->as.list.count : lvec_count(h->as.vec));
+	lval_del(h);
 
 	return lval_num(len);
 }
@@ -245,9 +307,9 @@ lval* builtin_var(lenv* e, lval* a, char* op) {
 	lval* syms = a->as.list.cell[0];
 
 	for(int i = 0; i < syms->as.list.count; i++) {
-		LASSERT(a, (syms->as.list.cell[i]->type == LVAL_SYM),
+		LASSERT(a, (LVAL_CELLS(syms)[i]->type == LVAL_SYM),
 			"Function '%s' cannot define non-symbol! Get %s, expected %s.",
-			op, ltype_name(syms->as.list.cell[i]->type), ltype_name(LVAL_SYM));
+			op, ltype_name(LVAL_CELLS(syms)[i]->type), ltype_name(LVAL_SYM));
 	}
 
 	LASSERT(a, (syms->as.list.count == a->as.list.count-1),
@@ -256,8 +318,8 @@ lval* builtin_var(lenv* e, lval* a, char* op) {
 
 	// assign copies of values to symbols
 	for(int i = 0; i < syms->as.list.count; i++){
-		if (strcmp(op, "def") == 0) { lenv_def(e, syms->as.list.cell[i], a->as.list.cell[i+1]); }
-		else if (strcmp(op, "=") == 0) { lenv_put(e, syms->as.list.cell[i], a->as.list.cell[i+1]); }
+		if (strcmp(op, "def") == 0) { lenv_def(e, LVAL_CELLS(syms)[i], a->as.list.cell[i+1]); }
+		else if (strcmp(op, "=") == 0) { lenv_put(e, LVAL_CELLS(syms)[i], a->as.list.cell[i+1]); }
 	}
 
 	lval_del(a);
@@ -267,53 +329,162 @@ lval* builtin_var(lenv* e, lval* a, char* op) {
 lval* builtin_def(lenv* e, lval* a) { return builtin_var(e, a, "def"); }
 lval* builtin_put(lenv* e, lval* a) { return builtin_var(e, a, "="); }
 
+lval* builtin_op_float(lval* x, lval* y, char* op) {
+    double yf = lval_to_double(y);
+
+    if (strcmp(op, "+") == 0) { x->as.flt += yf; }
+    if (strcmp(op, "-") == 0) { x->as.flt -= yf; }
+    if (strcmp(op, "*") == 0) { x->as.flt *= yf; }
+    if (strcmp(op, "/") == 0) {
+        if(yf == 0) {
+            lval_del(x);
+            return lval_err("Division by zero!");
+        }
+        x->as.flt /= yf;
+    }
+
+    return x;
+}
+
+/* Integer arithmetic, promoting to big integers when the result doesn't fit a machine word. */
+lval* builtin_op_int(lval* x, lval* y, char* op) {
+    if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+        long r = 0;
+        int overflow = 0;
+        if (strcmp(op, "+") == 0) { overflow = __builtin_add_overflow(x->as.num, y->as.num, &r); }
+        if (strcmp(op, "-") == 0) { overflow = __builtin_sub_overflow(x->as.num, y->as.num, &r); }
+        if (strcmp(op, "*") == 0) { overflow = __builtin_mul_overflow(x->as.num, y->as.num, &r); }
+        if (strcmp(op, "/") == 0) {
+            if(y->as.num == 0) {
+                lval_del(x);
+                return lval_err("Division by zero!");
+            }
+            overflow = (x->as.num == LONG_MIN && y->as.num == -1);
+            if (!overflow) { r = x->as.num / y->as.num; }
+        }
+
+        if (!overflow) {
+            x->as.num = r;
+            return x;
+        }
+    }
+
+    // big integers are never zero, they're demoted to machine words first
+    if (strcmp(op, "/") == 0 && y->type == LVAL_NUM && y->as.num == 0) {
+        lval_del(x);
+        return lval_err("Division by zero!");
+    }
+
+    lbig* xb = lval_to_big(x);
+    lbig* yb = lval_to_big(y);
+    lbig* r = NULL;
+    if (strcmp(op, "+") == 0) { r = lbig_add(xb, yb); }
+    if (strcmp(op, "-") == 0) { r = lbig_sub(xb, yb); }
+    if (strcmp(op, "*") == 0) { r = lbig_mul(xb, yb); }
+    if (strcmp(op, "/") == 0) { r = lbig_div(xb, yb); }
+
+    lbig_del(xb);
+    lbig_del(yb);
+    lval_del(x);
+    return lval_integer(r);
+}
+
 lval* builtin_op(lenv* e, lval* a, char* op) {
+    for(int i = 0; i < a->as.list.count; i++) {
+        int t = a->as.list.cell[i]->type;
+        if (t == LVAL_I64VEC || t == LVAL_F64VEC) { return lvec_op(e, a, op); }
+    }
+
     // ensure all arguments are numbers
-    for(int i = 0; i < a->as.list.count; i++) { LASSERT_TYPE(op, a, i, LVAL_NUM); }
+    for(int i = 0; i < a->as.list.count; i++) { LASSERT_NUMERIC(op, a, i); }
 
-    lval* x = lval_pop(a, 0);
+    // result accumulates in place of the first argument, so arithmetic
+    // on unshared values doesn't allocate new cells
+    lval* x = lval_own(lval_pop(a, 0));
 
     // try to perform unary negation
-    if ((strcmp(op, "-") == 0) && a->as.list.count == 0) { x->as.num = -x->as.num; }
+    if ((strcmp(op, "-") == 0) && a->as.list.count == 0) {
+        if (x->type == LVAL_FLOAT) {
+            x->as.flt = -x->as.flt;
+        } else if (x->type == LVAL_NUM && x->as.num != LONG_MIN) {
+            x->as.num = -x->as.num;
+        } else {
+            lbig* b = lval_to_big(x);
+            lval_del(x);
+            x = lval_integer(lbig_neg(b));
+            lbig_del(b);
+        }
+    }
 
     // for all elements
     while(a->as.list.count > 0) {
         lval* y = lval_pop(a, 0);
 
-        // perform operation
-        if (strcmp(op, "+") == 0) { x->as.num += y->as.num; }
-        if (strcmp(op, "-") == 0) { x->as.num -= y->as.num; }
-        if (strcmp(op, "*") == 0) { x->as.num *= y->as.num; }
-        if (strcmp(op, "/") == 0) {
-            if(y->as.num == 0) {
-                lval_del(x);
-                lval_del(y);
-                lval_del(a);
-                x = lval_err("Division by zero!"); break;
-            } else {
-                x->as.num /= y->as.num;
-            }
+        // integers are promoted to floats as soon as a float is involved
+        if (x->type != LVAL_FLOAT && y->type == LVAL_FLOAT) {
+            double xf = lval_to_double(x);
+            if (x->type == LVAL_BIGNUM) { lbig_del(x->as.big); }
+            x->type = LVAL_FLOAT;
+            x->as.flt = xf;
+        }
+
+        if (x->type == LVAL_FLOAT) {
+            x = builtin_op_float(x, y, op);
+            lval_del(y);
+            if (x->type == LVAL_ERR) { break; }
+            continue;
         }
 
+        x = builtin_op_int(x, y, op);
         lval_del(y);
+        if (x->type == LVAL_ERR) { break; }
     }
 
+    if (x->type != LVAL_ERR) { lval_num_rehash(x); }
+
     lval_del(a);
     return x;
 }
 
+lval* builtin_to_float(lenv* e, lval* a) {
+	LASSERT_NUM("float", a, 1);
+	LASSERT_NUMERIC("float", a, 0);
+
+	lval* x = lval_float(lval_to_double(a->as.list.cell[0]));
+	lval_del(a);
+	return x;
+}
+
+lval* builtin_to_int(lenv* e, lval* a) {
+	LASSERT_NUM("int", a, 1);
+	LASSERT_NUMERIC("int", a, 0);
+
+	// floats are truncated towards zero
+	lval* v = a->as.list.cell[0];
+	lval* x;
+	if(v->type == LVAL_FLOAT) {
+		x = lval_integer(lbig_from_double(v->as.flt));
+	} else {
+		x = lval_cp(v);
+	}
+	lval_del(a);
+	return x;
+}
+
 lval* builtin_add(lenv* e, lval* a) { return builtin_op(e, a, "+"); }
 lval* builtin_sub(lenv* e, lval* a) { return builtin_op(e, a, "-"); }
 lval* builtin_mul(lenv* e, lval* a) { return builtin_op(e, a, "*"); }
 lval* builtin_div(lenv* e, lval* a) { return builtin_op(e, a, "/"); }
 
 lval* builtin_print(lenv* e, lval* a) {
+	lbuf* b = lout_buf();
 	for(int i = 0; i < a->as.list.count; i++) {
-		lval_print(a->as.list.cell[i]);
-		putchar(' ');
+		lval_render(b, a->as.list.cell[i]);
+		lbuf_putc(b, ' ');
 	}
 
-	putchar('\n');
+	lbuf_putc(b, '\n');
+	lout_commit(b);
 	lval_del(a);
 
 	return lval_sexpr();
@@ -323,7 +494,7 @@ lval* builtin_error(lenv* e, lval* a) {
 	LASSERT_NUM("error", a, 1);
 	LASSERT_TYPE("error", a, 0, LVAL_STR);
 
-	lval* err = lval_err(a->as.list.cell[0]->as.str);
+	lval* err = lval_err("%s", lstr_cstr(a->as.list.cell[0]->as.str));
 
 	lval_del(a);
 	return err;
@@ -336,22 +507,37 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
 	lval_del(k); lval_del(v);
 }
 
+/* Adds builtin [func] as special form [name], called with the whole form unevaluated. */
+void lenv_add_special(lenv* e, char* name, lbuiltin func) {
+	lval* k = lval_sym(name);
+	lval* v = lval_fun(func);
+	v->as.fun->special = 1;
+	lenv_put(e, k, v);
+	lval_del(k); lval_del(v);
+}
+
 void lenv_add_builtins(lenv* e){
 	lenv_add_builtin(e, "+", builtin_add);
 	lenv_add_builtin(e, "-", builtin_sub);
 	lenv_add_builtin(e, "*", builtin_mul);
 	lenv_add_builtin(e, "/", builtin_div);
 
-	lenv_add_builtin(e, "if", builtin_if);
+	lenv_add_special(e, "if", builtin_if);
+	lenv_add_special(e, "when", builtin_when);
+	lenv_add_special(e, "cond", builtin_cond);
 	lenv_add_builtin(e, "==", builtin_eq);
 	lenv_add_builtin(e, "!=", builtin_ne);
 	lenv_add_builtin(e, ">", builtin_gt);
 	lenv_add_builtin(e, ">=", builtin_ge);
 	lenv_add_builtin(e, "<", builtin_lt);
 	lenv_add_builtin(e, "<=", builtin_le);
-	lenv_add_builtin(e, "||", builtin_or);
-	lenv_add_builtin(e, "&&", builtin_and);
+	lenv_add_special(e, "||", builtin_or);
+	lenv_add_special(e, "&&", builtin_and);
+	lenv_add_special(e, "or", builtin_or);
+	lenv_add_special(e, "and", builtin_and);
 	lenv_add_builtin(e, "!", builtin_neq);
+	lenv_add_builtin(e, "float", builtin_to_float);
+	lenv_add_builtin(e, "int", builtin_to_int);
 
 	lenv_add_builtin(e, "\\", builtin_lambda);
 	lenv_add_builtin(e, "def", builtin_def);
@@ -365,6 +551,61 @@ void lenv_add_builtins(lenv* e){
 	lenv_add_builtin(e, "init", builtin_init);
 	lenv_add_builtin(e, "eval", builtin_eval);
 	lenv_add_builtin(e, "print", builtin_print);
+	lenv_add_builtin(e, "pmap", builtin_pmap);
+	lenv_add_builtin(e, "preduce", builtin_preduce);
+
+	lenv_add_builtin(e, "str-concat", builtin_str_concat);
+	lenv_add_builtin(e, "str-len", builtin_str_len);
+	lenv_add_builtin(e, "str-sub", builtin_str_sub);
+	lenv_add_builtin(e, "str-find", builtin_str_find);
+	lenv_add_builtin(e, "str-split", builtin_str_split);
+	lenv_add_builtin(e, "str-replace", builtin_str_replace);
+	lenv_add_builtin(e, "str-join", builtin_str_join);
+	lenv_add_builtin(e, "str->num", builtin_str_to_num);
+	lenv_add_builtin(e, "num->str", builtin_num_to_str);
+
+	lenv_add_builtin(e, "mmap-file", builtin_mmap_file);
+	lenv_add_builtin(e, "lines", builtin_lines);
+	lenv_add_builtin(e, "fold-lines", builtin_fold_lines);
+	lenv_add_builtin(e, "next", builtin_next);
+	lenv_add_builtin(e, "range", builtin_range);
+	lenv_add_builtin(e, "iterate", builtin_iterate);
+	lenv_add_builtin(e, "lazy-map", builtin_lazy_map);
+	lenv_add_builtin(e, "lazy-filter", builtin_lazy_filter);
+	lenv_add_builtin(e, "lazy-take", builtin_lazy_take);
+	lenv_add_builtin(e, "collect", builtin_collect);
+	lenv_add_builtin(e, "fold-stream", builtin_fold_stream);
+	lenv_add_builtin(e, "i64vec", builtin_i64vec);
+	lenv_add_builtin(e, "f64vec", builtin_f64vec);
+	lenv_add_builtin(e, "vec-list", builtin_vec_list);
+	lenv_add_builtin(e, "vsum", builtin_vsum);
+	lenv_add_builtin(e, "vdot", builtin_vdot);
+	lenv_add_builtin(e, "vmin", builtin_vmin);
+	lenv_add_builtin(e, "vmax", builtin_vmax);
+	lenv_add_builtin(e, "v+", builtin_vadd);
+	lenv_add_builtin(e, "v*", builtin_vmul);
+	lenv_add_builtin(e, "memo", builtin_memo);
+	lenv_add_builtin(e, "memo-stats", builtin_memo_stats);
+
+	lenv_add_builtin(e, "hash-map", builtin_hash_map);
+	lenv_add_builtin(e, "assoc", builtin_assoc);
+	lenv_add_builtin(e, "dissoc", builtin_dissoc);
+	lenv_add_builtin(e, "get", builtin_get);
+	lenv_add_builtin(e, "keys", builtin_keys);
+	lenv_add_builtin(e, "vals", builtin_vals);
+	lenv_add_builtin(e, "merge", builtin_merge);
+
+	lenv_add_builtin(e, "case", builtin_case);
+	lenv_add_builtin(e, "select", builtin_select);
+
+	lenv_add_builtin(e, "defmacro", builtin_defmacro);
+	lenv_add_builtin(e, "sexpr", builtin_sexpr);
+
+	lenv_add_builtin(e, "spawn", builtin_spawn);
+	lenv_add_builtin(e, "yield", builtin_yield);
+	lenv_add_builtin(e, "chan", builtin_chan);
+	lenv_add_builtin(e, "send", builtin_send);
+	lenv_add_builtin(e, "recv", builtin_recv);
 	lenv_add_builtin(e, "error", builtin_error);
 }
 
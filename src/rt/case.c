@@ -0,0 +1,124 @@
+#include "lval.h"
+
+/*
+ * Multi-way branching. Clauses are Q-Expressions of a key or condition followed
+ * by code evaluated when the clause is chosen. All forms scan clauses in
+ * place; 'case' over literal keys inside lambdas is compiled by the optimizer
+ * into a map from keys to clause code, replacing the scan with a lookup.
+ * 'cond' is a special form, so its clauses are never evaluated as arguments.
+ */
+
+/* Evaluates code of clause [c] following its key. */
+lval* lval_eval_clause(lenv* e, lval* c) {
+	lval* x = lval_sexpr();
+	for(int i = 1; i < c->as.list.count; i++) {
+		lval_add(x, lval_nth(c, i));
+	}
+	return lval_eval(e, x);
+}
+
+lval* builtin_case(lenv* e, lval* a) {
+	LASSERT(a, a->as.list.count >= 1,
+		"Function 'case' passed too few arguments. Got %i, expected at least %i.", a->as.list.count, 1);
+
+	lval* x = a->as.list.cell[0];
+
+	// compiled table of clause code by key
+	if(a->as.list.count == 2 && a->as.list.cell[1]->type == LVAL_MAP) {
+		lval* code = lmap_get(a->as.list.cell[1]->as.map, x);
+		LASSERT(a, code != NULL, "No Case Found");
+
+		code = lval_own(lval_cp(code));
+		code->type = LVAL_SEXPR;
+		lval_del(a);
+		return lval_eval(e, code);
+	}
+
+	for(int i = 1; i < a->as.list.count; i++) {
+		LASSERT_TYPE("case", a, i, LVAL_QEXPR);
+		LASSERT_NOT_EMPTY("case", a, i);
+	}
+
+	for(int i = 1; i < a->as.list.count; i++) {
+		lval* c = a->as.list.cell[i];
+		lval* k = lval_eval(e, lval_nth(c, 0));
+		if(k->type == LVAL_ERR) {
+			lval_del(a);
+			return k;
+		}
+
+		int hit = lval_eq(x, k);
+		lval_del(k);
+		if(hit) {
+			lval* r = lval_eval_clause(e, c);
+			lval_del(a);
+			return r;
+		}
+	}
+
+	lval_del(a);
+	return lval_err("No Case Found");
+}
+
+lval* builtin_select(lenv* e, lval* a) {
+	for(int i = 0; i < a->as.list.count; i++) {
+		LASSERT_TYPE("select", a, i, LVAL_QEXPR);
+		LASSERT_NOT_EMPTY("select", a, i);
+	}
+
+	for(int i = 0; i < a->as.list.count; i++) {
+		lval* c = a->as.list.cell[i];
+		lval* t = lval_eval(e, lval_nth(c, 0));
+		if(t->type == LVAL_ERR) {
+			lval_del(a);
+			return t;
+		}
+		if(t->type != LVAL_NUM) {
+			lval* err = lval_err("Function 'select' passed incorrect type for condition %i. Got %s, expected %s.",
+				i, ltype_name(t->type), ltype_name(LVAL_NUM));
+			lval_del(t);
+			lval_del(a);
+			return err;
+		}
+
+		int hit = t->as.num != 0;
+		lval_del(t);
+		if(hit) {
+			lval* r = lval_eval_clause(e, c);
+			lval_del(a);
+			return r;
+		}
+	}
+
+	lval_del(a);
+	return lval_err("No Selection Found");
+}
+
+lval* builtin_cond(lenv* e, lval* a) {
+	for(int i = 1; i < a->as.list.count; i++) {
+		lval* c = LVAL_CELLS(a)[i];
+		if(c->type != LVAL_QEXPR || c->as.list.count == 0) {
+			return lval_err("Function 'cond' passed incorrect clause %i. Got %s, expected non-empty %s.",
+				i - 1, ltype_name(c->type), ltype_name(LVAL_QEXPR));
+		}
+	}
+
+	for(int i = 1; i < a->as.list.count; i++) {
+		lval* c = LVAL_CELLS(a)[i];
+		lval* t = lval_eval(e, lval_nth(c, 0));
+		if(t->type == LVAL_ERR) { return t; }
+		if(t->type != LVAL_NUM) {
+			lval* err = lval_err("Function 'cond' passed incorrect type for condition %i. Got %s, expected %s.",
+				i - 1, ltype_name(t->type), ltype_name(LVAL_NUM));
+			lval_del(t);
+			return err;
+		}
+
+		int hit = t->as.num != 0;
+		lval_del(t);
+		if(hit) { return lval_eval_range(e, c, 1); }
+	}
+
+	// no clause chosen
+	return lval_sexpr();
+}
@@ -0,0 +1,131 @@
+#include "lval.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * File builtins. Files are either mapped into memory as a whole and exposed
+ * as strings, so substrings and split fields are views into the mapping
+ * rather than copies, or streamed line by line through a fixed buffer, with
+ * every line released before the next one is read.
+ */
+
+lval* builtin_mmap_file(lenv* e, lval* a) {
+	LASSERT_NUM("mmap-file", a, 1);
+	LASSERT_TYPE("mmap-file", a, 0, LVAL_STR);
+
+	const char* path = lstr_cstr(a->as.list.cell[0]->as.str);
+	lstr* s = lstr_map_file(path);
+	LASSERT(a, s != NULL, "Function 'mmap-file' could not map file '%s': %s.", path, strerror(errno));
+
+	lval_del(a);
+	return lval_lstr(s);
+}
+
+/* Initial size of the buffer lines are read through. It grows to fit lines longer than that. */
+#define LINES_BUF_SIZE (1 << 20)
+
+typedef struct {
+	int 	fd;
+	char* 	buf;
+	int 	cap;
+	int 	start;	/* beginning of the next line */
+	int 	scan;	/* where to continue looking for the end of line */
+	int 	end;	/* end of data read so far */
+	int 	eof;
+} llines;
+
+lval* llines_next(lenv* e, lstream* s) {
+	llines* l = (llines*)s->state;
+
+	while(1) {
+		char* nl = (char*)memchr(l->buf + l->scan, '\n', l->end - l->scan);
+		if(nl) {
+			int len = (int)(nl - (l->buf + l->start));
+			lval* x = lval_lstr(lstr_new(l->buf + l->start, len));
+			l->start = l->scan = (int)(nl - l->buf) + 1;
+			return x;
+		}
+		l->scan = l->end;
+
+		if(l->eof) {
+			// last line without the trailing newline
+			if(l->start == l->end) { return NULL; }
+			lval* x = lval_lstr(lstr_new(l->buf + l->start, l->end - l->start));
+			l->start = l->scan = l->end;
+			return x;
+		}
+
+		// move the partial line to the front and read more behind it
+		if(l->start > 0) {
+			memmove(l->buf, l->buf + l->start, l->end - l->start);
+			l->end -= l->start;
+			l->scan -= l->start;
+			l->start = 0;
+		}
+		if(l->end == l->cap) {
+			l->cap *= 2;
+			l->buf = (char*)realloc(l->buf, l->cap);
+		}
+
+		ssize_t n = read(l->fd, l->buf + l->end, l->cap - l->end);
+		if(n < 0 && errno == EINTR) { continue; }
+		if(n < 0) { return lval_err("Could not read lines: %s.", strerror(errno)); }
+		if(n == 0) { l->eof = 1; }
+		l->end += (int)n;
+	}
+}
+
+void llines_free(lstream* s) {
+	llines* l = (llines*)s->state;
+	close(l->fd);
+	free(l->buf);
+	free(l);
+}
+
+/* Opens stream of lines of file [path], or returns NULL with errno set. */
+lstream* llines_open(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) { return NULL; }
+
+	llines* l = (llines*)calloc(1, sizeof(llines));
+	l->fd = fd;
+	l->cap = LINES_BUF_SIZE;
+	l->buf = (char*)malloc(l->cap);
+	return lstream_new(llines_next, llines_free, l);
+}
+
+lval* builtin_lines(lenv* e, lval* a) {
+	LASSERT_NUM("lines", a, 1);
+	LASSERT_TYPE("lines", a, 0, LVAL_STR);
+
+	const char* path = lstr_cstr(a->as.list.cell[0]->as.str);
+	lstream* s = llines_open(path);
+	LASSERT(a, s != NULL, "Function 'lines' could not open file '%s': %s.", path, strerror(errno));
+
+	lval_del(a);
+	return lval_stream(s);
+}
+
+lval* builtin_fold_lines(lenv* e, lval* a) {
+	LASSERT_NUM("fold-lines", a, 3);
+	LASSERT(a, a->as.list.cell[0]->type == LVAL_STR || a->as.list.cell[0]->type == LVAL_STREAM,
+		"Function 'fold-lines' passed incorrect type for argument 0. Got %s, expected String or Stream.",
+		ltype_name(a->as.list.cell[0]->type));
+	LASSERT_TYPE("fold-lines", a, 1, LVAL_FUN);
+
+	// path is opened here, a stream continues from where it was left
+	lstream* s;
+	if(a->as.list.cell[0]->type == LVAL_STR) {
+		const char* path = lstr_cstr(a->as.list.cell[0]->as.str);
+		s = llines_open(path);
+		LASSERT(a, s != NULL, "Function 'fold-lines' could not open file '%s': %s.", path, strerror(errno));
+	} else {
+		s = lstream_cp(a->as.list.cell[0]->as.stream);
+	}
+
+	lval* r = lstream_fold(e, s, a->as.list.cell[1], lval_cp(a->as.list.cell[2]));
+	lstream_del(s);
+	lval_del(a);
+	return r;
+}
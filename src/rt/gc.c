@@ -1,117 +1,401 @@
 #include "lval.h"
-#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
 
-mem_heap*
-heap_new(void) {
-	mem_heap* heap = (mem_heap*)malloc(sizeof(mem_heap));
-	heap->size = HEAP_INIT_SIZE;
+__thread mem_heap* HEAP = NULL;
+
+static long HEAP_DEFAULT_MAX;
+static pthread_once_t HEAP_DEFAULT_MAX_ONCE = PTHREAD_ONCE_INIT;
+
+/* Every parallel job makes a heap, so the environment is read exactly once. */
+static void
+heap_default_max_init(void) {
+	char* env = getenv("QSP_MAX_HEAP");
+	HEAP_DEFAULT_MAX = env ? atol(env) : HEAP_MAX_SIZE;
+	if(HEAP_DEFAULT_MAX < 0) { HEAP_DEFAULT_MAX = 0; }
+}
 
-	lval* head = (lval*)malloc(sizeof(lval));
-	lval* n = head;
-	memset(n, 0, sizeof(lval));
+void
+heap_set_default_max(long cells) {
+	pthread_once(&HEAP_DEFAULT_MAX_ONCE, heap_default_max_init);
+	HEAP_DEFAULT_MAX = cells < 0 ? 0 : cells;
+}
+
+long
+heap_default_max(void) {
+	pthread_once(&HEAP_DEFAULT_MAX_ONCE, heap_default_max_init);
+	return HEAP_DEFAULT_MAX;
+}
 
-	for(int i = 0; i < heap->size; i++) {
-		lval* tmp = (lval*)malloc(sizeof(lval));
-		memset(tmp, 0, sizeof(lval));
-		n->next = tmp;
-		n = tmp;
+/* Adds a slab of [n] cells to the heap, all of them free. */
+void
+heap_grow(mem_heap* heap, long n) {
+	lval* slab = (lval*)calloc(n, sizeof(lval));
+	if(!slab) {
+		fprintf(stderr, "qsp: out of memory growing heap of %ld values\n", heap->size);
+		abort();
+	}
+	for(long i = 0; i < n - 1; i++) {
+		slab[i].as.next = &slab[i + 1];
 	}
+	slab[n - 1].as.next = heap->free;
+	heap->free = slab;
 
-	n->next = NULL;
-	heap->head = head;
-	heap->next_free_val = heap->head;
+	heap->slabs = (mem_slab*)realloc(heap->slabs, sizeof(mem_slab) * (heap->nslabs + 1));
+	heap->slabs[heap->nslabs].cells = slab;
+	heap->slabs[heap->nslabs].count = n;
+	heap->nslabs++;
+	heap->size += n;
+}
 
+mem_heap*
+heap_new(void) {
+	mem_heap* heap = (mem_heap*)calloc(1, sizeof(mem_heap));
+	heap->max = heap_default_max();
+	heap_grow(heap, HEAP_INIT_SIZE);
+	heap->compacted = heap->nslabs;
 	return heap;
 }
 
 void
 heap_print(mem_heap* heap) {
-	lval* n = heap->head;
-	printf("HEAP\nsize:\t%d\ncontent:\n", heap->size);
-	while(n){
+	printf("HEAP\nsize:\t%ld\ncontent:\n", heap->size);
+	for(int i = 0; i < heap->nslabs; i++)
+	for(lval* n = heap->slabs[i].cells; n < heap->slabs[i].cells + heap->slabs[i].count; n++) {
 		char c;
 		switch(n->type) {
 		case LVAL_UNDEF: c = '.'; break;
 		case LVAL_ERR: c = 'E'; break;
 		case LVAL_FUN: c = 'F'; break;
 		case LVAL_NUM: c = 'N'; break;
+		case LVAL_FLOAT: c = 'D'; break;
+		case LVAL_BIGNUM: c = 'B'; break;
 		case LVAL_QEXPR: c = 'Q'; break;
 		case LVAL_SEXPR: c = 'S'; break;
 		case LVAL_STR: c = 'T'; break;
 		case LVAL_SYM: c = 'A'; break;
+		case LVAL_CHAN: c = 'C'; break;
+		case LVAL_MAP: c = 'M'; break;
+		case LVAL_STREAM: c = 'R'; break;
+		case LVAL_I64VEC: c = 'I'; break;
+		case LVAL_F64VEC: c = 'V'; break;
 		}
 		putchar(c);
-		n = n->next;
 	}
 	putchar('\n');
 }
 
 void
 heap_del(mem_heap* heap) {
-	lval* n = heap->head;
-
-	// clean all lvalues
-	while(n) {
-		lval* tmp = n;
-		n = n->next;
-		lval_delp(tmp);
-		free(tmp);
+	// values refer to each other, so all of them are released before any is freed;
+	// pinned counters keep releasing one from recursively releasing the others
+	for(int i = 0; i < heap->nslabs; i++) {
+		mem_slab* sl = &heap->slabs[i];
+		for(lval* n = sl->cells; n < sl->cells + sl->count; n++) { n->ref_count = INT_MAX; }
+	}
+	for(int i = 0; i < heap->nslabs; i++) {
+		mem_slab* sl = &heap->slabs[i];
+		for(lval* n = sl->cells; n < sl->cells + sl->count; n++) { lval_delp(n); }
 	}
 
+	for(int i = 0; i < heap->nslabs; i++) {
+		free(heap->slabs[i].cells);
+	}
+	free(heap->slabs);
 	free(heap);
 }
 
+/* Makes room on a heap with no free cell left. */
+void
+heap_refill(mem_heap* heap) {
+	long n = heap->size * (HEAP_GROWTH_RATE - 1);
+	if(heap->max && heap->size + n > heap->max) { n = heap->max - heap->size; }
+	if(n > 0) {
+		heap_grow(heap, n);
+		return;
+	}
+
+	// at the limit, cached results are given up first
+	lmemo_clear_heap(heap);
+	if(heap->free) { return; }
+
+	// past its limit the heap grows once by a reserve to raise the error with;
+	// code still allocating before the error is raised can't be stopped any other way
+	if(heap->oom) {
+		fprintf(stderr, "Out of memory! Heap is limited to %ld values, see --max-heap.\n", heap->max);
+		exit(1);
+	}
+	heap->oom = 1;
+	heap_grow(heap, HEAP_RESERVE);
+}
+
+lval*
+heap_oom(mem_heap* heap) {
+	if(!heap->oom) { return NULL; }
+	heap->oom = 0;
+	return lval_err("Out of memory! Heap is limited to %ld values, see --max-heap.", heap->max);
+}
+
+static int HEAP_COMPACT;
+static pthread_once_t HEAP_COMPACT_ONCE = PTHREAD_ONCE_INIT;
+
+static void
+heap_compact_init(void) {
+	HEAP_COMPACT = getenv("QSP_COMPACT") != NULL;
+}
+
+void
+heap_compact_enable(int on) {
+	pthread_once(&HEAP_COMPACT_ONCE, heap_compact_init);
+	HEAP_COMPACT = on;
+}
+
+/* Asked at safepoints, which parallel jobs reach as well. */
 int
-heap_resize(mem_heap* heap) {
-	int old_size = heap->size;
-	int new_size = (int)(old_size * HEAP_GROWTH_RATE);
-	if(new_size > HEAP_MAX_SIZE) {
-		return HEAP_MEM_OUT;
+heap_compact_on(void) {
+	pthread_once(&HEAP_COMPACT_ONCE, heap_compact_init);
+	return HEAP_COMPACT;
+}
+
+/*
+ * Compaction. Values are moved only when every reference to them is known:
+ * held by a list, a lambda, an environment of a lambda or the root one. A
+ * value with more references than these is held by something opaque, such
+ * as a stream, a map, a memo cache or C code, so it's pinned to its cell.
+ * Movable values are copied into a new slab breadth first from the root
+ * environment and the pinned values, so elements of a list end up next to
+ * each other in order. References are then pointed at the copies, and slabs
+ * without a pinned value are freed.
+ */
+
+typedef struct {
+	mem_heap* 	heap;
+	int** 		refs;	/* references found per cell of each slab */
+	lval*** 	to;		/* where each cell was moved, NULL if it wasn't */
+	lval* 		slab;	/* new slab */
+	long 		top;	/* cells used in it */
+} mem_compact;
+
+typedef void (*mem_slot_fn)(mem_compact* c, lval** slot);
+
+/* Finds cell [v] on the heap, returns its slab and index in [i]. */
+static int
+heap_find(mem_heap* heap, lval* v, long* i) {
+	for(int s = 0; s < heap->nslabs; s++) {
+		mem_slab* sl = &heap->slabs[s];
+		if(v >= sl->cells && v < sl->cells + sl->count) {
+			*i = v - sl->cells;
+			return s;
+		}
 	}
-	heap->size = new_size;
+	return -1;
+}
 
-	lval* last = heap->head;
-	while(last->next) { last = last->next; }
+static int
+heap_live(lval* v) {
+	return v->type != LVAL_UNDEF || v->ref_count > 0;
+}
 
-	lval* n = last;
-	for(int i = old_size; i < new_size; i++) {
-		lval* tmp = (lval*)malloc(sizeof(lval));
-		memset(tmp, 0, sizeof(lval));
-		n->next = tmp;
-		n = tmp;
+static void
+heap_visit_env(mem_compact* c, lenv* e, mem_slot_fn fn) {
+	for(int i = 0; i < e->map->cap; i++) {
+		if(e->map->slots[i].used) { fn(c, (lval**)&e->map->slots[i].val); }
 	}
-	n->next = NULL;
-	heap->next_free_val = last->next;
+}
 
-	return heap->size;
+/* Applies [fn] to every reference held by [v]. */
+static void
+heap_visit(mem_compact* c, lval* v, mem_slot_fn fn) {
+	switch(v->type) {
+	case LVAL_QEXPR:
+	case LVAL_SEXPR:
+		if(v->as.list.ints) { break; }
+		for(int i = 0; i < v->as.list.count; i++) {
+			fn(c, &v->as.list.cell[i]);
+		}
+		break;
+	case LVAL_FUN:
+		if(v->as.fun->builtin) { break; }
+		fn(c, &v->as.fun->formals);
+		fn(c, &v->as.fun->body);
+		if(v->as.fun->assumed) {
+			fn(c, &v->as.fun->source);
+			fn(c, &v->as.fun->assumed);
+		}
+		heap_visit_env(c, v->as.fun->env, fn);
+		break;
+	}
 }
 
-lval*
-heap_next_free(mem_heap* heap){
-	lval* v = heap->next_free_val;
-	if(!v) { return v; }
+static void
+heap_count_ref(mem_compact* c, lval** slot) {
+	long i;
+	int s = heap_find(c->heap, *slot, &i);
+	if(s >= 0) { c->refs[s][i]++; }
+}
+
+static int
+heap_pinned(mem_compact* c, int s, long i) {
+	lval* v = &c->heap->slabs[s].cells[i];
+	return heap_live(v) && v->ref_count > c->refs[s][i];
+}
 
-	// checkout next free lvalue cell on the heap
-	lval* n = v->next;
-	while(n && n->type != LVAL_UNDEF) {
-		n = n->next;
+/* Copies the value referenced by [slot] into the new slab, unless it's pinned or copied already. */
+static void
+heap_move_ref(mem_compact* c, lval** slot) {
+	long i;
+	int s = heap_find(c->heap, *slot, &i);
+	if(s < 0 || c->to[s][i] || heap_pinned(c, s, i)) { return; }
+
+	lval* n = &c->slab[c->top++];
+	*n = **slot;
+	c->to[s][i] = n;
+}
+
+/* Copies everything reachable from the copies made since [from]. */
+static void
+heap_move_from(mem_compact* c, long from) {
+	while(from < c->top) {
+		heap_visit(c, &c->slab[from++], heap_move_ref);
 	}
-	heap->next_free_val = n;
+}
 
-	return v;
+static void
+heap_fix_ref(mem_compact* c, lval** slot) {
+	long i;
+	int s = heap_find(c->heap, *slot, &i);
+	if(s >= 0 && c->to[s][i]) { *slot = c->to[s][i]; }
+}
+
+void
+heap_compact(mem_heap* heap, lenv* root) {
+	mem_compact c = { heap, NULL, NULL, NULL, 0 };
+	c.refs = (int**)malloc(sizeof(int*) * heap->nslabs);
+	c.to = (lval***)malloc(sizeof(lval**) * heap->nslabs);
+	char* pins = (char*)calloc(heap->nslabs, sizeof(char));
+	for(int s = 0; s < heap->nslabs; s++) {
+		c.refs[s] = (int*)calloc(heap->slabs[s].count, sizeof(int));
+		c.to[s] = (lval**)calloc(heap->slabs[s].count, sizeof(lval*));
+	}
+
+	// count references known to the heap
+	heap_visit_env(&c, root, heap_count_ref);
+	for(int s = 0; s < heap->nslabs; s++)
+	for(long i = 0; i < heap->slabs[s].count; i++) {
+		if(heap_live(&heap->slabs[s].cells[i])) { heap_visit(&c, &heap->slabs[s].cells[i], heap_count_ref); }
+	}
+
+	long moved = 0, kept = 0;
+	for(int s = 0; s < heap->nslabs; s++) {
+		for(long i = 0; i < heap->slabs[s].count; i++) {
+			if(heap_pinned(&c, s, i)) { pins[s] = 1; }
+			else if(heap_live(&heap->slabs[s].cells[i])) { moved++; }
+		}
+		if(pins[s]) { kept += heap->slabs[s].count; }
+	}
+
+	long cap = moved * HEAP_GROWTH_RATE;
+	if(cap < HEAP_INIT_SIZE) { cap = HEAP_INIT_SIZE; }
+	if(heap->max && kept + cap > heap->max) { cap = heap->max - kept > moved ? heap->max - kept : moved; }
+	c.slab = (lval*)calloc(cap, sizeof(lval));
+	if(!c.slab) {
+		// compaction is an optimization, without memory for it the heap stays as it is
+		cap = 0;
+		moved = 0;
+	}
+
+	if(moved) {
+		// lists are laid out breadth first, starting from globals
+		heap_visit_env(&c, root, heap_move_ref);
+		heap_move_from(&c, 0);
+		for(int s = 0; s < heap->nslabs; s++)
+		for(long i = 0; i < heap->slabs[s].count; i++) {
+			if(!heap_pinned(&c, s, i)) { continue; }
+			long from = c.top;
+			heap_visit(&c, &heap->slabs[s].cells[i], heap_move_ref);
+			heap_move_from(&c, from);
+		}
+
+		// the rest is only referenced from itself
+		for(int s = 0; s < heap->nslabs; s++)
+		for(long i = 0; i < heap->slabs[s].count; i++) {
+			lval* v = &heap->slabs[s].cells[i];
+			if(!heap_live(v) || heap_pinned(&c, s, i) || c.to[s][i]) { continue; }
+			long from = c.top;
+			lval* p = v;
+			heap_move_ref(&c, &p);
+			heap_move_from(&c, from);
+		}
+
+		// point references at the copies
+		heap_visit_env(&c, root, heap_fix_ref);
+		for(long i = 0; i < c.top; i++) {
+			heap_visit(&c, &c.slab[i], heap_fix_ref);
+		}
+		for(int s = 0; s < heap->nslabs; s++)
+		for(long i = 0; i < heap->slabs[s].count; i++) {
+			if(heap_pinned(&c, s, i)) { heap_visit(&c, &heap->slabs[s].cells[i], heap_fix_ref); }
+		}
+	}
+
+	// slabs with pinned values stay, everything else in them is free now
+	mem_slab* slabs = (mem_slab*)malloc(sizeof(mem_slab) * (heap->nslabs + 1));
+	int n = 0;
+	heap->free = NULL;
+	heap->size = 0;
+	for(int s = 0; s < heap->nslabs; s++) {
+		mem_slab* sl = &heap->slabs[s];
+		if(moved && !pins[s]) {
+			free(sl->cells);
+			continue;
+		}
+		for(long i = sl->count - 1; i >= 0; i--) {
+			lval* v = &sl->cells[i];
+			if(moved && c.to[s][i]) { memset(v, 0, sizeof(lval)); }
+			if(!heap_live(v)) {
+				v->as.next = heap->free;
+				heap->free = v;
+			}
+		}
+		slabs[n++] = *sl;
+		heap->size += sl->count;
+	}
+	if(moved) {
+		for(long i = cap - 1; i >= c.top; i--) {
+			c.slab[i].as.next = heap->free;
+			heap->free = &c.slab[i];
+		}
+		slabs[n].cells = c.slab;
+		slabs[n].count = cap;
+		n++;
+		heap->size += cap;
+	} else {
+		free(c.slab);
+	}
+
+	for(int s = 0; s < heap->nslabs; s++) {
+		free(c.refs[s]);
+		free(c.to[s]);
+	}
+	free(c.refs);
+	free(c.to);
+	free(pins);
+
+	free(heap->slabs);
+	heap->slabs = slabs;
+	heap->nslabs = n;
+	heap->compacted = n;
 }
 
 lval*
 lval_new(void) {
 	mem_heap* h = HEAP;
-	lval* v = heap_next_free(h);
-
-	// if NULL was returned, perform heap resize
-	while(!v) {
-		if(heap_resize(h) == HEAP_MEM_OUT) { return NULL; }
-		v = heap_next_free(h);
-	}
+	if(!h->free) { heap_refill(h); }
 
+	// take the first free cell
+	lval* v = h->free;
+	h->free = v->as.next;
+	v->as.next = NULL;
 	v->ref_count = 1;
 	return v;
 }
@@ -129,18 +413,36 @@ lval_delp(lval* v){
   switch(v->type){
   	case LVAL_UNDEF: break;
     case LVAL_NUM: break;
-    case LVAL_STR: free(v->as.str); break;
+    case LVAL_FLOAT: break;
+    case LVAL_BIGNUM: lbig_del(v->as.big); break;
+    case LVAL_STR: lstr_del(v->as.str); break;
     case LVAL_FUN:
-    	if(!v->as.fun.builtin){
-    		lenv_del(v->as.fun.env);
-    		lval_del(v->as.fun.formals);
-    		lval_del(v->as.fun.body);
+    	if(!v->as.fun->builtin){
+    		lenv_del(v->as.fun->env);
+    		lval_del(v->as.fun->formals);
+    		lval_del(v->as.fun->body);
+    		if(v->as.fun->assumed) {
+    			lval_del(v->as.fun->source);
+    			lval_del(v->as.fun->assumed);
+    		}
+    		ljit_del(v->as.fun->jit);
+    		if(v->as.fun->memo) { lmemo_del(v->as.fun->memo); }
     	}
+    	free(v->as.fun);
     break;
     case LVAL_ERR: free(v->as.err); break;
     case LVAL_SYM: free(v->as.sym); break;
+    case LVAL_CHAN: lchan_del(v->as.chan); break;
+    case LVAL_MAP: lmap_del(v->as.map); break;
+    case LVAL_STREAM: lstream_del(v->as.stream); break;
+    case LVAL_I64VEC:
+    case LVAL_F64VEC: lvec_del(v->as.vec); break;
     case LVAL_QEXPR:
     case LVAL_SEXPR:
+      if(v->as.list.ints) {
+        free(v->as.list.ints);
+        break;
+      }
       for(int i=0; i < v->as.list.count; i++){
         lval_del(v->as.list.cell[i]);
       }
@@ -148,16 +450,15 @@ lval_delp(lval* v){
     break;
   }
 
-  // clear lvalue
+  // clear lvalue, lists built by hand rely on the rest being zeroed
   v->type = LVAL_UNDEF;
   v->hash = 0;
   v->ref_count = 0;
-  //v->as = 0;
+  memset(&v->as, 0, sizeof(v->as));
 
-  // if pointer is before last free value on the heap, set free value as next to get
-  if((v) < (HEAP->next_free_val)) {
-	  HEAP->next_free_val = v;
-  }
+  // cell is reused by the next allocation
+  v->as.next = HEAP->free;
+  HEAP->free = v;
 }
 
 lval*
@@ -166,6 +467,34 @@ lval_cp(lval* v) {
 	return v;
 }
 
+lval*
+lval_own(lval* v) {
+	if(v->ref_count <= 1) { return v; }
+
+	// value is shared, detach a private copy of it
+	lval* x;
+	if(v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+		x = lval_new();
+		x->type = v->type;
+		x->hash = v->hash;
+		x->as.list.count = v->as.list.count;
+		if(v->as.list.ints) {
+			x->as.list.ints = (long*)malloc(sizeof(long) * x->as.list.count);
+			memcpy(x->as.list.ints, v->as.list.ints, sizeof(long) * x->as.list.count);
+		} else {
+			x->as.list.cell = (lval**)malloc(sizeof(lval*) * x->as.list.count);
+			for(int i = 0; i < x->as.list.count; i++) {
+				x->as.list.cell[i] = lval_cp(v->as.list.cell[i]);
+			}
+		}
+	} else {
+		x = lval_dcp(v);
+	}
+
+	lval_del(v);
+	return x;
+}
+
 lval* lval_dcp(lval* v) {
 	lval* x = lval_new();
 	x->type = v->type;
@@ -174,26 +503,47 @@ lval* lval_dcp(lval* v) {
 
 	switch(v->type) {
 		case LVAL_NUM: x->as.num = v->as.num; break;
-		case LVAL_STR:
-			x->as.str = (char*)malloc(strlen(v->as.str)+1);
-			strcpy(x->as.str, v->as.str);
-			break;
+		case LVAL_FLOAT: x->as.flt = v->as.flt; break;
+		case LVAL_BIGNUM: x->as.big = lbig_copy(v->as.big); break;
+		case LVAL_STR: x->as.str = lstr_ref(v->as.str); break;
 		case LVAL_FUN:
-			if(v->as.fun.builtin){
-				x->as.fun.builtin = v->as.fun.builtin;
+			x->as.fun = lfun_new();
+			x->as.fun->macro = v->as.fun->macro;
+			x->as.fun->special = v->as.fun->special;
+			if(v->as.fun->builtin){
+				x->as.fun->builtin = v->as.fun->builtin;
 			} else {
-				x->as.fun.builtin = NULL;
-				x->as.fun.env = lenv_copy(v->as.fun.env);
-				x->as.fun.formals = lval_dcp(v->as.fun.formals);
-				x->as.fun.body = lval_dcp(v->as.fun.body);
+				x->as.fun->builtin = NULL;
+				x->as.fun->env = lenv_copy(v->as.fun->env);
+				x->as.fun->formals = lval_dcp(v->as.fun->formals);
+				x->as.fun->body = lval_dcp(v->as.fun->body);
+				if(v->as.fun->assumed) {
+					x->as.fun->source = lval_dcp(v->as.fun->source);
+					x->as.fun->assumed = lval_cp(v->as.fun->assumed);
+				}
+				x->as.fun->arity = v->as.fun->arity;
+				x->as.fun->variadic = v->as.fun->variadic;
+				x->as.fun->calls = 0;
+				x->as.fun->jit = NULL;
+				x->as.fun->memo = v->as.fun->memo ? lmemo_cp(v->as.fun->memo) : NULL;
 			}
 			break;
 		case LVAL_ERR: x->as.err = (char*)malloc(strlen(v->as.err)+1); strcpy(x->as.err, v->as.err); break;
 		case LVAL_SYM: x->as.sym = (char*)malloc(strlen(v->as.sym)+1); strcpy(x->as.sym, v->as.sym); break;
+		case LVAL_CHAN: x->as.chan = lchan_cp(v->as.chan); break;
+		case LVAL_MAP: x->as.map = lmap_cp(v->as.map); break;
+		case LVAL_STREAM: x->as.stream = lstream_cp(v->as.stream); break;
+		case LVAL_I64VEC:
+		case LVAL_F64VEC: x->as.vec = lvec_cp(v->as.vec); break;
 
 		case LVAL_SEXPR:
 		case LVAL_QEXPR:
 			x->as.list.count = v->as.list.count;
+			if(v->as.list.ints) {
+				x->as.list.ints = (long*)malloc(sizeof(long) * x->as.list.count);
+				memcpy(x->as.list.ints, v->as.list.ints, sizeof(long) * x->as.list.count);
+				break;
+			}
 			x->as.list.cell = (lval**)malloc(sizeof(lval*) * x->as.list.count);
 			for(int i = 0; i < x->as.list.count; i++) {
 				x->as.list.cell[i] = lval_dcp(v->as.list.cell[i]);
@@ -203,3 +553,114 @@ lval* lval_dcp(lval* v) {
 
 	return x;
 }
+
+lenv*
+lenv_clone(lenv* e) {
+	lenv* n = lenv_new();
+	for(int i = 0; i < e->map->cap; i++) {
+		hslot s = e->map->slots[i];
+		if(s.used == 1) {
+			hmap_put(n->map, s.hash, lval_clone(s.val));
+		}
+	}
+
+	return n;
+}
+
+lval*
+lval_clone(lval* v) {
+	// unlike lval_dcp this never touches reference counters of [v] or any of its inner values
+	if(v->type == LVAL_FUN && !v->as.fun->builtin) {
+		lval* x = lval_new();
+		x->type = LVAL_FUN;
+		x->hash = v->hash;
+		x->as.fun = lfun_new();
+		x->as.fun->builtin = NULL;
+		x->as.fun->env = lenv_clone(v->as.fun->env);
+		x->as.fun->formals = lval_clone(v->as.fun->formals);
+		x->as.fun->body = lval_clone(v->as.fun->body);
+		if(v->as.fun->assumed) {
+			x->as.fun->source = lval_clone(v->as.fun->source);
+			x->as.fun->assumed = lval_clone(v->as.fun->assumed);
+		}
+		x->as.fun->arity = v->as.fun->arity;
+		x->as.fun->variadic = v->as.fun->variadic;
+		x->as.fun->macro = v->as.fun->macro;
+		x->as.fun->special = 0;
+		x->as.fun->calls = 0;
+		x->as.fun->jit = NULL;
+		x->as.fun->memo = NULL;	// cached values belong to the other heap
+		return x;
+	}
+
+	if(v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+		lval* x = lval_new();
+		x->type = v->type;
+		x->hash = v->hash;
+		x->as.list.count = v->as.list.count;
+		if(v->as.list.ints) {
+			x->as.list.ints = (long*)malloc(sizeof(long) * x->as.list.count);
+			memcpy(x->as.list.ints, v->as.list.ints, sizeof(long) * x->as.list.count);
+			return x;
+		}
+		x->as.list.cell = (lval**)malloc(sizeof(lval*) * x->as.list.count);
+		for(int i = 0; i < x->as.list.count; i++) {
+			x->as.list.cell[i] = lval_clone(v->as.list.cell[i]);
+		}
+		return x;
+	}
+
+	if(v->type == LVAL_MAP) {
+		lval* x = lval_new();
+		x->type = LVAL_MAP;
+		x->hash = v->hash;
+		x->as.map = lmap_clone(v->as.map);
+		return x;
+	}
+
+	if(v->type == LVAL_I64VEC || v->type == LVAL_F64VEC) {
+		lval* x = lval_new();
+		x->type = v->type;
+		x->hash = v->hash;
+		x->as.vec = lvec_clone(v->as.vec);
+		return x;
+	}
+
+	if(v->type == LVAL_STR) {
+		// strings are shared by reference, so the new heap gets its own flat copy
+		lval* x = lval_new();
+		x->type = LVAL_STR;
+		x->hash = v->hash;
+		x->as.str = lstr_clone(v->as.str);
+		return x;
+	}
+
+	// channels and streams would be shared, callers reject them with lval_thread_bound
+	return lval_dcp(v);
+}
+
+int
+lval_thread_bound(lval* v) {
+	switch(v->type) {
+		case LVAL_CHAN:
+		case LVAL_STREAM:
+			return 1;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			if(v->as.list.ints) { return 0; }
+			for(int i = 0; i < v->as.list.count; i++) {
+				if(lval_thread_bound(v->as.list.cell[i])) { return 1; }
+			}
+			return 0;
+		case LVAL_MAP:
+			return lmap_any(v->as.map, lval_thread_bound);
+		case LVAL_FUN:
+			if(v->as.fun->builtin) { return 0; }
+			for(int i = 0; i < v->as.fun->env->map->cap; i++) {
+				hslot s = v->as.fun->env->map->slots[i];
+				if(s.used == 1 && lval_thread_bound(s.val)) { return 1; }
+			}
+			return lval_thread_bound(v->as.fun->body);
+	}
+	return 0;
+}
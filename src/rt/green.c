@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include "lval.h"
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * Cooperative green threads. Every thread runs on its own stack, so the
+ * evaluator keeps its recursive shape and a switch only saves callee-saved
+ * registers. Stacks are carved out of a few large shared reservations,
+ * committed by the kernel page by page as they grow, and are reused once
+ * a thread finishes. Thread which drives the interpreter takes part in
+ * scheduling as the main green thread: others run when it yields, blocks
+ * on a channel or finishes a top level form.
+ */
+
+/* As deep as a main thread stack where address space allows, pages are committed lazily. */
+#if UINTPTR_MAX > 0xffffffffUL
+#define GREEN_STACK_SIZE 	(64UL << 20)
+#define GREEN_SLAB_STACKS 	256		/* stacks carved out of one reservation */
+#else
+#define GREEN_STACK_SIZE 	(1UL << 20)
+#define GREEN_SLAB_STACKS 	32
+#endif
+#define GREEN_GUARD_SIZE 	4096
+#define GREEN_STACK_KEEP 	(64 << 10)
+#define GREEN_GUARDED_MAX 	16384	/* guards made by mprotect, each one costs a memory mapping */
+
+#if defined(__linux__) && !defined(MADV_GUARD_INSTALL)
+#define MADV_GUARD_INSTALL 	102
+#endif
+
+#if defined(__x86_64__)
+
+typedef struct { void* sp; } gctx;
+
+void green_swap(gctx* from, gctx* to);
+
+__asm__(
+	".text\n"
+	".globl green_swap\n"
+	".type green_swap, @function\n"
+	"green_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq (%rsi), %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size green_swap, .-green_swap\n"
+);
+
+void gctx_init(gctx* c, char* stack, size_t size, void (*entry)(void)) {
+	// stack frame popped by green_swap: 6 registers and return address to entry
+	void** sp = (void**)(((unsigned long)(stack + size)) & ~15UL);
+	*(--sp) = NULL;
+	*(--sp) = (void*)entry;
+	for(int i = 0; i < 6; i++) { *(--sp) = NULL; }
+	c->sp = sp;
+}
+
+#else
+
+#include <ucontext.h>
+
+typedef ucontext_t gctx;
+
+void green_swap(gctx* from, gctx* to) {
+	swapcontext(from, to);
+}
+
+void gctx_init(gctx* c, char* stack, size_t size, void (*entry)(void)) {
+	getcontext(c);
+	c->uc_stack.ss_sp = stack;
+	c->uc_stack.ss_size = size;
+	c->uc_link = NULL;
+	makecontext(c, entry, 0);
+}
+
+#endif
+
+typedef struct gtask gtask;
+
+struct gtask {
+	gctx 	ctx;
+	char* 	stack;		/* NULL for the main green thread */
+	lval* 	f;
+	lenv* 	env;
+	lchan* 	waiting;	/* channel the thread is blocked on */
+	int 	deadlock;
+	gtask* 	next;		/* link in run queue or channel wait queue */
+};
+
+typedef struct {
+	gtask 	main;
+	gtask* 	current;
+	gtask* 	head;		/* run queue */
+	gtask* 	tail;
+	gtask* 	dead;		/* finished thread, whose stack cannot be released until switched away from */
+	int 	ids;
+	int 	alive;
+	char* 	slab;		/* reservation new stacks are carved from */
+	int 	slab_used;
+	int 	guarded;
+	int 	nstacks;	/* free stacks, ready for reuse */
+	int 	carved;		/* all stacks, [stacks] has room for each */
+	char** 	stacks;
+} gsched;
+
+struct lchan {
+	int 	ref_count;
+	int 	cap;
+	int 	len;
+	int 	first;
+	lval** 	buf;
+	gtask* 	recvq;
+	gtask* 	sendq;
+};
+
+static __thread gsched* SCHED = NULL;
+
+gsched* gsched_get(void) {
+	if(!SCHED) {
+		SCHED = (gsched*)calloc(1, sizeof(gsched));
+		SCHED->current = &SCHED->main;
+	}
+	return SCHED;
+}
+
+void gsched_push(gsched* s, gtask* t) {
+	t->next = NULL;
+	if(s->tail) { s->tail->next = t; } else { s->head = t; }
+	s->tail = t;
+}
+
+gtask* gsched_pop(gsched* s) {
+	gtask* t = s->head;
+	if(t) {
+		s->head = t->next;
+		if(!s->head) { s->tail = NULL; }
+		t->next = NULL;
+	}
+	return t;
+}
+
+void gtask_enqueue(gtask** q, gtask* t) {
+	t->next = NULL;
+	while(*q) { q = &(*q)->next; }
+	*q = t;
+}
+
+void gtask_unlink(gtask** q, gtask* t) {
+	while(*q && *q != t) { q = &(*q)->next; }
+	if(*q) { *q = t->next; }
+	t->next = NULL;
+}
+
+/* Makes the lowest page of [stack] fault on access. A guard region leaves the mapping in one piece where
+ * the kernel supports it, mprotect splits it, and processes only get so many mappings. */
+int gstack_guard(gsched* s, char* stack) {
+#ifdef MADV_GUARD_INSTALL
+	if(madvise(stack, GREEN_GUARD_SIZE, MADV_GUARD_INSTALL) == 0) { return 1; }
+#endif
+	if(s->guarded >= GREEN_GUARDED_MAX) { return 0; }
+	if(mprotect(stack, GREEN_GUARD_SIZE, PROT_NONE) != 0) { return 0; }
+	s->guarded++;
+	return 1;
+}
+
+char* gstack_new(gsched* s) {
+	if(s->nstacks > 0) { return s->stacks[--s->nstacks]; }
+
+	// stacks are never unmapped one by one, so released ones always fit the free list
+	char** stacks = (char**)realloc(s->stacks, sizeof(char*) * (s->carved + 1));
+	if(!stacks) { return NULL; }
+	s->stacks = stacks;
+
+	if(!s->slab || s->slab_used == GREEN_SLAB_STACKS) {
+		char* slab = (char*)mmap(NULL, GREEN_STACK_SIZE * GREEN_SLAB_STACKS, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(slab == MAP_FAILED) { return NULL; }
+		s->slab = slab;
+		s->slab_used = 0;
+	}
+
+	char* stack = s->slab + GREEN_STACK_SIZE * s->slab_used;
+	if(!gstack_guard(s, stack)) { return NULL; }
+	s->slab_used++;
+	s->carved++;
+	return stack;
+}
+
+void gstack_del(gsched* s, char* stack) {
+	// pages a deep recursion committed are given back, top of the stack stays warm
+	madvise(stack + GREEN_GUARD_SIZE, GREEN_STACK_SIZE - GREEN_GUARD_SIZE - GREEN_STACK_KEEP, MADV_DONTNEED);
+	s->stacks[s->nstacks++] = stack;
+}
+
+/* Releases thread which finished before switching to the current one. */
+void gsched_reap(gsched* s) {
+	if(s->dead && s->dead != s->current) {
+		gstack_del(s, s->dead->stack);
+		free(s->dead);
+		s->dead = NULL;
+	}
+}
+
+void gsched_switch(gsched* s, gtask* next) {
+	gtask* prev = s->current;
+	s->current = next;
+	green_swap(&prev->ctx, &next->ctx);
+	gsched_reap(s);
+}
+
+/* Picks next runnable thread. If there's none, main thread blocked on a channel is woken up to report a deadlock. */
+gtask* gsched_next(gsched* s) {
+	gtask* next = gsched_pop(s);
+	if(next || s->current == &s->main) { return next; }
+
+	next = &s->main;
+	next->deadlock = 1;
+	if(next->waiting) {
+		gtask_unlink(&next->waiting->recvq, next);
+		gtask_unlink(&next->waiting->sendq, next);
+	}
+	return next;
+}
+
+void green_entry(void) {
+	gsched* s = SCHED;
+	gsched_reap(s);
+
+	gtask* t = s->current;
+	lval* r = lval_call(t->env, t->f, lval_sexpr());
+	if(r->type == LVAL_ERR) { lval_println(r); }
+	lval_del(r);
+	lval_del(t->f);
+
+	s->alive--;
+	s->dead = t;
+	gsched_switch(s, gsched_next(s));
+}
+
+/* Suspends current thread blocked on a channel [q]. Returns 0 when it can never be woken up. */
+int green_block(gsched* s, lchan* c, gtask** q) {
+	gtask* t = s->current;
+	gtask_enqueue(q, t);
+	t->waiting = c;
+
+	gtask* next = gsched_next(s);
+	if(!next) {
+		gtask_unlink(q, t);
+		t->waiting = NULL;
+		return 0;
+	}
+
+	gsched_switch(s, next);
+	t->waiting = NULL;
+
+	if(t->deadlock) {
+		t->deadlock = 0;
+		return 0;
+	}
+	return 1;
+}
+
+void green_wake(gsched* s, gtask** q) {
+	gtask* t = *q;
+	if(t) {
+		*q = t->next;
+		gsched_push(s, t);
+	}
+}
+
+void green_run(void) {
+	gsched* s = SCHED;
+	if(!s || s->current != &s->main) { return; }
+
+	while(s->head) {
+		gsched_push(s, &s->main);
+		gsched_switch(s, gsched_pop(s));
+	}
+}
+
+int green_alive(void) {
+	return SCHED ? SCHED->alive : 0;
+}
+
+lchan* lchan_new(int cap) {
+	lchan* c = (lchan*)calloc(1, sizeof(lchan));
+	c->ref_count = 1;
+	c->cap = cap;
+	c->buf = (lval**)malloc(sizeof(lval*) * cap);
+	return c;
+}
+
+lchan* lchan_cp(lchan* c) {
+	c->ref_count++;
+	return c;
+}
+
+void lchan_del(lchan* c) {
+	if(--c->ref_count > 0) { return; }
+
+	for(int i = 0; i < c->len; i++) {
+		lval_del(c->buf[(c->first + i) % c->cap]);
+	}
+	free(c->buf);
+	free(c);
+}
+
+lval* builtin_spawn(lenv* e, lval* a) {
+	LASSERT_NUM("spawn", a, 1);
+	LASSERT_TYPE("spawn", a, 0, LVAL_FUN);
+
+	gsched* s = gsched_get();
+	gtask* t = (gtask*)calloc(1, sizeof(gtask));
+	if(!t) {
+		lval_del(a);
+		return lval_err("Function 'spawn' could not allocate green thread.");
+	}
+	t->stack = gstack_new(s);
+	if(!t->stack) {
+		free(t);
+		lval_del(a);
+		return lval_err("Function 'spawn' could not allocate green thread stack.");
+	}
+
+	// green threads outlive the calling function, so they're run in root environment
+	while(e->par) { e = e->par; }
+	t->env = e;
+	t->f = lval_pop(a, 0);
+	lval_del(a);
+
+	gctx_init(&t->ctx, t->stack, GREEN_STACK_SIZE, green_entry);
+	gsched_push(s, t);
+	s->alive++;
+
+	return lval_num(++s->ids);
+}
+
+lval* builtin_yield(lenv* e, lval* a) {
+	LASSERT_NUM("yield", a, 0);
+	lval_del(a);
+
+	gsched* s = gsched_get();
+	if(s->head) {
+		gsched_push(s, s->current);
+		gsched_switch(s, gsched_pop(s));
+	}
+
+	return lval_sexpr();
+}
+
+lval* builtin_chan(lenv* e, lval* a) {
+	LASSERT_NUM("chan", a, 1);
+	LASSERT_TYPE("chan", a, 0, LVAL_NUM);
+	LASSERT(a, a->as.list.cell[0]->as.num > 0,
+		"Function 'chan' expects positive capacity. Got %li.", a->as.list.cell[0]->as.num);
+
+	int cap = (int)a->as.list.cell[0]->as.num;
+	lval_del(a);
+
+	return lval_chan(lchan_new(cap));
+}
+
+lval* builtin_send(lenv* e, lval* a) {
+	LASSERT_NUM("send", a, 2);
+	LASSERT_TYPE("send", a, 0, LVAL_CHAN);
+
+	gsched* s = gsched_get();
+	lchan* c = a->as.list.cell[0]->as.chan;
+
+	while(c->len == c->cap) {
+		if(!green_block(s, c, &c->sendq)) {
+			lval_del(a);
+			return lval_err("Deadlock: 'send' on a full channel with no green thread left to receive.");
+		}
+	}
+
+	c->buf[(c->first + c->len) % c->cap] = lval_pop(a, 1);
+	c->len++;
+	green_wake(s, &c->recvq);
+
+	lval_del(a);
+	return lval_sexpr();
+}
+
+lval* builtin_recv(lenv* e, lval* a) {
+	LASSERT_NUM("recv", a, 1);
+	LASSERT_TYPE("recv", a, 0, LVAL_CHAN);
+
+	gsched* s = gsched_get();
+	lchan* c = a->as.list.cell[0]->as.chan;
+
+	while(c->len == 0) {
+		if(!green_block(s, c, &c->recvq)) {
+			lval_del(a);
+			return lval_err("Deadlock: 'recv' on an empty channel with no green thread left to send.");
+		}
+	}
+
+	lval* x = c->buf[c->first];
+	c->first = (c->first + 1) % c->cap;
+	c->len--;
+	green_wake(s, &c->sendq);
+
+	lval_del(a);
+	return x;
+}
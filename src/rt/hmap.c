@@ -1,10 +1,11 @@
 #include "hmap.h"
 #include <stdlib.h>
+#include <string.h>
 
 #define HASH_INIT_SIZE 4
 #define HASH_GROWT_RATE 2
 
-#define HASH_RES(h, key) key % h->cap
+#define HASH_RES(h, key) ((unsigned int)(key) % (h)->cap)
 
 hmap* hmap_new(void) {
 	 hmap* h = (hmap*)malloc(sizeof(hmap));
@@ -71,12 +72,11 @@ int hmap_put(hmap* h, int hash, void* val) {
 	}
 
 	// set in data
+	if(!h->slots[i].used) { h->len++; }
    	h->slots[i].val = val;
 	h->slots[i].used = 1;
 	h->slots[i].hash = hash;
 
-	h->len++;
-
 	return HASH_OK;
 }
 
@@ -86,13 +86,14 @@ int hmap_rehash(hmap* h) {
 	hslot* tmp = (hslot*)malloc(sizeof(hslot) * new_size);
 	if(!tmp) { return HASH_MEM_OUT; }
 
-	memset(tmp, 0, new_size);
+	memset(tmp, 0, sizeof(hslot) * new_size);
 	hslot* curr = h->slots;
 	h->slots = tmp;
 	h->cap = new_size;
 	h->len = 0;
 
 	for(int i = 0; i < old_size; i++) {
+		if(!curr[i].used) { continue; }
 		int status = hmap_put(h, curr[i].hash, curr[i].val);
 		if(status != HASH_OK) return status;
 	}
@@ -26,6 +26,7 @@ void hmap_del(hmap* h);
 int hmap_put(hmap* h, int key, void* val);
 void* hmap_get(hmap* h, int key);
 int hmap_rem(hmap* h, int key);
+int hmap_rehash(hmap* h);
 
 unsigned int hmap_int_h(int key);
 unsigned int hmap_str_h(char* s);
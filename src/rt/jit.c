@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include "lval.h"
+#include <limits.h>
+#include <pthread.h>
+
+/*
+ * Baseline JIT for hot lambdas. Once a lambda has been called often enough
+ * its body is translated, template by template, into x86-64 code working on
+ * machine integers. Only bodies made of integer literals, formals, '+ - *',
+ * comparisons, 'if' and calls to the lambda itself are compiled - these have
+ * no side effects, so whenever native code meets something it can't do
+ * exactly like the interpreter (an overflow needing a big integer, arguments
+ * that aren't machine integers, too deep recursion) it gives up and the call
+ * is simply evaluated again by the interpreter.
+ *
+ * Symbols are resolved dynamically, so names the body looks up are checked on
+ * every entry to still mean what they meant at compile time. Lambdas that
+ * keep giving up are handed back to the interpreter for good.
+ *
+ * Set QSP_NO_JIT (or pass --no-jit) to interpret everything.
+ */
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define LJIT_X64 1
+#endif
+
+#define LJIT_THRESHOLD 	1000	/* calls before a lambda is compiled */
+#define LJIT_MAX_DEPTH 	4096	/* native frames before giving up */
+#define LJIT_MAX_BAILS 	64		/* runs given up before a lambda stays interpreted */
+#define LJIT_MAX_CODE 	65536	/* bytes of code per lambda */
+
+struct ljit {
+	ljit_code 	code;
+	size_t 		size;
+	int 		bails;
+	int 		nguards;
+	lval** 		guards;		/* symbols looked up by the body */
+	lval** 		expect;		/* what they resolved to, NULL for the lambda itself */
+};
+
+/* Marks lambdas which can't or shouldn't be compiled. */
+static ljit LJIT_NONE;
+
+static int ljit_enabled;
+static pthread_once_t LJIT_ONCE = PTHREAD_ONCE_INIT;
+
+/* Parallel jobs ask too, so the environment is read exactly once. */
+static void ljit_init(void) {
+	ljit_enabled = getenv("QSP_NO_JIT") == NULL;
+}
+
+void ljit_enable(int on) {
+	pthread_once(&LJIT_ONCE, ljit_init);
+	ljit_enabled = on;
+}
+
+static int ljit_on(void) {
+	pthread_once(&LJIT_ONCE, ljit_init);
+	return ljit_enabled;
+}
+
+void ljit_del(ljit* j) {
+	if(j == NULL || j == &LJIT_NONE) { return; }
+#ifdef LJIT_X64
+	// code compiled ahead of time isn't mapped
+	if(j->size) { munmap((void*)j->code, j->size); }
+#endif
+	for(int i = 0; i < j->nguards; i++) {
+		lval_del(j->guards[i]);
+		if(j->expect[i]) { lval_del(j->expect[i]); }
+	}
+	free(j->guards);
+	free(j->expect);
+	free(j);
+}
+
+/* Records that [sym] has to resolve to [h] on entry, or to the lambda itself if [h] is NULL. */
+static void ljit_guard(ljit* j, lval* sym, lval* h) {
+	for(int i = 0; i < j->nguards; i++) {
+		if(strcmp(j->guards[i]->as.sym, sym->as.sym) == 0) { return; }
+	}
+	j->guards = (lval**)realloc(j->guards, sizeof(lval*) * (j->nguards + 1));
+	j->expect = (lval**)realloc(j->expect, sizeof(lval*) * (j->nguards + 1));
+	j->guards[j->nguards] = lval_cp(sym);
+	j->expect[j->nguards] = h ? lval_cp(h) : NULL;
+	j->nguards++;
+}
+
+#ifdef LJIT_X64
+
+/* Code being assembled for lambda [f], called from environment [e]. */
+typedef struct {
+	unsigned char* 	buf;
+	int 			len;
+	int 			cap;
+	int* 			bails;		/* offsets of jumps to the bail-out path */
+	int 			nbails;
+	lenv* 			e;
+	lval* 			f;
+	ljit* 			j;
+} ljit_asm;
+
+static void ljit_emit(ljit_asm* a, const unsigned char* b, int n) {
+	if(a->len + n > a->cap) {
+		a->cap = (a->len + n) * 2;
+		a->buf = (unsigned char*)realloc(a->buf, a->cap);
+	}
+	memcpy(a->buf + a->len, b, n);
+	a->len += n;
+}
+
+#define LJIT_EMIT(a, ...) do { 								\
+		static const unsigned char b_[] = { __VA_ARGS__ }; 	\
+		ljit_emit(a, b_, sizeof(b_)); 						\
+	} while(0)
+
+/* Little endian immediate of [n] bytes. */
+static void ljit_imm(ljit_asm* a, long v, int n) {
+	unsigned char b[8];
+	for(int i = 0; i < n; i++) { b[i] = (unsigned char)(v >> (8 * i)); }
+	ljit_emit(a, b, n);
+}
+
+static void ljit_patch(ljit_asm* a, int at, int target) {
+	int rel = target - (at + 4);
+	memcpy(a->buf + at, &rel, 4);
+}
+
+/* Emits a jump whose 32 bit offset is patched later, returning where it is. */
+static int ljit_jump(ljit_asm* a) {
+	int at = a->len;
+	ljit_imm(a, 0, 4);
+	return at;
+}
+
+static void ljit_bail_on(ljit_asm* a) {
+	a->bails = (int*)realloc(a->bails, sizeof(int) * (a->nbails + 1));
+	a->bails[a->nbails++] = ljit_jump(a);
+}
+
+static int ljit_formal(lval* f, lval* sym) {
+	// later formals of the same name win, as with lenv_put
+	int r = -1;
+	for(int i = 0; i < f->as.fun->arity; i++) {
+		if(strcmp(LVAL_CELLS(f->as.fun->formals)[i]->as.sym, sym->as.sym) == 0) { r = i; }
+	}
+	return r;
+}
+
+/* Resolves [sym] called by the body, recording it to be checked on entry. */
+static lbuiltin ljit_resolve(ljit_asm* a, lval* sym, int* self) {
+	lval* h = lenv_get(a->e, sym);
+	lbuiltin b = NULL;
+	*self = 0;
+	if(h->type == LVAL_FUN && !h->as.fun->macro) {
+		b = h->as.fun->builtin;
+		*self = (h == a->f);
+	}
+	if(b || *self) { ljit_guard(a->j, sym, *self ? NULL : h); }
+	lval_del(h);
+	return b;
+}
+
+static int ljit_expr(ljit_asm* a, lval* x);
+static int ljit_apply(ljit_asm* a, lval* x);
+
+/* Block evaluated the way 'eval' does, as an S-Expression. Branches of 'if' may be plain expressions too. */
+static int ljit_block(ljit_asm* a, lval* b) {
+	if(b->type != LVAL_QEXPR) { return ljit_expr(a, b); }
+	if(b->as.list.count == 1) { return ljit_expr(a, LVAL_CELLS(b)[0]); }
+	return ljit_apply(a, b);
+}
+
+/* Compiles [x] leaving its value in rax. */
+static int ljit_expr(ljit_asm* a, lval* x) {
+	switch(x->type) {
+	case LVAL_NUM:
+		LJIT_EMIT(a, 0x48, 0xB8);						// mov rax, imm64
+		ljit_imm(a, x->as.num, 8);
+		return 1;
+	case LVAL_SYM: {
+		int i = ljit_formal(a->f, x);
+		if(i < 0) { return 0; }
+		LJIT_EMIT(a, 0x48, 0x8B, 0x83);					// mov rax, [rbx + 8*i]
+		ljit_imm(a, 8 * i, 4);
+		return 1;
+	}
+	case LVAL_SEXPR:
+		if(x->as.list.count == 1) { return ljit_expr(a, LVAL_CELLS(x)[0]); }
+		return ljit_apply(a, x);
+	}
+	return 0;
+}
+
+/* Compiles operands of [x] folded left with [op], bailing out on overflow. */
+static int ljit_fold(ljit_asm* a, lval* x, lbuiltin op) {
+	int n = x->as.list.count;
+	if(!ljit_expr(a, LVAL_CELLS(x)[1])) { return 0; }
+
+	if(n == 2 && op == builtin_sub) {
+		LJIT_EMIT(a, 0x48, 0xF7, 0xD8);					// neg rax
+		LJIT_EMIT(a, 0x0F, 0x80);						// jo bail
+		ljit_bail_on(a);
+		return 1;
+	}
+
+	for(int i = 2; i < n; i++) {
+		LJIT_EMIT(a, 0x50);								// push rax
+		if(!ljit_expr(a, LVAL_CELLS(x)[i])) { return 0; }
+		LJIT_EMIT(a, 0x48, 0x89, 0xC1);					// mov rcx, rax
+		LJIT_EMIT(a, 0x58);								// pop rax
+		if(op == builtin_add) { LJIT_EMIT(a, 0x48, 0x01, 0xC8); }			// add rax, rcx
+		else if(op == builtin_sub) { LJIT_EMIT(a, 0x48, 0x29, 0xC8); }		// sub rax, rcx
+		else { LJIT_EMIT(a, 0x48, 0x0F, 0xAF, 0xC1); }						// imul rax, rcx
+		LJIT_EMIT(a, 0x0F, 0x80);						// jo bail
+		ljit_bail_on(a);
+	}
+	return 1;
+}
+
+static int ljit_compare(ljit_asm* a, lval* x, unsigned char setcc) {
+	if(x->as.list.count != 3) { return 0; }
+	if(!ljit_expr(a, LVAL_CELLS(x)[1])) { return 0; }
+	LJIT_EMIT(a, 0x50);									// push rax
+	if(!ljit_expr(a, LVAL_CELLS(x)[2])) { return 0; }
+	LJIT_EMIT(a, 0x48, 0x89, 0xC1);						// mov rcx, rax
+	LJIT_EMIT(a, 0x58);									// pop rax
+	LJIT_EMIT(a, 0x48, 0x39, 0xC8);						// cmp rax, rcx
+	unsigned char set[] = { 0x0F, setcc, 0xC0 };		// setcc al
+	ljit_emit(a, set, 3);
+	LJIT_EMIT(a, 0x0F, 0xB6, 0xC0);						// movzx eax, al
+	return 1;
+}
+
+static int ljit_if(ljit_asm* a, lval* x) {
+	if(x->as.list.count != 4) { return 0; }
+	if(!ljit_expr(a, LVAL_CELLS(x)[1])) { return 0; }
+	LJIT_EMIT(a, 0x48, 0x85, 0xC0);						// test rax, rax
+	LJIT_EMIT(a, 0x0F, 0x84);							// jz else
+	int to_else = ljit_jump(a);
+	if(!ljit_block(a, LVAL_CELLS(x)[2])) { return 0; }
+	LJIT_EMIT(a, 0xE9);									// jmp end
+	int to_end = ljit_jump(a);
+	ljit_patch(a, to_else, a->len);
+	if(!ljit_block(a, LVAL_CELLS(x)[3])) { return 0; }
+	ljit_patch(a, to_end, a->len);
+	return 1;
+}
+
+/* Calls the compiled lambda itself, with arguments pushed so they form an array. */
+static int ljit_self(ljit_asm* a, lval* x) {
+	int n = x->as.list.count - 1;
+	if(n != a->f->as.fun->arity) { return 0; }
+
+	for(int i = n; i >= 1; i--) {
+		if(!ljit_expr(a, LVAL_CELLS(x)[i])) { return 0; }
+		LJIT_EMIT(a, 0x50);								// push rax
+	}
+	LJIT_EMIT(a, 0x48, 0x89, 0xE7);						// mov rdi, rsp
+	LJIT_EMIT(a, 0x4C, 0x89, 0xE6);						// mov rsi, r12
+	LJIT_EMIT(a, 0xE8);									// call entry
+	ljit_patch(a, ljit_jump(a), 0);
+	LJIT_EMIT(a, 0x48, 0x81, 0xC4);						// add rsp, 8*n
+	ljit_imm(a, 8 * n, 4);
+	LJIT_EMIT(a, 0x49, 0x83, 0x7C, 0x24, 0x08, 0x00);	// cmp qword [r12 + 8], 0
+	LJIT_EMIT(a, 0x0F, 0x85);							// jne bail
+	ljit_bail_on(a);
+	return 1;
+}
+
+static int ljit_apply(ljit_asm* a, lval* x) {
+	if(x->as.list.count < 2) { return 0; }
+	lval* h = LVAL_CELLS(x)[0];
+	if(h->type != LVAL_SYM || ljit_formal(a->f, h) >= 0) { return 0; }
+
+	int self;
+	lbuiltin b = ljit_resolve(a, h, &self);
+	if(self) { return ljit_self(a, x); }
+
+	if(b == builtin_add || b == builtin_sub || b == builtin_mul) { return ljit_fold(a, x, b); }
+	if(b == builtin_lt) { return ljit_compare(a, x, 0x9C); }
+	if(b == builtin_le) { return ljit_compare(a, x, 0x9E); }
+	if(b == builtin_gt) { return ljit_compare(a, x, 0x9F); }
+	if(b == builtin_ge) { return ljit_compare(a, x, 0x9D); }
+	if(b == builtin_eq) { return ljit_compare(a, x, 0x94); }
+	if(b == builtin_ne) { return ljit_compare(a, x, 0x95); }
+	if(b == builtin_if) { return ljit_if(a, x); }
+	return 0;
+}
+
+/* Translates body of [f], returning LJIT_NONE when it uses anything not supported. */
+static ljit* ljit_compile(lenv* e, lval* f) {
+	if(f->as.fun->variadic || f->as.fun->macro || f->as.fun->env->map->len != 0) { return &LJIT_NONE; }
+
+	ljit* j = (ljit*)calloc(1, sizeof(ljit));
+	ljit_asm a = { NULL, 0, 0, NULL, 0, e, f, j };
+
+	// prologue - rbx points to arguments, r12 to the run's state
+	LJIT_EMIT(&a, 0x55);								// push rbp
+	LJIT_EMIT(&a, 0x48, 0x89, 0xE5);					// mov rbp, rsp
+	LJIT_EMIT(&a, 0x53);								// push rbx
+	LJIT_EMIT(&a, 0x41, 0x54);							// push r12
+	LJIT_EMIT(&a, 0x48, 0x89, 0xFB);					// mov rbx, rdi
+	LJIT_EMIT(&a, 0x49, 0x89, 0xF4);					// mov r12, rsi
+	LJIT_EMIT(&a, 0x49, 0xFF, 0x04, 0x24);				// inc qword [r12]
+	LJIT_EMIT(&a, 0x49, 0x81, 0x3C, 0x24);				// cmp qword [r12], max
+	ljit_imm(&a, LJIT_MAX_DEPTH, 4);
+	LJIT_EMIT(&a, 0x0F, 0x8F);							// jg bail
+	ljit_bail_on(&a);
+
+	int ok = ljit_block(&a, f->as.fun->body);
+
+	// epilogue, shared with the bail-out path below which may leave operands pushed
+	int epilogue = a.len;
+	LJIT_EMIT(&a, 0x49, 0xFF, 0x0C, 0x24);				// dec qword [r12]
+	LJIT_EMIT(&a, 0x48, 0x8D, 0x65, 0xF0);				// lea rsp, [rbp - 16]
+	LJIT_EMIT(&a, 0x41, 0x5C);							// pop r12
+	LJIT_EMIT(&a, 0x5B);								// pop rbx
+	LJIT_EMIT(&a, 0x5D);								// pop rbp
+	LJIT_EMIT(&a, 0xC3);								// ret
+
+	int bail = a.len;
+	LJIT_EMIT(&a, 0x49, 0xC7, 0x44, 0x24, 0x08);		// mov qword [r12 + 8], 1
+	ljit_imm(&a, 1, 4);
+	LJIT_EMIT(&a, 0xE9);								// jmp epilogue
+	ljit_patch(&a, ljit_jump(&a), epilogue);
+	for(int i = 0; i < a.nbails; i++) { ljit_patch(&a, a.bails[i], bail); }
+	free(a.bails);
+
+	void* mem = MAP_FAILED;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = ((size_t)a.len + page - 1) / page * page;
+	if(ok && a.len <= LJIT_MAX_CODE) {
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if(mem != MAP_FAILED) {
+		memcpy(mem, a.buf, a.len);
+		if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+			munmap(mem, size);
+			mem = MAP_FAILED;
+		}
+	}
+	free(a.buf);
+
+	if(mem == MAP_FAILED) {
+		ljit_del(j);
+		return &LJIT_NONE;
+	}
+	j->code = (ljit_code)mem;
+	j->size = size;
+	return j;
+}
+
+#else
+
+static ljit* ljit_compile(lenv* e, lval* f) { return &LJIT_NONE; }
+
+#endif
+
+lval* ljit_call(lenv* e, lval* f, lval** args, int n) {
+	// native self calls would go around the cache
+	if(f->as.fun->memo) { return NULL; }
+
+	if(f->as.fun->jit == NULL) {
+		if(++f->as.fun->calls < LJIT_THRESHOLD) { return NULL; }
+		f->as.fun->jit = ljit_on() ? ljit_compile(e, f) : &LJIT_NONE;
+	}
+
+	ljit* j = f->as.fun->jit;
+	if(j == &LJIT_NONE || n != f->as.fun->arity) { return NULL; }
+
+	long nums[n + 1];
+	for(int i = 0; i < n; i++) {
+		if(args[i]->type != LVAL_NUM) { return NULL; }
+		nums[i] = args[i]->as.num;
+	}
+
+	// names used by the body must still resolve to the same functions
+	for(int i = 0; i < j->nguards; i++) {
+		lval* h = lenv_get(e, j->guards[i]);
+		int same = h == (j->expect[i] ? j->expect[i] : f);
+		lval_del(h);
+		if(!same) { return NULL; }
+	}
+
+	ljit_ctx ctx = { 0, 0 };
+	long r = j->code(nums, &ctx);
+	if(ctx.failed) {
+		if(++j->bails >= LJIT_MAX_BAILS) {
+			ljit_del(j);
+			f->as.fun->jit = &LJIT_NONE;
+		}
+		return NULL;
+	}
+
+	return lval_num(r);
+}
+
+int ljit_install(lenv* e, const ljit_native* n) {
+	if(!ljit_on()) { return 0; }
+
+	lval* k = lval_sym((char*)n->name);
+	lval* f = lenv_get(e, k);
+	lval_del(k);
+	if(f->type != LVAL_FUN || f->as.fun->builtin || (f->as.fun->jit && f->as.fun->jit != &LJIT_NONE)) {
+		lval_del(f);
+		return 0;
+	}
+
+	ljit* j = (ljit*)calloc(1, sizeof(ljit));
+	j->code = n->code;
+	int ok = 1;
+	for(int i = 0; i < n->nsyms && ok; i++) {
+		const ljit_sym* s = &n->syms[i];
+		k = lval_sym((char*)s->name);
+		lval* h = lenv_get(e, k);
+		if(s->builtin) {
+			ok = h->type == LVAL_FUN && h->as.fun->builtin == s->builtin;
+		} else {
+			ok = h->type == LVAL_FUN && !h->as.fun->builtin && !h->as.fun->macro && lval_hash(h) == s->hash;
+		}
+		if(ok) { ljit_guard(j, k, h == f ? NULL : h); }
+		lval_del(h);
+		lval_del(k);
+	}
+
+	if(ok) {
+		f->as.fun->jit = j;
+	} else {
+		ljit_del(j);
+	}
+	lval_del(f);
+	return ok;
+}
@@ -10,10 +10,17 @@ char * ltype_name(int t) {
 	case LVAL_ERR: return "Error";
 	case LVAL_FUN: return "Function";
 	case LVAL_NUM: return "Number";
+	case LVAL_FLOAT: return "Float";
+	case LVAL_BIGNUM: return "Number";
 	case LVAL_QEXPR: return "Q-Expression";
 	case LVAL_SEXPR: return "S-Expression";
 	case LVAL_SYM: return "Symbol";
 	case LVAL_STR: return "String";
+	case LVAL_CHAN: return "Channel";
+	case LVAL_MAP: return "Map";
+	case LVAL_STREAM: return "Stream";
+	case LVAL_I64VEC: return "I64-Vector";
+	case LVAL_F64VEC: return "F64-Vector";
 	default: return "Unknown";
 	}
 }
@@ -27,20 +34,82 @@ lval* lval_num(long x) {
   return v;
 }
 
+/* Create a new float type lval */
+lval* lval_float(double x) {
+  lval* v = lval_new();
+  v->type = LVAL_FLOAT;
+  v->as.flt = x;
+  lval_num_rehash(v);
+  return v;
+}
+
+/* Create a new big integer type lval. Takes ownership of [b] */
+lval* lval_bignum(lbig* b) {
+  lval* v = lval_new();
+  v->type = LVAL_BIGNUM;
+  v->as.big = b;
+  lval_num_rehash(v);
+  return v;
+}
+
+lval* lval_integer(lbig* b) {
+	long x;
+	if(lbig_to_long(b, &x)) {
+		lbig_del(b);
+		return lval_num(x);
+	}
+	return lval_bignum(b);
+}
+
+lbig* lval_to_big(lval* v) {
+	return v->type == LVAL_BIGNUM ? lbig_copy(v->as.big) : lbig_from_long(v->as.num);
+}
+
+void lval_num_rehash(lval* v) {
+	if(v->type == LVAL_BIGNUM) {
+		v->hash = hmap_int_h((int)lbig_hash(v->as.big));
+	} else if(v->type == LVAL_FLOAT) {
+		long bits;
+		memcpy(&bits, &v->as.flt, sizeof(bits));
+		v->hash = hmap_int_h((int)(bits ^ (bits >> 32)));
+	} else {
+		v->hash = hmap_int_h(v->as.num);
+	}
+}
+
+double lval_to_double(lval* v) {
+	switch(v->type) {
+		case LVAL_FLOAT: return v->as.flt;
+		case LVAL_BIGNUM: return lbig_to_double(v->as.big);
+		default: return (double)v->as.num;
+	}
+}
+
 lval* lval_str(char* s) {
+	  return lval_lstr(lstr_from(s));
+}
+
+/* Create a new string type lval. Takes ownership of [s] */
+lval* lval_lstr(lstr* s) {
 	  lval* v = lval_new();
 	  v->type = LVAL_STR;
-	  v->hash = hmap_str_h(s);
-	  v->as.str = (char*)malloc(strlen(s) + 1);
-	  strcpy(v->as.str, s);
+	  v->hash = (int)s->hash;
+	  v->as.str = s;
 	  return v;
 }
 
+lfun* lfun_new(void) {
+	return (lfun*)calloc(1, sizeof(lfun));
+}
+
 lval* lval_fun(lbuiltin func) {
 	  lval* v = lval_new();
 	  v->type = LVAL_FUN;
-	  v->hash = hmap_int_h((int*)func);
-	  v->as.fun.builtin = func;
+	  v->as.fun = lfun_new();
+	  v->hash = hmap_int_h((int)(long)func);
+	  v->as.fun->builtin = func;
+	  v->as.fun->macro = 0;
+	  v->as.fun->special = 0;
 	  return v;
 }
 
@@ -48,10 +117,21 @@ lval* lval_lambda(lval* formals, lval* body) {
 	lval* v = lval_new();
 
 	v->type = LVAL_FUN;
-	v->as.fun.builtin = NULL;
-	v->as.fun.env = lenv_new();
-	v->as.fun.formals = formals;
-	v->as.fun.body = body;
+	v->as.fun = lfun_new();
+	v->as.fun->builtin = NULL;
+	v->as.fun->env = lenv_new();
+	v->as.fun->formals = formals;
+	v->as.fun->body = body;
+	v->as.fun->macro = 0;
+	v->as.fun->special = 0;
+	v->as.fun->calls = 0;
+	v->as.fun->jit = NULL;
+	v->as.fun->memo = NULL;
+
+	// resolve argument counts once, instead of on every call
+	int n = formals->as.list.count;
+	v->as.fun->variadic = (n >= 2 && strcmp(LVAL_CELLS(formals)[n-2]->as.sym, "&") == 0);
+	v->as.fun->arity = v->as.fun->variadic ? n - 2 : n;
 
 	int h = formals->hash ^ body->hash;
 	v->hash = h;
@@ -82,12 +162,12 @@ lval* lval_err(char* fmt, ...) {
 lenv* lenv_copy(lenv* env) {
 	lenv* n = (lenv*)malloc(sizeof(lenv));
 	n->par = env->par;
+	n->src = env->src;
 	n->map = hmap_new();
 	for(int i = 0; i < env->map->cap; i++) {
 		hslot s = env->map->slots[i];
 		if(s.used == 1) {
-			lval* cp = lval_cp(s.val);
-			hmap_put(n->map, cp->hash, cp);
+			hmap_put(n->map, s.hash, lval_cp(s.val));
 		}
 	}
 
@@ -109,6 +189,7 @@ lval* lval_sexpr(void){
   v->hash = hmap_list_h(0, NULL);
   v->as.list.count = 0;
   v->as.list.cell = NULL;
+  v->as.list.ints = NULL;
 
   return v;
 }
@@ -119,71 +200,114 @@ lval* lval_qexpr(void) {
 	v->hash = hmap_list_h(0, NULL);
 	v->as.list.count = 0;
 	v->as.list.cell = NULL;
+	v->as.list.ints = NULL;
 
 	return v;
 }
 
+lval* lval_chan(lchan* c) {
+	lval* v = lval_new();
+	v->type = LVAL_CHAN;
+	v->hash = hmap_int_h((int)(long)c);
+	v->as.chan = c;
+	return v;
+}
+
 lval* lval_add(lval* e, lval* x) {
+  // hash is extended the same way hmap_list_h computes it, instead of rehashing the whole list
+  e->hash = 31*e->hash + x->hash;
+
+  // integers added to an empty or packed Q-Expression are stored unboxed
+  if(e->type == LVAL_QEXPR && x->type == LVAL_NUM && (e->as.list.ints || e->as.list.count == 0)) {
+	  free(e->as.list.cell);
+	  e->as.list.cell = NULL;
+	  e->as.list.ints = realloc(e->as.list.ints, sizeof(long) * (e->as.list.count + 1));
+	  e->as.list.ints[e->as.list.count++] = x->as.num;
+	  lval_del(x);
+	  return e;
+  }
+
+  if(e->as.list.ints) { lval_unpack(e); }
   e->as.list.count++;
   e->as.list.cell = realloc(e->as.list.cell, sizeof(lval*) * e->as.list.count);
   e->as.list.cell[e->as.list.count-1] = x;
-  e->hash = hmap_list_h(e->as.list.count, e->as.list.cell);
   return e;
 }
 
-void lval_print_str(lval* v) {
-	char * escaped = (char*)malloc(strlen(v->as.str) + 1);
-	strcpy(escaped, v->as.str);
-	escaped = mpcf_escape(escaped);
+lval** lval_unpack(lval* v) {
+	long* ints = v->as.list.ints;
+	v->as.list.cell = (lval**)malloc(sizeof(lval*) * v->as.list.count);
+	for(int i = 0; i < v->as.list.count; i++) {
+		v->as.list.cell[i] = lval_num(ints[i]);
+	}
+	v->as.list.ints = NULL;
+	free(ints);
+	return v->as.list.cell;
+}
 
-	printf("\"%s\"", escaped);
+lval* lval_pack(lval* v) {
+	if(v->type != LVAL_QEXPR || v->as.list.ints || v->as.list.count == 0) { return v; }
+	for(int i = 0; i < v->as.list.count; i++) {
+		if(v->as.list.cell[i]->type != LVAL_NUM) { return v; }
+	}
 
-	free(escaped);
+	v->as.list.ints = (long*)malloc(sizeof(long) * v->as.list.count);
+	for(int i = 0; i < v->as.list.count; i++) {
+		v->as.list.ints[i] = v->as.list.cell[i]->as.num;
+		lval_del(v->as.list.cell[i]);
+	}
+	free(v->as.list.cell);
+	v->as.list.cell = NULL;
+	return v;
 }
 
-/* Print an "lval" */
-void lval_print(lval* v) {
-  switch (v->type) {
-    case LVAL_NUM: printf("%li", v->as.num); break;
-    case LVAL_STR: lval_print_str(v); break;
-    case LVAL_SYM: printf("%s", v->as.sym); break;
-    case LVAL_FUN: if(v->as.fun.builtin) {
-			printf("<builtin>");
-		} else {
-			printf("(\\");
-			lval_print(v->as.fun.formals);
-			putchar(' ');
-			lval_print(v->as.fun.body);
-			putchar(')');
-		}
-		break;
-    case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
-    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-    case LVAL_ERR: printf("Error: %s", v->as.err); break;
-  }
+lval* lval_nth(lval* v, int i) {
+	return v->as.list.ints ? lval_num(v->as.list.ints[i]) : lval_cp(v->as.list.cell[i]);
 }
 
-void lval_expr_print(lval* v, char open, char close) {
-  putchar(open);
-
-  for(int i = 0; i < v->as.list.count; i++) {
-    lval_print(v->as.list.cell[i]);
-    if(i != (v->as.list.count-1)){
-        putchar(' ');
-    }
-  }
+void lval_list_rehash(lval* v) {
+	if(!v->as.list.ints) {
+		v->hash = hmap_list_h(v->as.list.count, v->as.list.cell);
+		return;
+	}
 
-  putchar(close);
+	// same as hashes of boxed numbers would give
+	int hash = 31;
+	for(int i = 0; i < v->as.list.count; i++) {
+		hash = 31*hash + (int)hmap_int_h(v->as.list.ints[i]);
+	}
+	v->hash = hash;
 }
 
-/* Print an "lval" followed by a newline */
-void lval_println(lval* v) { lval_print(v); putchar('\n'); }
+void lval_fmt_float(double x, char* buf) {
+	// shortest representation which reads back as the same value
+	for(int p = 15; p <= 17; p++) {
+		snprintf(buf, 32, "%.*g", p, x);
+		if(strtod(buf, NULL) == x) { break; }
+	}
+
+	// keep floats distinguishable from integers
+	if(!strpbrk(buf, ".en")) { strcat(buf, ".0"); }
+}
 
 lval* lval_pop(lval* v, int i) {
+    if(v->as.list.ints) {
+        lval* x = lval_num(v->as.list.ints[i]);
+        memmove(&v->as.list.ints[i], &v->as.list.ints[i+1], sizeof(long) * (v->as.list.count - i - 1));
+        v->as.list.count--;
+
+        // empty lists are never packed
+        if(v->as.list.count == 0) {
+            free(v->as.list.ints);
+            v->as.list.ints = NULL;
+        }
+        return x;
+    }
+
     lval* x = v->as.list.cell[i];
 
     // shift memory
-    memmove(&v->as.list.cell[i], &v->as.list.cell[i+1], sizeof(lval*) * (v->as.list.count - 1));
+    memmove(&v->as.list.cell[i], &v->as.list.cell[i+1], sizeof(lval*) * (v->as.list.count - i - 1));
     v->as.list.count--;
     v->as.list.cell = realloc(v->as.list.cell, sizeof(lval*) * v->as.list.count);
 
@@ -200,6 +324,7 @@ lval* lval_take(lval* v, int i) {
 lenv* lenv_new(void) {
 	lenv* e = (lenv*)malloc(sizeof(lenv));
 	e->par = NULL;
+	e->src = NULL;
 	e->map = hmap_new();
 	return e;
 }
@@ -230,6 +355,17 @@ void lenv_print(lenv* e) {
 
 lval* lenv_get(lenv* e, lval* k) {
 	lval* val= hmap_get(e->map, k->hash);
+	if(!val && e->src) {
+		// shared value is only read, the copy is kept for later lookups
+		lval* s = hmap_get(e->src->map, k->hash);
+		if(s && lval_thread_bound(s)) {
+			return lval_err("Symbol '%s' holds a channel or stream, which can't be used by a parallel job.", k->as.sym);
+		}
+		if(s) {
+			val = lval_clone(s);
+			hmap_put(e->map, k->hash, val);
+		}
+	}
 	if(val) {
 		return lval_cp(val);
 	}
@@ -242,7 +378,10 @@ lval* lenv_get(lenv* e, lval* k) {
 }
 
 void lenv_put(lenv* env, lval* key, lval* val) {
+	// redefinition releases the replaced value
+	lval* old = (lval*)hmap_get(env->map, key->hash);
 	hmap_put(env->map, key->hash, lval_cp(val));
+	if(old) { lval_del(old); }
 }
 
 void lenv_def(lenv* e, lval* v, lval* k) {
@@ -250,78 +389,138 @@ void lenv_def(lenv* e, lval* v, lval* k) {
 	lenv_put(e, v, k);
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-	// if builtin, use straight call
-	if(f->as.fun.builtin) { return f->as.fun.builtin(e, a); }
-
-	lval* cf = lval_dcp(f);
-	int given = a->as.list.count;
-	int total = cf->as.fun.formals->as.list.count;
-
-	// there are still arguments to be processed
-	while(a->as.list.count) {
-		// too many args provided
-		if(cf->as.fun.formals->as.list.count == 0) {
-			lval_del(a);
-			return lval_err("Function passed too many arguments. Got %i, expected %i.", given, total);
+/* Releases the [n] arguments of an abandoned call. */
+static void lval_args_del(lval** args, int n) {
+	for(int i = 0; i < n; i++) {
+		lval_del(args[i]);
+	}
+}
+
+lval* lval_apply(lenv* e, lval* f, lval** args, int n) {
+	// builtins still take their arguments as a list
+	if(f->as.fun->builtin) {
+		lval* a = lval_sexpr();
+		if(f->as.fun->special) { lval_add(a, lval_cp(f)); }
+		for(int i = 0; i < n; i++) {
+			lval_add(a, args[i]);
 		}
+		if(!f->as.fun->special) { return f->as.fun->builtin(e, a); }
 
-		lval* sym = lval_pop(cf->as.fun.formals, 0);
+		// special form applied as a value gets a form of values, which evaluate to themselves
+		lval* r = f->as.fun->builtin(e, a);
+		lval_del(a);
+		return r;
+	}
 
-		// special case - use '&' to deal with variable length arguments
-		if(strcmp(sym->as.sym, "&") == 0) {
-			// & should always be followed by exactly one another symbol
-			if(cf->as.fun.formals->as.list.count != 1) {
-				lval_del(a);
-				return lval_err("Function format invalid. Symbol '&' not followed by single symbol");
-			}
+	// memoized lambdas answer repeated arguments from their cache
+	if(f->as.fun->memo) { return lmemo_call(e, f, args, n); }
+	return lval_apply_lambda(e, f, args, n);
+}
 
-			// bind next formal to remaining arguments
-			lval* nsym = lval_pop(cf->as.fun.formals, 0);
-			lenv_put(cf->as.fun.env, nsym, builtin_list(e, a));
-			lval_del(sym);
-			lval_del(nsym);
-			break;
-		}
+lval* lval_apply_lambda(lenv* e, lval* f, lval** args, int n) {
+	// optimized body is run only as long as names it was optimized for weren't rebound
+	lval* body = f->as.fun->body;
+	if(f->as.fun->assumed && !lval_assumptions_hold(e, f)) { body = f->as.fun->source; }
 
-		lval* val = lval_pop(a, 0);
+	// hot lambdas run as native code whenever their arguments allow it
+	lval* r = body == f->as.fun->body ? ljit_call(e, f, args, n) : NULL;
+	if(r) {
+		lval_args_del(args, n);
+		return r;
+	}
 
-		lenv_put(cf->as.fun.env, sym, val);
+	int total = f->as.fun->arity;
 
-		lval_del(sym);
-		lval_del(val);
+	// too many args provided
+	if(n > total && !f->as.fun->variadic) {
+		lval_args_del(args, n);
+		return lval_err("Function passed too many arguments. Got %i, expected %i.", n, total);
 	}
-	lval_del(a);
 
-	// if & remains in formal list it should be bound to empty list
-	if(cf->as.fun.formals->as.list.count > 0 && strcmp(cf->as.fun.formals->as.list.cell[0]->as.sym, "&") == 0) {
-		if(cf->as.fun.formals->as.list.count != 2) {
-			return lval_err("Function format invalid. Symbol '&' not followed by a single symbol.");
+	// not all formals were given - return partially evaluated lambda function
+	if(n < total) {
+		lval* cf = lval_dcp(f);
+		if(cf->as.fun->memo) {
+			lmemo_del(cf->as.fun->memo);
+			cf->as.fun->memo = NULL;
 		}
+		lval* formals = cf->as.fun->formals;
+		for(int i = 0; i < n; i++) {
+			lenv_put(cf->as.fun->env, LVAL_CELLS(formals)[0], args[i]);
+			lval_del(lval_pop(formals, 0));
+		}
+		cf->as.fun->arity -= n;
+		lval_args_del(args, n);
+		return cf;
+	}
 
-		lval_del(lval_pop(cf->as.fun.formals, 0)); 		// forget '&' symbol
-		lval* sym = lval_pop(cf->as.fun.formals, 0);
-		lval* val = lval_qexpr();
+	// full application binds into a fresh frame and leaves the lambda itself untouched
+	lenv* env = lenv_copy(f->as.fun->env);
+	lval** formals = LVAL_CELLS(f->as.fun->formals);
+	for(int i = 0; i < total; i++) {
+		lenv_put(env, formals[i], args[i]);
+	}
+	lval_args_del(args, total);
 
-		lenv_put(cf->as.fun.env, sym, val);
-		lval_del(sym);
-		lval_del(val);
+	// special case - '&' binds its symbol to the list of remaining arguments
+	if(f->as.fun->variadic) {
+		lval* rest = lval_qexpr();
+		for(int i = total; i < n; i++) {
+			lval_add(rest, args[i]);
+		}
+		lenv_put(env, formals[total + 1], rest);
+		lval_del(rest);
 	}
 
-	// check if all formals from lambda has been evaluated
-	if(cf->as.fun.formals->as.list.count == 0) {
-		// execute lambda function and return result
-		cf->as.fun.env->par = e;
-		return builtin_eval(cf->as.fun.env, lval_add(lval_sexpr(), cf->as.fun.body));
-	} else {
-		// return partially evaluated lambda function
-		return cf;
+	// execute lambda function and return result
+	env->par = e;
+	r = lval_eval_cells(env, body);
+	lenv_del(env);
+	return r;
+}
+
+lval* lval_call(lenv* e, lval* f, lval* a) {
+	// loops driven from C, such as over streams, stop here once the heap ran out
+	lval* oom = heap_oom(HEAP);
+	if(oom) {
+		lval_del(a);
+		return oom;
 	}
+
+	// if builtin, use straight call
+	if(f->as.fun->builtin && !f->as.fun->special) { return f->as.fun->builtin(e, a); }
+
+	int n = a->as.list.count;
+	lval* frame[LVAL_FRAME];
+	lval** args = n <= LVAL_FRAME ? frame : (lval**)malloc(sizeof(lval*) * n);
+	for(int i = 0; i < n; i++) {
+		args[i] = lval_cp(LVAL_CELLS(a)[i]);
+	}
+	lval_del(a);
+
+	lval* r = lval_apply(e, f, args, n);
+	if(args != frame) { free(args); }
+	return r;
 }
 
 lval* lval_join(lval* x, lval* y){
-	while(y->as.list.count) {
-		x = lval_add(x, lval_pop(y, 0));
+	x = lval_own(x);
+
+	// packed lists are joined with a single copy
+	if(x->type == LVAL_QEXPR && y->as.list.ints && (x->as.list.ints || x->as.list.count == 0)) {
+		int n = x->as.list.count + y->as.list.count;
+		free(x->as.list.cell);
+		x->as.list.cell = NULL;
+		x->as.list.ints = (long*)realloc(x->as.list.ints, sizeof(long) * n);
+		memcpy(x->as.list.ints + x->as.list.count, y->as.list.ints, sizeof(long) * y->as.list.count);
+		x->as.list.count = n;
+		lval_list_rehash(x);
+		lval_del(y);
+		return x;
+	}
+
+	for(int i = 0; i < y->as.list.count; i++) {
+		x = lval_add(x, lval_nth(y, i));
 	}
 
 	lval_del(y);
@@ -334,18 +533,39 @@ int lval_eq(lval* x, lval* y) {
 
 	switch(x->type) {
 		case LVAL_NUM: return (x->as.num == y->as.num);
-		case LVAL_STR: return (strcmp(x->as.str, y->as.str) == 0);
+		case LVAL_FLOAT: return (x->as.flt == y->as.flt);
+		case LVAL_BIGNUM: return lbig_cmp(x->as.big, y->as.big) == 0;
+		case LVAL_STR: return lstr_eq(x->as.str, y->as.str);
 		case LVAL_SYM: return (strcmp(x->as.sym, y->as.sym) == 0);
 		case LVAL_ERR: return (strcmp(x->as.err, y->as.err) == 0);
+		case LVAL_CHAN: return (x->as.chan == y->as.chan);
+		case LVAL_STREAM: return (x->as.stream == y->as.stream);
+		case LVAL_MAP: return lmap_eq(x->as.map, y->as.map);
+		case LVAL_I64VEC:
+		case LVAL_F64VEC: return lvec_eq(x->as.vec, y->as.vec, x->type);
 		case LVAL_FUN:
-			if(x->as.fun.builtin) {
-				return (x->as.fun.builtin == y->as.fun.builtin);
+			if(x->as.fun->builtin) {
+				return (x->as.fun->builtin == y->as.fun->builtin);
 			} else {
-				return lval_eq(x->as.fun.formals, y->as.fun.formals) && lval_eq(x->as.fun.body, y->as.fun.body);
+				return lval_eq(x->as.fun->formals, y->as.fun->formals) && lval_eq(LFUN_SOURCE(x->as.fun), LFUN_SOURCE(y->as.fun));
 			}
 		case LVAL_SEXPR:
 		case LVAL_QEXPR:
 			if(x->as.list.count != y->as.list.count) { return 0; }
+			if(x->as.list.ints && y->as.list.ints) {
+				return memcmp(x->as.list.ints, y->as.list.ints, sizeof(long) * x->as.list.count) == 0;
+			}
+
+			// packed list is compared against cells without boxing it
+			if(y->as.list.ints) { lval* t = x; x = y; y = t; }
+			if(x->as.list.ints) {
+				for(int i = 0; i < x->as.list.count; i++) {
+					lval* c = y->as.list.cell[i];
+					if(c->type != LVAL_NUM || c->as.num != x->as.list.ints[i]) { return 0; }
+				}
+				return 1;
+			}
+
 			for(int i = 0; i < x->as.list.count; i++) {
 				if(!lval_eq(x->as.list.cell[i], y->as.list.cell[i])) { return 0; }
 			}
@@ -356,39 +576,103 @@ int lval_eq(lval* x, lval* y) {
 	return 0;
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-    for(int i = 0; i < v->as.list.count; i++) {
-    	lval* evaluable = v->as.list.cell[i];
-    	evaluable = lval_eval(e, evaluable);
-    	v->as.list.cell[i] = evaluable;
-    }
-    for(int i = 0; i < v->as.list.count; i++) {
-    	lval* o = v->as.list.cell[i];
-    	if(o->type == LVAL_ERR) {
-    		return lval_take(v, i);
-    	}
-    }
+/* Call made of cells of [v] from [from] on, as macros and special forms get it. */
+static lval* lval_subform(lval* v, int from) {
+	if(from == 0) { return lval_cp(v); }
+
+	lval* x = lval_sexpr();
+	for(int i = from; i < v->as.list.count; i++) {
+		lval_add(x, lval_nth(v, i));
+	}
+	return x;
+}
 
-    // empty expression
-    if (v->as.list.count == 0) { return v; }
+/* Evaluates cells of [v] from [from] on into the argument frame [args] and calls the first one. */
+static lval* lval_eval_frame(lenv* e, lval* v, int from, lval** args, int n) {
+	lval** cells = LVAL_CELLS(v) + from;
+	args[0] = lval_eval(e, lval_cp(cells[0]));
+	lval* h = args[0];
+
+	// macro calls get their arguments unevaluated, then the expansion is evaluated instead
+	if(n > 1 && cells[0]->type == LVAL_SYM && h->type == LVAL_FUN && h->as.fun->macro) {
+		lval* x = lval_expand(e, h, lval_subform(v, from));
+		lval_del(h);
+		return lval_eval(e, x);
+	}
 
-    // single expression
-    if (v->as.list.count == 1) { return lval_take(v, 0); }
+	// special forms evaluate only the arguments they need
+	if(n > 1 && h->type == LVAL_FUN && h->as.fun->builtin && h->as.fun->special) {
+		lval* x = lval_subform(v, from);
+		lval* r = h->as.fun->builtin(e, x);
+		lval_del(x);
+		lval_del(h);
+		return r;
+	}
 
-    // ensure first elem is function
-    lval* s = lval_pop(v, 0);
-    if (s->type != LVAL_FUN) {
-        lval* err = lval_err("S-Expression starts with incorrect type! Got %s, expected %s",
-        		ltype_name(s->type), ltype_name(LVAL_FUN));
-        lval_del(s);
-        lval_del(v);
+	for(int i = 1; i < n; i++) {
+		args[i] = lval_eval(e, lval_cp(cells[i]));
+	}
+	for(int i = 0; i < n; i++) {
+		if(args[i]->type == LVAL_ERR) {
+			lval* err = args[i];
+			args[i] = args[n - 1];
+			lval_args_del(args, n - 1);
+			return err;
+		}
+	}
 
-        return err;
-    }
+	// single expression
+	if(n == 1) { return args[0]; }
+
+	// ensure first elem is function
+	if(h->type != LVAL_FUN) {
+		lval* err = lval_err("S-Expression starts with incorrect type! Got %s, expected %s",
+				ltype_name(h->type), ltype_name(LVAL_FUN));
+		lval_args_del(args, n);
+		return err;
+	}
+
+	lval* r = lval_apply(e, h, args + 1, n - 1);
+	lval_del(h);
+	return r;
+}
+
+lval* lval_eval_range(lenv* e, lval* v, int from) {
+	// heap ran past its limit, nothing more is evaluated until the error unwinds
+	lval* oom = heap_oom(HEAP);
+	if(oom) { return oom; }
+
+	int n = v->as.list.count - from;
+
+	// empty expression
+	if(n <= 0) { return lval_sexpr(); }
+
+	lval* frame[LVAL_FRAME];
+	lval** args = n <= LVAL_FRAME ? frame : (lval**)malloc(sizeof(lval*) * n);
+	lval* r = lval_eval_frame(e, v, from, args, n);
+	if(args != frame) { free(args); }
+	return r;
+}
+
+lval* lval_eval_cells(lenv* e, lval* v) {
+	return lval_eval_range(e, v, 0);
+}
+
+/* Evaluates branch [b] of a special form. Q-Expressions, literal or computed by the branch, are code run the way 'eval' runs it, anything else is an expression. */
+lval* lval_eval_branch(lenv* e, lval* b) {
+	if(b->type == LVAL_QEXPR) { return lval_eval_cells(e, b); }
 
-    lval* res = lval_call(e, s, v);
-    lval_del(s);
-    return res;
+	lval* x = lval_eval(e, lval_cp(b));
+	if(x->type != LVAL_QEXPR) { return x; }
+	lval* r = lval_eval_cells(e, x);
+	lval_del(x);
+	return r;
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+	lval* r = lval_eval_cells(e, v);
+	lval_del(v);
+	return r;
 }
 
 lval* lval_eval(lenv* e, lval *v){
@@ -402,10 +686,10 @@ lval* lval_eval(lenv* e, lval *v){
     return v;
 }
 
-unsigned int hmap_list_h(int n, lval* l) {
+unsigned int hmap_list_h(int n, lval** l) {
 	int hash = 31;
 	for (int i = 0; i < n; i++) {
-		hash = 31*hash + l[i].hash;
+		hash = 31*hash + l[i]->hash;
 	}
 	return hash;
 }
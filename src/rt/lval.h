@@ -2,6 +2,11 @@
 #define LVAL_H
 
 #include "hmap.h"
+#include "bignum.h"
+#include "rope.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define LASSERT(args, cond, fmt, ...) 				\
 	if(!(cond)) { 									\
@@ -15,6 +20,12 @@
 		"Function '%s' passed incorrect type for argument %i. Got %s, expected %s.",	\
 		func, index, ltype_name(args->as.list.cell[index]->type), ltype_name(expect))
 
+#define LASSERT_NUMERIC(func, args, index)												\
+	LASSERT(args, (args->as.list.cell[index]->type == LVAL_NUM || args->as.list.cell[index]->type == LVAL_FLOAT \
+		|| args->as.list.cell[index]->type == LVAL_BIGNUM), 							\
+		"Function '%s' passed incorrect type for argument %i. Got %s, expected %s.",	\
+		func, index, ltype_name(args->as.list.cell[index]->type), ltype_name(LVAL_NUM))
+
 #define LASSERT_NUM(func, args, num)													\
 	LASSERT(args, (args->as.list.count == num),											\
 		"Function '%s' passed incorrect number of arguments. Got %i, expected %i.",		\
@@ -30,11 +41,24 @@ struct lval;
 struct lenv;
 struct lfun;
 struct llist;
+struct lchan;
+struct lmap;
+struct lstream;
+struct lvec;
+struct ljit;
+struct lmemo;
 typedef struct mem_heap mem_heap;
 typedef struct lval lval;
 typedef struct lenv lenv;
 typedef struct lfun lfun;
 typedef struct llist llist;
+typedef struct lchan lchan;
+typedef struct lmap lmap;
+typedef struct lstream lstream;
+typedef struct lvec lvec;
+typedef struct ljit ljit;
+typedef struct lmemo lmemo;
+typedef struct lbuf lbuf;
 
 typedef lval* (*lbuiltin)(lenv*, lval*);
 
@@ -54,25 +78,44 @@ enum {
 	LVAL_ERR,
 	LVAL_SYM,
 	LVAL_QEXPR,
-	LVAL_SEXPR 
+	LVAL_SEXPR,
+	LVAL_CHAN,
+	LVAL_FLOAT,
+	LVAL_BIGNUM,
+	LVAL_MAP,
+	LVAL_STREAM,
+	LVAL_I64VEC,
+	LVAL_F64VEC
 };
 
 #define HEAP_INIT_SIZE 		1000
 #define HEAP_GROWTH_RATE 	2
-#define HEAP_MAX_SIZE		100000
+#define HEAP_MAX_SIZE		100000	/* default limit of values on a heap, see heap_set_default_max */
+#define HEAP_RESERVE		1024	/* values allowed past the limit once it's hit, until the error is raised */
 
-enum {
-	HEAP_MEM_OUT = -1
-};
+/* Arguments of a call that fit into its C stack frame, longer calls take them from malloc. */
+#define LVAL_FRAME			8
+
+/* block of cells allocated at once */
+typedef struct {
+	lval* 	cells;
+	long 	count;
+} mem_slab;
 
 /* managed memory heap */
 struct mem_heap {
-	int		size;
-	lval* 	head;
-	lval* 	next_free_val;
+	long		size;
+	long 		max;		/* limit of [size], 0 for none */
+	int 		oom;		/* 1 once [size] went past [max], until the error is raised */
+	lval* 		free;		/* free cells, linked through [as.next] */
+	mem_slab* 	slabs;
+	int 		nslabs;
+	int 		compacted;	/* [nslabs] right after the last compaction */
+	lmemo* 		memos;		/* result caches of the heap, emptied when it runs out */
 };
 
-extern mem_heap* HEAP;
+/* Heap used by the current thread for all lvalue allocations. */
+extern __thread mem_heap* HEAP;
 
 /* lambda function struct */
 struct lfun {
@@ -80,48 +123,115 @@ struct lfun {
 	lenv* 		env;
 	lval* 		formals;
 	lval* 		body;
+	lval* 		source;		/* body as written, run instead of [body] when [assumed] doesn't hold; NULL if not optimized */
+	lval* 		assumed;	/* symbols and values [body] was optimized for, in pairs */
+	int 		arity;		/* number of formals before '&' */
+	int 		variadic;	/* 1 if formals end with '& rest' */
+	int 		macro;		/* 1 if called with unevaluated arguments, returning code to evaluate instead */
+	int 		special;	/* 1 if builtin is a special form, borrowing the whole unevaluated call */
+	int 		calls;		/* calls counted until the body gets compiled */
+	ljit* 		jit;		/* native code of the body, see jit.c */
+	lmemo* 		memo;		/* cache of results by arguments, NULL unless memoized */
 };
 
+/* Body of lambda [f] as written, which is what gets printed and compared. */
+#define LFUN_SOURCE(f) ((f)->source ? (f)->source : (f)->body)
+
+/* Lists hold boxed cells, except Q-Expressions made only of integers, which keep them packed in [ints] until anything else is added. */
 struct llist {
 	int 	count;
 	lval** 	cell;
+	long* 	ints;	/* packed elements, NULL for lists of cells */
 };
 
+/* Cells of list [v]. Packed lists are boxed into cells for good on first access, so code aware of packing should prefer lval_nth. */
+#define LVAL_CELLS(v) ((v)->as.list.ints ? lval_unpack(v) : (v)->as.list.cell)
+
+/* Values are kept small, a number takes the same cell as a list: anything bigger than a list header lives out of line. */
 struct lval {
-  int type;
+  unsigned char type;
   int hash;
   int ref_count;
-  lval* next;
 
   union {
+	  lval* next;		/* link in the free list of the heap while the cell is free */
 	  char* err;
 	  char* sym;
-	  char* str;
+	  lstr* str;
 	  long 	num;
-	  lfun 	fun;
+	  double flt;
+	  lbig* big;
+	  lfun* fun;
 	  llist list;
+	  lchan* chan;
+	  lmap* map;
+	  lstream* stream;
+	  lvec* vec;
   } as;
 };
 
+/* Pull based stream of values, consumed as it's read. [next] returns the next value, an error, or NULL once the stream is exhausted. */
+struct lstream {
+	int 	ref_count;
+	lval* 	(*next)(lenv* e, lstream* s);
+	void 	(*release)(lstream* s);	/* releases [state] */
+	void* 	state;
+};
+
+/* Growable character buffer output is rendered into. */
+struct lbuf {
+	char* 	data;
+	int 	len;
+	int 	cap;
+	int 	out;	/* 1 if contents are passed on to standard output once the buffer grows large */
+};
+
 struct lenv {
   lenv* par;
   hmap* map;
+  lenv* src;	/* environment of another heap, read only, whose values are cloned here on first lookup */
 };
 
 char * ltype_name(int t);
 
 lval* lval_num(long x);
+lval* lval_float(double x);
+lval* lval_bignum(lbig* b);
 lval* lval_str(char* s);
+lval* lval_lstr(lstr* s);
 lval* lval_fun(lbuiltin func);
 lval* lval_lambda(lval* formals, lval* body);
+
+/* Function data of a new Function lvalue, zeroed. */
+lfun* lfun_new(void);
 lval* lval_err(char* fmt, ...);
 lval* lval_sym(char* s);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
+lval* lval_chan(lchan* c);
+lval* lval_map(lmap* m);
+lval* lval_stream(lstream* s);
+lval* lval_vec(int type, lvec* v);
 
 /* Creates a new managed heap. */
 mem_heap* heap_new(void);
 
+/* Limit of values on heaps created from now on, 0 for none. Defaults to QSP_MAX_HEAP if set, HEAP_MAX_SIZE otherwise. */
+void heap_set_default_max(long cells);
+long heap_default_max(void);
+
+/* Error raised by the next evaluation step once [heap] ran out of memory, or NULL. */
+lval* heap_oom(mem_heap* heap);
+
+/* Moves values of [heap] into a fresh slab, elements of each list next to each other, and frees the slabs left empty.
+ * Values referenced from anywhere but lists, lambdas and environments stay in place. Only safe when no C code holds
+ * a value without counting the reference, between top level forms of [root], see qsp.c. */
+void heap_compact(mem_heap* heap, lenv* root);
+
+/* Compaction is off unless enabled or QSP_COMPACT is set. */
+void heap_compact_enable(int on);
+int heap_compact_on(void);
+
 /* Prints current heap content. */
 void heap_print(mem_heap* heap);
 
@@ -131,20 +241,77 @@ void heap_del(mem_heap* heap);
 /* Allocates a new lvalue from managed heap of undefined type */
 lval* lval_new(void);
 
+/* Recomputes hash of a number or float changed in place. */
+void lval_num_rehash(lval* v);
+
+/* Returns value of a number or float as double. */
+double lval_to_double(lval* v);
+
+/* Formats float in its shortest form which reads back as the same value. [buf] must hold at least 32 characters. */
+void lval_fmt_float(double x, char* buf);
+
+/* Parses a number literal, returning an error if [s] isn't one. */
+lval* lval_read_num_str(const char* s);
+
+/* Wraps integer [b] as a Number, demoting it to a machine word when it fits. Takes ownership of [b]. */
+lval* lval_integer(lbig* b);
+
+/* Returns new big integer holding value of integer lvalue [v]. */
+lbig* lval_to_big(lval* v);
+
 /* Adds a [x] to list [sexpr] */
 lval* lval_add(lval* sexpr, lval* x);
 
+/* Boxes elements of packed list [v] into cells. Returns the cells. */
+lval** lval_unpack(lval* v);
+
+/* Packs list [v] if it's a Q-Expression made only of integers. */
+lval* lval_pack(lval* v);
+
+/* Returns new reference to element [i] of list [v], boxing just that one if the list is packed. */
+lval* lval_nth(lval* v, int i);
+
+/* Recomputes hash of a list changed in place. */
+void lval_list_rehash(lval* v);
+
 /* Creates a shallow copy of lvalue. */
 lval* lval_cp(lval* c);
 
+/* Returns lvalue safe to be mutated in place. Shared values are replaced by a shallow copy, releasing one reference of the original. */
+lval* lval_own(lval* v);
+
 /* Creates a deep copy of lvalue. Unlike lval_cp this one allocates a completely new lvalue and copies all of it's inner states. */
 lval* lval_dcp(lval* c);
 
+/* Creates a deep copy of lvalue without modifying it in any way. Safe to use to move values between heaps owned by different threads, as long as [v] isn't bound to its thread. */
+lval* lval_clone(lval* v);
+
+/* Checks if [v] holds a channel or stream anywhere inside. Those are shared rather than copied, so they can't move to another thread. */
+int lval_thread_bound(lval* v);
+
 /* Deletes a lvalue. This functions frees a lvalue back to heap only if reference counter hits zero. */
 void lval_del(lval* v);
+
+/* Frees inner state of lvalue and returns it back to managed heap regardless of its reference counter. */
+void lval_delp(lval* v);
+
+lval* lval_pop(lval* v, int i);
+lval* lval_take(lval* v, int i);
+lval* lval_join(lval* x, lval* y);
+int lval_eq(lval* x, lval* y);
 lval* lval_call(lenv* e, lval* f, lval* a);
 
-void lval_expr_print(lval* v, char open, char close);
+/* Calls [f] with the [n] arguments in [args], taking their references over. Only builtins and '&' get a heap list. */
+lval* lval_apply(lenv* e, lval* f, lval** args, int n);
+
+/* Same as lval_apply for lambda [f], bypassing its result cache. */
+lval* lval_apply_lambda(lenv* e, lval* f, lval** args, int n);
+
+/* Renders [v] into buffer [b] in the same form it's read from. */
+void lval_render(lbuf* b, lval* v);
+void lval_expr_render(lbuf* b, lval* v, char open, char close);
+
+/* Writes [v] to standard output, through the output buffer. */
 void lval_print(lval* v);
 void lval_println(lval* v);
 void lenv_print(lenv* e);
@@ -152,14 +319,243 @@ void lenv_print(lenv* e);
 lval* lval_eval(lenv* env, lval* v);
 lval* lval_eval_sexpr(lenv* env, lval* v);
 
+/* Evaluates S-Expression or lambda body [v] without changing it. Arguments live in a frame on the C stack. */
+lval* lval_eval_cells(lenv* env, lval* v);
+
+/* Same as lval_eval_cells for cells of [v] from [from] on, such as code of a clause following its condition. */
+lval* lval_eval_range(lenv* env, lval* v, int from);
+lval* lval_eval_branch(lenv* env, lval* b);
+
 lenv* lenv_new(void);
+lenv* lenv_copy(lenv* e);
+lenv* lenv_clone(lenv* e);
 void lenv_del(lenv* e);
 lval* lenv_get(lenv* e, lval* k);
 void lenv_put(lenv* e, lval* v, lval* k);
 void lenv_def(lenv* e, lval* v, lval* k);
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
+void lenv_add_special(lenv* e, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* e);
 
-unsigned int hmap_list_h(int n, lval* s);
+lval* builtin_list(lenv* e, lval* a);
+lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_if(lenv* e, lval* a);
+lval* builtin_when(lenv* e, lval* a);
+lval* builtin_lambda(lenv* e, lval* a);
+lval* builtin_case(lenv* e, lval* a);
+lval* builtin_select(lenv* e, lval* a);
+lval* builtin_cond(lenv* e, lval* a);
+lval* builtin_add(lenv* e, lval* a);
+lval* builtin_sub(lenv* e, lval* a);
+lval* builtin_mul(lenv* e, lval* a);
+lval* builtin_div(lenv* e, lval* a);
+lval* builtin_eq(lenv* e, lval* a);
+lval* builtin_ne(lenv* e, lval* a);
+lval* builtin_gt(lenv* e, lval* a);
+lval* builtin_ge(lenv* e, lval* a);
+lval* builtin_lt(lenv* e, lval* a);
+lval* builtin_le(lenv* e, lval* a);
+lval* builtin_and(lenv* e, lval* a);
+lval* builtin_or(lenv* e, lval* a);
+lval* builtin_neq(lenv* e, lval* a);
+lval* builtin_to_float(lenv* e, lval* a);
+lval* builtin_to_int(lenv* e, lval* a);
+lval* builtin_pmap(lenv* e, lval* a);
+lval* builtin_preduce(lenv* e, lval* a);
+
+lval* builtin_str_concat(lenv* e, lval* a);
+lval* builtin_str_len(lenv* e, lval* a);
+lval* builtin_str_sub(lenv* e, lval* a);
+lval* builtin_str_find(lenv* e, lval* a);
+lval* builtin_str_split(lenv* e, lval* a);
+lval* builtin_str_replace(lenv* e, lval* a);
+lval* builtin_str_join(lenv* e, lval* a);
+lval* builtin_str_to_num(lenv* e, lval* a);
+lval* builtin_num_to_str(lenv* e, lval* a);
+
+lval* builtin_mmap_file(lenv* e, lval* a);
+lval* builtin_lines(lenv* e, lval* a);
+lval* builtin_fold_lines(lenv* e, lval* a);
+lval* builtin_next(lenv* e, lval* a);
+lval* builtin_range(lenv* e, lval* a);
+lval* builtin_iterate(lenv* e, lval* a);
+lval* builtin_lazy_map(lenv* e, lval* a);
+lval* builtin_lazy_filter(lenv* e, lval* a);
+lval* builtin_lazy_take(lenv* e, lval* a);
+lval* builtin_collect(lenv* e, lval* a);
+lval* builtin_fold_stream(lenv* e, lval* a);
+
+lval* builtin_i64vec(lenv* e, lval* a);
+lval* builtin_f64vec(lenv* e, lval* a);
+lval* builtin_vec_list(lenv* e, lval* a);
+lval* builtin_vsum(lenv* e, lval* a);
+lval* builtin_vdot(lenv* e, lval* a);
+lval* builtin_vmin(lenv* e, lval* a);
+lval* builtin_vmax(lenv* e, lval* a);
+lval* builtin_vadd(lenv* e, lval* a);
+lval* builtin_vmul(lenv* e, lval* a);
+
+lval* builtin_memo(lenv* e, lval* a);
+lval* builtin_memo_stats(lenv* e, lval* a);
+
+lval* builtin_hash_map(lenv* e, lval* a);
+lval* builtin_assoc(lenv* e, lval* a);
+lval* builtin_dissoc(lenv* e, lval* a);
+lval* builtin_get(lenv* e, lval* a);
+lval* builtin_keys(lenv* e, lval* a);
+lval* builtin_vals(lenv* e, lval* a);
+lval* builtin_merge(lenv* e, lval* a);
+
+lval* builtin_defmacro(lenv* e, lval* a);
+lval* builtin_sexpr(lenv* e, lval* a);
+
+lval* builtin_spawn(lenv* e, lval* a);
+lval* builtin_yield(lenv* e, lval* a);
+lval* builtin_chan(lenv* e, lval* a);
+lval* builtin_send(lenv* e, lval* a);
+lval* builtin_recv(lenv* e, lval* a);
+
+/* Shares channel, increasing its reference counter. */
+lchan* lchan_cp(lchan* c);
+
+/* Releases channel together with buffered values once it's no longer referenced. */
+void lchan_del(lchan* c);
+
+lstream* lstream_new(lval* (*next)(lenv*, lstream*), void (*release)(lstream*), void* state);
+lstream* lstream_cp(lstream* s);
+void lstream_del(lstream* s);
+
+/* Returns new reference to a stream reading sequence [v] - either a stream or a Q-Expression. */
+lstream* lval_to_stream(lval* v);
+
+/* Calls [f] with the accumulated value and each value of [s] in turn, starting with [init]. Consumes [init]. */
+lval* lstream_fold(lenv* e, lstream* s, lval* f, lval* init);
+
+lvec* lvec_cp(lvec* v);
+void lvec_del(lvec* v);
+
+/* Creates a copy of vector with its own reference counter, for another thread. */
+lvec* lvec_clone(lvec* v);
+
+int lvec_count(lvec* v);
+int lvec_eq(lvec* x, lvec* y, int type);
+void lvec_render(lbuf* b, lval* v);
+
+/* Arithmetic [op] over arguments [a] of which some are vectors, applied elementwise with numbers broadcast. */
+lval* lvec_op(lenv* e, lval* a, char* op);
+
+lval* builtin_op(lenv* e, lval* a, char* op);
+
+/* State shared by native frames of one run. Native code sets [failed] when the interpreter has to take over. */
+typedef struct {
+	long depth;
+	long failed;
+} ljit_ctx;
+
+/* Native code of a lambda, taking its integer arguments. */
+typedef long (*ljit_code)(long* args, ljit_ctx* ctx);
+
+/* Global name native code relies on. */
+typedef struct {
+	const char* 	name;
+	lbuiltin 		builtin;	/* builtin expected under [name], NULL for a lambda */
+	unsigned int 	hash;		/* lval_hash of the lambda compiled */
+} ljit_sym;
+
+/* Native code compiled ahead of time for global lambda [name], see qspc. */
+typedef struct {
+	const char* 	name;
+	ljit_code 		code;
+	const ljit_sym* syms;		/* names looked up by the code, [name] included */
+	int 			nsyms;
+} ljit_native;
+
+/* Runs lambda [f] on the [n] arguments in [args] as native code once it's hot. Returns NULL when the interpreter has to do it, [args] are never taken. */
+lval* ljit_call(lenv* e, lval* f, lval** args, int n);
+void ljit_del(ljit* j);
+
+/* Attaches [n] to its lambda once all names it relies on are defined as expected. Returns 1 if attached. */
+int ljit_install(lenv* e, const ljit_native* n);
+
+/* Turns compilation of hot lambdas on or off, overriding QSP_NO_JIT. */
+void ljit_enable(int on);
+
+/* Shares map, increasing its reference counter. */
+lmap* lmap_cp(lmap* m);
+
+/* Releases map together with its entries once it's no longer referenced. */
+void lmap_del(lmap* m);
+
+/* Creates a copy of map with all entries cloned by lval_clone. */
+lmap* lmap_clone(lmap* m);
+
+/* Checks if [pred] holds for any key or value of [m]. */
+int lmap_any(lmap* m, int (*pred)(lval*));
+
+lmap* lmap_new(void);
+
+/* Returns map with [k] bound to [v], leaving [m] unchanged. Borrows all arguments. */
+lmap* lmap_assoc(lmap* m, lval* k, lval* v);
+
+/* Returns value bound to [k] without taking a reference to it, or NULL. */
+lval* lmap_get(lmap* m, lval* k);
+
+int lmap_eq(lmap* a, lmap* b);
+int lmap_count(lmap* m);
+void lmap_render(lbuf* b, lmap* m);
+
+/* Structural hash of [v], equal for values equal by lval_eq. */
+unsigned int lval_hash(lval* v);
+
+lmemo* lmemo_new(int bound);
+lmemo* lmemo_cp(lmemo* m);
+void lmemo_del(lmemo* m);
+
+/* Empties all result caches on [heap]. */
+void lmemo_clear_heap(mem_heap* heap);
+
+/* Calls memoized lambda [f], answering arguments seen before from its cache. Takes [args] over. */
+lval* lmemo_call(lenv* e, lval* f, lval** args, int n);
+
+/* Expands [form], a call of macro [m], into code replacing it. Consumes [form]. */
+lval* lval_expand(lenv* e, lval* m, lval* form);
+
+void lbuf_put(lbuf* b, const char* s, int len);
+void lbuf_puts(lbuf* b, const char* s);
+void lbuf_putc(lbuf* b, char c);
+void lbuf_put_long(lbuf* b, long x);
+
+/* Returns emptied output buffer of the calling thread, to render into and pass to lout_commit. */
+lbuf* lout_buf(void);
+
+/* Appends contents of [b] to standard output buffer and empties [b]. */
+void lout_commit(lbuf* b);
+
+/* Appends [len] bytes of [s] to standard output buffer, shared by all threads. */
+void lout_write(const char* s, int len);
+
+/* Writes out everything buffered for standard output. Done automatically at exit. */
+void lout_flush(void);
+
+/* Runs spawned green threads until none of them is runnable. Called by the main green thread between top level forms. */
+void green_run(void);
+
+/* Number of green threads spawned and not finished yet. */
+int green_alive(void);
+
+/* Checks if builtin function has no side effects and can be evaluated ahead of time. */
+int lbuiltin_pure(lbuiltin f);
+
+/* Optimizes lambda [body] at definition time: folds constant expressions over pure builtins and reduces 'if' with constant conditions.
+ * Sets [assumed] to the symbols and values the result relies on, in pairs, or NULL if it relies on none. */
+lval* lval_optimize(lenv* e, lval* formals, lval* body, lval** assumed);
+
+/* Keeps body [source] as written along with lambda [f] optimized under [assumed], see lval_optimize. Returns [f]. */
+lval* lval_lambda_assume(lval* f, lval* source, lval* assumed);
+
+/* Checks if symbols the body of lambda [f] was optimized for still resolve to the same values in [e]. */
+int lval_assumptions_hold(lenv* e, lval* f);
+
+unsigned int hmap_list_h(int n, lval** s);
 
 #endif
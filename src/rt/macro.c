@@ -0,0 +1,159 @@
+#include "lval.h"
+
+/*
+ * Macros are lambdas called with their arguments unevaluated, returning code
+ * which replaces the call. Calls found in a lambda body are expanded once,
+ * when the lambda is defined, so the expansion is cached in its code; calls
+ * evaluated directly, like top level forms, are expanded as they run.
+ *
+ * Expansions are made hygienic by renaming formals of lambdas introduced by
+ * the macro itself, so they can't capture symbols of code passed in by the
+ * caller. Code coming from arguments is recognized by identity, since macros
+ * build expansions by sharing argument values rather than copying them.
+ */
+
+/* Counter making renamed symbols unique, shared by all threads. */
+static int GENSYM = 0;
+
+/* Checks if [v] is one of the values making up macro arguments [args]. */
+int lval_within(lval* v, lval* args) {
+	if(v == args) { return 1; }
+	if(args->type != LVAL_SEXPR && args->type != LVAL_QEXPR) { return 0; }
+	// packed lists hold only numbers, never code
+	if(args->as.list.ints) { return 0; }
+
+	for(int i = 0; i < args->as.list.count; i++) {
+		if(lval_within(v, args->as.list.cell[i])) { return 1; }
+	}
+	return 0;
+}
+
+int lval_is_lambda_form(lval* v) {
+	return (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR)
+		&& v->as.list.count == 3
+		&& LVAL_CELLS(v)[0]->type == LVAL_SYM
+		&& strcmp(LVAL_CELLS(v)[0]->as.sym, "\\") == 0
+		&& LVAL_CELLS(v)[1]->type == LVAL_QEXPR;
+}
+
+/* Copies expansion [v] renaming symbols according to [renames] - a list of {from to} pairs, innermost last. Argument code is shared as it is. */
+lval* lval_hygiene(lval* v, lval* args, lval* renames) {
+	if(lval_within(v, args)) { return lval_cp(v); }
+
+	if(v->type == LVAL_SYM) {
+		for(int i = renames->as.list.count - 1; i >= 0; i--) {
+			lval* r = LVAL_CELLS(renames)[i];
+			if(strcmp(LVAL_CELLS(r)[0]->as.sym, v->as.sym) == 0) {
+				return lval_nth(r, 1);
+			}
+		}
+		return lval_cp(v);
+	}
+
+	if(v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) { return lval_cp(v); }
+
+	lval* x = v->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+
+	if(lval_is_lambda_form(v) && !lval_within(LVAL_CELLS(v)[1], args)) {
+		// formals introduced by the macro get fresh names, invisible to the caller's code
+		lval* inner = lval_qexpr();
+		for(int i = 0; i < renames->as.list.count; i++) {
+			lval_add(inner, lval_nth(renames, i));
+		}
+
+		lval* formals = LVAL_CELLS(v)[1];
+		lval* renamed = lval_qexpr();
+		for(int i = 0; i < formals->as.list.count; i++) {
+			lval* s = LVAL_CELLS(formals)[i];
+			if(s->type != LVAL_SYM || strcmp(s->as.sym, "&") == 0 || lval_within(s, args)) {
+				lval_add(renamed, lval_cp(s));
+				continue;
+			}
+
+			char name[256];
+			snprintf(name, sizeof(name), "%s#%i", s->as.sym, __sync_add_and_fetch(&GENSYM, 1));
+			lval* to = lval_sym(name);
+			lval_add(inner, lval_add(lval_add(lval_qexpr(), lval_cp(s)), lval_cp(to)));
+			lval_add(renamed, to);
+		}
+
+		lval_add(x, lval_nth(v, 0));
+		lval_add(x, renamed);
+		lval_add(x, lval_hygiene(LVAL_CELLS(v)[2], args, inner));
+		lval_del(inner);
+		return x;
+	}
+
+	for(int i = 0; i < v->as.list.count; i++) {
+		lval_add(x, lval_hygiene(LVAL_CELLS(v)[i], args, renames));
+	}
+	return x;
+}
+
+lval* lval_expand(lenv* e, lval* m, lval* form) {
+	lval* args = lval_sexpr();
+	for(int i = 1; i < form->as.list.count; i++) {
+		lval_add(args, lval_nth(form, i));
+	}
+
+	lval* r = lval_call(e, m, lval_cp(args));
+	if(r->type == LVAL_ERR) {
+		lval_del(args);
+		lval_del(form);
+		return r;
+	}
+
+	lval* renames = lval_qexpr();
+	lval* x = lval_hygiene(r, args, renames);
+	lval_del(renames);
+	lval_del(r);
+	lval_del(args);
+	lval_del(form);
+
+	// expansion given as a Q-Expression is code to evaluate in place of the call
+	if(x->type == LVAL_QEXPR) {
+		x = lval_own(x);
+		x->type = LVAL_SEXPR;
+	}
+	return x;
+}
+
+lval* builtin_defmacro(lenv* e, lval* a) {
+	LASSERT_NUM("defmacro", a, 2);
+	LASSERT_TYPE("defmacro", a, 0, LVAL_QEXPR);
+	LASSERT_TYPE("defmacro", a, 1, LVAL_QEXPR);
+	LASSERT_NOT_EMPTY("defmacro", a, 0);
+
+	lval* sig = a->as.list.cell[0];
+	for(int i = 0; i < sig->as.list.count; i++) {
+		LASSERT(a, LVAL_CELLS(sig)[i]->type == LVAL_SYM,
+			"Function 'defmacro' cannot define non-symbol. Got %s, expected %s.",
+			ltype_name(LVAL_CELLS(sig)[i]->type), ltype_name(LVAL_SYM));
+	}
+
+	sig = lval_own(lval_pop(a, 0));
+	lval* name = lval_pop(sig, 0);
+	lval* body = lval_pop(a, 0);
+	lval_del(a);
+
+	lval* m = builtin_lambda(e, lval_add(lval_add(lval_sexpr(), sig), body));
+	if(m->type == LVAL_ERR) {
+		lval_del(name);
+		return m;
+	}
+
+	m->as.fun->macro = 1;
+	lenv_def(e, name, m);
+	lval_del(name);
+	lval_del(m);
+	return lval_sexpr();
+}
+
+lval* builtin_sexpr(lenv* e, lval* a) {
+	LASSERT_NUM("sexpr", a, 1);
+	LASSERT_TYPE("sexpr", a, 0, LVAL_QEXPR);
+
+	lval* x = lval_own(lval_take(a, 0));
+	x->type = LVAL_SEXPR;
+	return x;
+}
@@ -0,0 +1,599 @@
+#include "lval.h"
+
+/*
+ * Persistent hash maps implemented as hash array mapped tries. Every level
+ * consumes 5 bits of a key hash and stores only the used slots, indexed by
+ * popcount of a 32-bit bitmap. Updates copy the path from the root to the
+ * changed slot and share everything else, so maps are immutable values and
+ * copying one is O(1). Keys hashing to the same 32 bits end up in a
+ * collision node at the bottom, searched linearly.
+ */
+
+#define LMAP_BITS 	5
+#define LMAP_MASK 	((1u << LMAP_BITS) - 1)
+#define LMAP_DEPTH 	35		/* shift at which hash bits run out */
+
+typedef struct lmap_node lmap_node;
+
+typedef struct {
+	unsigned int 	hash;
+	lval* 			key;	/* NULL when slot holds a sub node */
+	lval* 			val;
+	lmap_node* 		sub;
+} lmap_slot;
+
+struct lmap_node {
+	int 			ref_count;
+	unsigned int 	bitmap;		/* unused in collision nodes */
+	int 			len;
+	lmap_slot 		slots[];
+};
+
+struct lmap {
+	int 			ref_count;
+	int 			count;
+	unsigned int 	hash;		/* order independent hash of all entries */
+	lmap_node* 		root;
+};
+
+unsigned int lmap_mix(unsigned int h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/* Structural hash consistent with lval_eq. Hashes stored in lists may be stale after in place updates, so they're recomputed. */
+unsigned int lval_hash(lval* v) {
+	switch(v->type) {
+		case LVAL_SEXPR:
+		case LVAL_QEXPR: {
+			unsigned int h = 31;
+			for(int i = 0; i < v->as.list.count; i++) {
+				h = 31 * h + (v->as.list.ints ? hmap_int_h(v->as.list.ints[i]) : lval_hash(v->as.list.cell[i]));
+			}
+			return h;
+		}
+		case LVAL_FLOAT:
+			// 0.0 and -0.0 are equal
+			return v->as.flt == 0 ? 0 : (unsigned int)v->hash;
+		case LVAL_FUN:
+			if(v->as.fun->builtin) { return (unsigned int)v->hash; }
+			return lval_hash(v->as.fun->formals) ^ lval_hash(LFUN_SOURCE(v->as.fun));
+		case LVAL_MAP:
+			return v->as.map->hash;
+		default:
+			return (unsigned int)v->hash;
+	}
+}
+
+unsigned int lmap_entry_hash(unsigned int kh, lval* val) {
+	return lmap_mix(kh ^ (lval_hash(val) * 31));
+}
+
+lmap_node* lmap_node_new(unsigned int bitmap, int len) {
+	lmap_node* n = (lmap_node*)malloc(sizeof(lmap_node) + sizeof(lmap_slot) * len);
+	n->ref_count = 1;
+	n->bitmap = bitmap;
+	n->len = len;
+	return n;
+}
+
+void lmap_node_del(lmap_node* n) {
+	if(--n->ref_count > 0) { return; }
+
+	for(int i = 0; i < n->len; i++) {
+		if(n->slots[i].key) {
+			lval_del(n->slots[i].key);
+			lval_del(n->slots[i].val);
+		} else {
+			lmap_node_del(n->slots[i].sub);
+		}
+	}
+	free(n);
+}
+
+/* Shallow copy of a node with room for [extra] more slots; all slots are shared. */
+lmap_node* lmap_node_dup(lmap_node* n, int extra) {
+	lmap_node* x = lmap_node_new(n->bitmap, n->len + extra);
+	x->len = n->len;
+	for(int i = 0; i < n->len; i++) {
+		x->slots[i] = n->slots[i];
+		if(x->slots[i].key) {
+			lval_cp(x->slots[i].key);
+			lval_cp(x->slots[i].val);
+		} else {
+			x->slots[i].sub->ref_count++;
+		}
+	}
+	return x;
+}
+
+int lmap_index(unsigned int bitmap, unsigned int bit) {
+	return __builtin_popcount(bitmap & (bit - 1));
+}
+
+/* Node holding two entries which collided at [shift]. */
+lmap_node* lmap_node_pair(int shift, lmap_slot a, lmap_slot b) {
+	if(shift >= LMAP_DEPTH) {
+		lmap_node* n = lmap_node_new(0, 2);
+		n->slots[0] = a;
+		n->slots[1] = b;
+		return n;
+	}
+
+	unsigned int ia = (a.hash >> shift) & LMAP_MASK;
+	unsigned int ib = (b.hash >> shift) & LMAP_MASK;
+	if(ia == ib) {
+		lmap_node* n = lmap_node_new(1u << ia, 1);
+		n->slots[0].hash = 0;
+		n->slots[0].key = NULL;
+		n->slots[0].val = NULL;
+		n->slots[0].sub = lmap_node_pair(shift + LMAP_BITS, a, b);
+		return n;
+	}
+
+	lmap_node* n = lmap_node_new((1u << ia) | (1u << ib), 2);
+	n->slots[ia < ib ? 0 : 1] = a;
+	n->slots[ia < ib ? 1 : 0] = b;
+	return n;
+}
+
+lval* lmap_node_get(lmap_node* n, int shift, unsigned int hash, lval* k) {
+	while(n) {
+		if(shift >= LMAP_DEPTH) {
+			for(int i = 0; i < n->len; i++) {
+				if(lval_eq(n->slots[i].key, k)) { return n->slots[i].val; }
+			}
+			return NULL;
+		}
+
+		unsigned int bit = 1u << ((hash >> shift) & LMAP_MASK);
+		if(!(n->bitmap & bit)) { return NULL; }
+
+		lmap_slot* s = &n->slots[lmap_index(n->bitmap, bit)];
+		if(s->key) {
+			return (s->hash == hash && lval_eq(s->key, k)) ? s->val : NULL;
+		}
+		n = s->sub;
+		shift += LMAP_BITS;
+	}
+	return NULL;
+}
+
+/* Returns a new node with [k] bound to [v]. [old] receives the replaced value, if any. Takes ownership of [k] and [v]. */
+lmap_node* lmap_node_assoc(lmap_node* n, int shift, unsigned int hash, lval* k, lval* v, lval** old) {
+	lmap_slot e = { hash, k, v, NULL };
+
+	if(shift >= LMAP_DEPTH) {
+		for(int i = 0; i < n->len; i++) {
+			if(lval_eq(n->slots[i].key, k)) {
+				lmap_node* x = lmap_node_dup(n, 0);
+				*old = x->slots[i].val;
+				lval_del(x->slots[i].key);
+				x->slots[i] = e;
+				return x;
+			}
+		}
+		lmap_node* x = lmap_node_dup(n, 1);
+		x->slots[x->len++] = e;
+		return x;
+	}
+
+	unsigned int bit = 1u << ((hash >> shift) & LMAP_MASK);
+	int idx = lmap_index(n->bitmap, bit);
+
+	if(!(n->bitmap & bit)) {
+		// insert new slot keeping slots ordered by bit position
+		lmap_node* x = lmap_node_dup(n, 1);
+		memmove(&x->slots[idx + 1], &x->slots[idx], sizeof(lmap_slot) * (x->len - idx));
+		x->slots[idx] = e;
+		x->bitmap |= bit;
+		x->len++;
+		return x;
+	}
+
+	lmap_slot* s = &n->slots[idx];
+	lmap_node* x = lmap_node_dup(n, 0);
+	lmap_slot* xs = &x->slots[idx];
+
+	if(!s->key) {
+		lmap_node* sub = lmap_node_assoc(s->sub, shift + LMAP_BITS, hash, k, v, old);
+		lmap_node_del(xs->sub);
+		xs->sub = sub;
+	} else if(s->hash == hash && lval_eq(s->key, k)) {
+		*old = xs->val;
+		lval_del(xs->key);
+		*xs = e;
+	} else {
+		// push both entries one level down
+		lmap_slot prev = *xs;
+		xs->key = NULL;
+		xs->val = NULL;
+		xs->hash = 0;
+		xs->sub = lmap_node_pair(shift + LMAP_BITS, prev, e);
+	}
+	return x;
+}
+
+/* Returns a new node without [k], or NULL if it became empty. [old] receives the removed value. */
+lmap_node* lmap_node_dissoc(lmap_node* n, int shift, unsigned int hash, lval* k, lval** old) {
+	int idx = -1;
+	unsigned int bit = 0;
+
+	if(shift >= LMAP_DEPTH) {
+		for(int i = 0; i < n->len; i++) {
+			if(lval_eq(n->slots[i].key, k)) { idx = i; break; }
+		}
+		if(idx < 0) { n->ref_count++; return n; }
+	} else {
+		bit = 1u << ((hash >> shift) & LMAP_MASK);
+		if(!(n->bitmap & bit)) { n->ref_count++; return n; }
+		idx = lmap_index(n->bitmap, bit);
+
+		lmap_slot* s = &n->slots[idx];
+		if(!s->key) {
+			lmap_node* sub = lmap_node_dissoc(s->sub, shift + LMAP_BITS, hash, k, old);
+			if(sub == s->sub) {
+				lmap_node_del(sub);
+				n->ref_count++;
+				return n;
+			}
+
+			lmap_node* x = lmap_node_dup(n, 0);
+			lmap_node_del(x->slots[idx].sub);
+			if(sub) {
+				// a sub node left with a single entry is pulled up
+				if(sub->len == 1 && sub->slots[0].key) {
+					x->slots[idx] = sub->slots[0];
+					lval_cp(x->slots[idx].key);
+					lval_cp(x->slots[idx].val);
+					lmap_node_del(sub);
+				} else {
+					x->slots[idx].sub = sub;
+				}
+				return x;
+			}
+			memmove(&x->slots[idx], &x->slots[idx + 1], sizeof(lmap_slot) * (x->len - idx - 1));
+			x->len--;
+			x->bitmap &= ~bit;
+			if(x->len == 0) { lmap_node_del(x); return NULL; }
+			return x;
+		}
+		if(!(s->hash == hash && lval_eq(s->key, k))) { n->ref_count++; return n; }
+	}
+
+	if(n->len == 1) {
+		*old = lval_cp(n->slots[idx].val);
+		return NULL;
+	}
+
+	lmap_node* x = lmap_node_dup(n, 0);
+	*old = x->slots[idx].val;
+	lval_del(x->slots[idx].key);
+	memmove(&x->slots[idx], &x->slots[idx + 1], sizeof(lmap_slot) * (x->len - idx - 1));
+	x->len--;
+	x->bitmap &= ~bit;
+	return x;
+}
+
+lmap* lmap_new(void) {
+	lmap* m = (lmap*)malloc(sizeof(lmap));
+	m->ref_count = 1;
+	m->count = 0;
+	m->hash = 0;
+	m->root = NULL;
+	return m;
+}
+
+/* Create a new map type lval. Takes ownership of [m] */
+lval* lval_map(lmap* m) {
+	lval* v = lval_new();
+	v->type = LVAL_MAP;
+	v->hash = (int)m->hash;
+	v->as.map = m;
+	return v;
+}
+
+int lmap_count(lmap* m) {
+	return m->count;
+}
+
+lmap* lmap_cp(lmap* m) {
+	m->ref_count++;
+	return m;
+}
+
+void lmap_del(lmap* m) {
+	if(--m->ref_count > 0) { return; }
+	if(m->root) { lmap_node_del(m->root); }
+	free(m);
+}
+
+lval* lmap_get(lmap* m, lval* k) {
+	return lmap_node_get(m->root, 0, lmap_mix(lval_hash(k)), k);
+}
+
+lmap* lmap_assoc(lmap* m, lval* k, lval* v) {
+	unsigned int kh = lval_hash(k);
+	unsigned int hash = lmap_mix(kh);
+
+	lmap* x = lmap_new();
+	x->count = m->count;
+	x->hash = m->hash + lmap_entry_hash(kh, v);
+
+	lval* old = NULL;
+	if(m->root) {
+		x->root = lmap_node_assoc(m->root, 0, hash, lval_cp(k), lval_cp(v), &old);
+	} else {
+		x->root = lmap_node_new(1u << (hash & LMAP_MASK), 1);
+		lmap_slot e = { hash, lval_cp(k), lval_cp(v), NULL };
+		x->root->slots[0] = e;
+	}
+
+	if(old) {
+		x->hash -= lmap_entry_hash(kh, old);
+		lval_del(old);
+	} else {
+		x->count++;
+	}
+	return x;
+}
+
+lmap* lmap_dissoc(lmap* m, lval* k) {
+	if(!m->root) { return lmap_cp(m); }
+
+	unsigned int kh = lval_hash(k);
+	lval* old = NULL;
+	lmap_node* root = lmap_node_dissoc(m->root, 0, lmap_mix(kh), k, &old);
+	if(!old) {
+		lmap_node_del(root);
+		return lmap_cp(m);
+	}
+
+	lmap* x = lmap_new();
+	x->root = root;
+	x->count = m->count - 1;
+	x->hash = m->hash - lmap_entry_hash(kh, old);
+	lval_del(old);
+	return x;
+}
+
+/* Stores keys and values of all entries under [n] into [keys] and [vals] starting at [*at]. Either array may be NULL. */
+void lmap_node_items(lmap_node* n, lval** keys, lval** vals, int* at) {
+	for(int i = 0; i < n->len; i++) {
+		lmap_slot* s = &n->slots[i];
+		if(s->key) {
+			if(keys) { keys[*at] = lval_cp(s->key); }
+			if(vals) { vals[*at] = lval_cp(s->val); }
+			(*at)++;
+		} else {
+			lmap_node_items(s->sub, keys, vals, at);
+		}
+	}
+}
+
+/* Returns keys or values of all entries as a Q-Expression. */
+lval* lmap_items(lmap* m, int want_keys) {
+	lval* l = lval_qexpr();
+	l->as.list.count = m->count;
+	l->as.list.cell = (lval**)malloc(sizeof(lval*) * m->count);
+
+	int at = 0;
+	if(m->root) {
+		lmap_node_items(m->root, want_keys ? l->as.list.cell : NULL, want_keys ? NULL : l->as.list.cell, &at);
+	}
+	l->hash = hmap_list_h(l->as.list.count, l->as.list.cell);
+	return l;
+}
+
+int lmap_node_contains(lmap_node* n, lmap* m) {
+	for(int i = 0; i < n->len; i++) {
+		lmap_slot* s = &n->slots[i];
+		if(s->key) {
+			lval* v = lmap_get(m, s->key);
+			if(!v || !lval_eq(v, s->val)) { return 0; }
+		} else if(!lmap_node_contains(s->sub, m)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int lmap_eq(lmap* a, lmap* b) {
+	if(a == b || (a->count == 0 && b->count == 0)) { return 1; }
+	if(a->count != b->count || a->hash != b->hash) { return 0; }
+	return lmap_node_contains(a->root, b);
+}
+
+lmap_node* lmap_node_clone(lmap_node* n) {
+	lmap_node* x = lmap_node_new(n->bitmap, n->len);
+	for(int i = 0; i < n->len; i++) {
+		x->slots[i] = n->slots[i];
+		if(n->slots[i].key) {
+			x->slots[i].key = lval_clone(n->slots[i].key);
+			x->slots[i].val = lval_clone(n->slots[i].val);
+		} else {
+			x->slots[i].sub = lmap_node_clone(n->slots[i].sub);
+		}
+	}
+	return x;
+}
+
+lmap* lmap_clone(lmap* m) {
+	lmap* x = lmap_new();
+	x->count = m->count;
+	x->hash = m->hash;
+	x->root = m->root ? lmap_node_clone(m->root) : NULL;
+	return x;
+}
+
+int lmap_node_any(lmap_node* n, int (*pred)(lval*)) {
+	for(int i = 0; i < n->len; i++) {
+		lmap_slot* s = &n->slots[i];
+		if(s->key ? pred(s->key) || pred(s->val) : lmap_node_any(s->sub, pred)) { return 1; }
+	}
+	return 0;
+}
+
+int lmap_any(lmap* m, int (*pred)(lval*)) {
+	return m->root ? lmap_node_any(m->root, pred) : 0;
+}
+
+void lmap_node_render(lbuf* b, lmap_node* n, int* first) {
+	for(int i = 0; i < n->len; i++) {
+		lmap_slot* s = &n->slots[i];
+		if(s->key) {
+			if(!*first) { lbuf_putc(b, ' '); }
+			*first = 0;
+			lval_render(b, s->key);
+			lbuf_putc(b, ' ');
+			lval_render(b, s->val);
+		} else {
+			lmap_node_render(b, s->sub, first);
+		}
+	}
+}
+
+void lmap_render(lbuf* b, lmap* m) {
+	int first = 1;
+	lbuf_puts(b, "#{");
+	if(m->root) { lmap_node_render(b, m->root, &first); }
+	lbuf_putc(b, '}');
+}
+
+/* Maps are expected at [index]; nil stands for the empty map, since builtins can't be called without arguments. */
+#define LASSERT_MAP(func, args, index)														\
+	LASSERT(args, (args->as.list.cell[index]->type == LVAL_MAP 								\
+		|| (args->as.list.cell[index]->type == LVAL_QEXPR && args->as.list.cell[index]->as.list.count == 0)), \
+		"Function '%s' passed incorrect type for argument %i. Got %s, expected %s.",		\
+		func, index, ltype_name(args->as.list.cell[index]->type), ltype_name(LVAL_MAP))
+
+/* Returns new reference to map held by [v], which is either a map or nil. */
+lmap* lval_to_map(lval* v) {
+	return v->type == LVAL_MAP ? lmap_cp(v->as.map) : lmap_new();
+}
+
+lval* builtin_hash_map(lenv* e, lval* a) {
+	LASSERT(a, a->as.list.count % 2 == 0,
+		"Function 'hash-map' passed odd number of arguments. Expected key value pairs.");
+
+	lmap* m = lmap_new();
+	for(int i = 0; i < a->as.list.count; i += 2) {
+		lmap* x = lmap_assoc(m, a->as.list.cell[i], a->as.list.cell[i+1]);
+		lmap_del(m);
+		m = x;
+	}
+
+	lval_del(a);
+	return lval_map(m);
+}
+
+lval* builtin_assoc(lenv* e, lval* a) {
+	LASSERT_MAP("assoc", a, 0);
+	LASSERT(a, a->as.list.count % 2 == 1,
+		"Function 'assoc' passed odd number of arguments after map. Expected key value pairs.");
+
+	lmap* m = lval_to_map(a->as.list.cell[0]);
+	for(int i = 1; i < a->as.list.count; i += 2) {
+		lmap* x = lmap_assoc(m, a->as.list.cell[i], a->as.list.cell[i+1]);
+		lmap_del(m);
+		m = x;
+	}
+
+	lval_del(a);
+	return lval_map(m);
+}
+
+lval* builtin_dissoc(lenv* e, lval* a) {
+	LASSERT_MAP("dissoc", a, 0);
+
+	lmap* m = lval_to_map(a->as.list.cell[0]);
+	for(int i = 1; i < a->as.list.count; i++) {
+		lmap* x = lmap_dissoc(m, a->as.list.cell[i]);
+		lmap_del(m);
+		m = x;
+	}
+
+	lval_del(a);
+	return lval_map(m);
+}
+
+lval* builtin_get(lenv* e, lval* a) {
+	LASSERT(a, a->as.list.count == 2 || a->as.list.count == 3,
+		"Function 'get' passed incorrect number of arguments. Got %i, expected 2 or 3.", a->as.list.count);
+	LASSERT_MAP("get", a, 0);
+
+	// missing keys give the default value if there's one, nil otherwise
+	lval* m = a->as.list.cell[0];
+	lval* v = m->type == LVAL_MAP ? lmap_get(m->as.map, a->as.list.cell[1]) : NULL;
+	if(v) {
+		v = lval_cp(v);
+	} else if(a->as.list.count == 3) {
+		v = lval_cp(a->as.list.cell[2]);
+	} else {
+		v = lval_qexpr();
+	}
+
+	lval_del(a);
+	return v;
+}
+
+lval* builtin_keys(lenv* e, lval* a) {
+	LASSERT_NUM("keys", a, 1);
+	LASSERT_MAP("keys", a, 0);
+
+	lmap* m = lval_to_map(a->as.list.cell[0]);
+	lval* keys = lmap_items(m, 1);
+	lmap_del(m);
+	lval_del(a);
+	return keys;
+}
+
+lval* builtin_vals(lenv* e, lval* a) {
+	LASSERT_NUM("vals", a, 1);
+	LASSERT_MAP("vals", a, 0);
+
+	lmap* m = lval_to_map(a->as.list.cell[0]);
+	lval* vals = lmap_items(m, 0);
+	lmap_del(m);
+	lval_del(a);
+	return vals;
+}
+
+lval* builtin_merge(lenv* e, lval* a) {
+	for(int i = 0; i < a->as.list.count; i++) { LASSERT_MAP("merge", a, i); }
+	if(a->as.list.count == 0) {
+		lval_del(a);
+		return lval_map(lmap_new());
+	}
+
+	// entries of later maps win; structure of the first map is shared by the result
+	lmap* m = lval_to_map(a->as.list.cell[0]);
+	for(int i = 1; i < a->as.list.count; i++) {
+		if(a->as.list.cell[i]->type != LVAL_MAP) { continue; }
+
+		lmap* b = a->as.list.cell[i]->as.map;
+		if(m->count == 0) {
+			lmap_del(m);
+			m = lmap_cp(b);
+			continue;
+		}
+		if(!b->root) { continue; }
+
+		lval* keys = lmap_items(b, 1);
+		lval* vals = lmap_items(b, 0);
+		for(int j = 0; j < keys->as.list.count; j++) {
+			lmap* x = lmap_assoc(m, LVAL_CELLS(keys)[j], LVAL_CELLS(vals)[j]);
+			lmap_del(m);
+			m = x;
+		}
+		lval_del(keys);
+		lval_del(vals);
+	}
+
+	lval_del(a);
+	return lval_map(m);
+}
@@ -0,0 +1,269 @@
+#include "lval.h"
+
+/*
+ * Result caches of memoized lambdas. Calls are keyed by their argument lists,
+ * hashed with lval_hash and compared with lval_eq, in a chained hash table.
+ * Entries are also kept on a list from the most to the least recently used
+ * one, so once a cache is full the entry unused for the longest time makes
+ * room for the new one. Only lambdas applied to all of their formals cache
+ * results, errors are never cached. Caches are listed on their heap, which
+ * empties them when it runs out of values.
+ */
+
+#define LMEMO_SIZE 		4096	/* entries kept unless a bound is given */
+#define LMEMO_BUCKETS 	64		/* initial buckets, doubled as entries come */
+
+typedef struct lmemo_entry lmemo_entry;
+
+struct lmemo_entry {
+	unsigned int 	hash;
+	int 			n;
+	lval** 			args;
+	lval* 			val;
+	lmemo_entry* 	chain;		/* next entry in the same bucket */
+	lmemo_entry* 	newer;
+	lmemo_entry* 	older;
+};
+
+struct lmemo {
+	int 			ref_count;
+	int 			count;
+	int 			bound;
+	int 			nbuckets;
+	lmemo_entry** 	buckets;
+	lmemo_entry* 	newest;
+	lmemo_entry* 	oldest;
+	long 			hits;
+	long 			misses;
+	long 			evictions;
+	mem_heap* 		heap;
+	lmemo* 			prev;		/* caches on the same heap */
+	lmemo* 			next;
+};
+
+lmemo* lmemo_new(int bound) {
+	lmemo* m = (lmemo*)calloc(1, sizeof(lmemo));
+	m->ref_count = 1;
+	m->bound = bound > 0 ? bound : LMEMO_SIZE;
+	m->nbuckets = LMEMO_BUCKETS;
+	m->buckets = (lmemo_entry**)calloc(m->nbuckets, sizeof(lmemo_entry*));
+
+	m->heap = HEAP;
+	m->next = HEAP->memos;
+	if(m->next) { m->next->prev = m; }
+	HEAP->memos = m;
+	return m;
+}
+
+lmemo* lmemo_cp(lmemo* m) {
+	m->ref_count++;
+	return m;
+}
+
+void lmemo_entry_del(lmemo_entry* x) {
+	for(int i = 0; i < x->n; i++) {
+		lval_del(x->args[i]);
+	}
+	free(x->args);
+	lval_del(x->val);
+	free(x);
+}
+
+void lmemo_clear(lmemo* m) {
+	lmemo_entry* x = m->newest;
+	while(x) {
+		lmemo_entry* o = x->older;
+		lmemo_entry_del(x);
+		x = o;
+	}
+	memset(m->buckets, 0, sizeof(lmemo_entry*) * m->nbuckets);
+	m->newest = m->oldest = NULL;
+	m->evictions += m->count;
+	m->count = 0;
+}
+
+void lmemo_del(lmemo* m) {
+	if(--m->ref_count > 0) { return; }
+
+	m->evictions -= m->count;
+	lmemo_clear(m);
+	if(m->prev) { m->prev->next = m->next; } else { m->heap->memos = m->next; }
+	if(m->next) { m->next->prev = m->prev; }
+	free(m->buckets);
+	free(m);
+}
+
+/* Empties every cache on [heap], giving its values back. */
+void lmemo_clear_heap(mem_heap* heap) {
+	for(lmemo* m = heap->memos; m; m = m->next) {
+		lmemo_clear(m);
+	}
+}
+
+unsigned int lmemo_hash(lval** args, int n) {
+	unsigned int h = 31;
+	for(int i = 0; i < n; i++) {
+		h = 31 * h + lval_hash(args[i]);
+	}
+	return h;
+}
+
+lmemo_entry* lmemo_find(lmemo* m, unsigned int h, lval** args, int n) {
+	lmemo_entry* x = m->buckets[h & (m->nbuckets - 1)];
+	for(; x; x = x->chain) {
+		if(x->hash != h || x->n != n) { continue; }
+
+		int i = 0;
+		while(i < n && lval_eq(x->args[i], args[i])) { i++; }
+		if(i == n) { return x; }
+	}
+	return NULL;
+}
+
+void lmemo_unlink(lmemo* m, lmemo_entry* x) {
+	if(x->newer) { x->newer->older = x->older; } else { m->newest = x->older; }
+	if(x->older) { x->older->newer = x->newer; } else { m->oldest = x->newer; }
+}
+
+void lmemo_push(lmemo* m, lmemo_entry* x) {
+	x->newer = NULL;
+	x->older = m->newest;
+	if(m->newest) { m->newest->newer = x; } else { m->oldest = x; }
+	m->newest = x;
+}
+
+void lmemo_evict(lmemo* m) {
+	lmemo_entry* x = m->oldest;
+	lmemo_unlink(m, x);
+
+	lmemo_entry** p = &m->buckets[x->hash & (m->nbuckets - 1)];
+	while(*p != x) { p = &(*p)->chain; }
+	*p = x->chain;
+
+	lmemo_entry_del(x);
+	m->count--;
+	m->evictions++;
+}
+
+void lmemo_grow(lmemo* m) {
+	int nb = m->nbuckets * 2;
+	lmemo_entry** b = (lmemo_entry**)calloc(nb, sizeof(lmemo_entry*));
+	for(lmemo_entry* x = m->newest; x; x = x->older) {
+		x->chain = b[x->hash & (nb - 1)];
+		b[x->hash & (nb - 1)] = x;
+	}
+	free(m->buckets);
+	m->buckets = b;
+	m->nbuckets = nb;
+}
+
+/* Caches [val] for arguments [args], taking references of both over. */
+void lmemo_put(lmemo* m, unsigned int h, lval** args, int n, lval* val) {
+	lmemo_entry* x = (lmemo_entry*)malloc(sizeof(lmemo_entry));
+	x->hash = h;
+	x->n = n;
+	x->args = args;
+	x->val = val;
+
+	if(m->count >= m->bound) { lmemo_evict(m); }
+	if(m->count >= m->nbuckets) { lmemo_grow(m); }
+
+	x->chain = m->buckets[h & (m->nbuckets - 1)];
+	m->buckets[h & (m->nbuckets - 1)] = x;
+	lmemo_push(m, x);
+	m->count++;
+}
+
+lval* lmemo_call(lenv* e, lval* f, lval** args, int n) {
+	// partial applications aren't cached, nor counted
+	if(n < f->as.fun->arity) { return lval_apply_lambda(e, f, args, n); }
+
+	lmemo* m = f->as.fun->memo;
+	unsigned int h = lmemo_hash(args, n);
+
+	lmemo_entry* x = lmemo_find(m, h, args, n);
+	if(x) {
+		m->hits++;
+		lmemo_unlink(m, x);
+		lmemo_push(m, x);
+		for(int i = 0; i < n; i++) {
+			lval_del(args[i]);
+		}
+		return lval_cp(x->val);
+	}
+	m->misses++;
+
+	lval** keys = (lval**)malloc(sizeof(lval*) * (n ? n : 1));
+	for(int i = 0; i < n; i++) {
+		keys[i] = lval_cp(args[i]);
+	}
+
+	lval* r = lval_apply_lambda(e, f, args, n);
+
+	// the call may have cached the same arguments already through recursion
+	if(r->type == LVAL_ERR || lmemo_find(m, h, keys, n)) {
+		for(int i = 0; i < n; i++) {
+			lval_del(keys[i]);
+		}
+		free(keys);
+		return r;
+	}
+
+	lmemo_put(m, h, keys, n, lval_cp(r));
+	return r;
+}
+
+lval* builtin_memo(lenv* e, lval* a) {
+	LASSERT(a, a->as.list.count == 1 || a->as.list.count == 2,
+		"Function 'memo' passed incorrect number of arguments. Got %i, expected 1 or 2.", a->as.list.count);
+	LASSERT_TYPE("memo", a, 0, LVAL_FUN);
+	LASSERT(a, !a->as.list.cell[0]->as.fun->builtin && !a->as.list.cell[0]->as.fun->macro,
+		"Function 'memo' passed a builtin or a macro. Expected a lambda.");
+
+	int bound = LMEMO_SIZE;
+	if(a->as.list.count == 2) {
+		LASSERT_TYPE("memo", a, 1, LVAL_NUM);
+		LASSERT(a, a->as.list.cell[1]->as.num > 0 && a->as.list.cell[1]->as.num <= 0x7fffffff,
+			"Function 'memo' passed cache size %li. Expected a positive size.", a->as.list.cell[1]->as.num);
+		bound = (int)a->as.list.cell[1]->as.num;
+	}
+
+	// the wrapper gets a cache of its own, even when memoizing a memoized lambda
+	lval* f = lval_dcp(a->as.list.cell[0]);
+	if(f->as.fun->memo) { lmemo_del(f->as.fun->memo); }
+	f->as.fun->memo = lmemo_new(bound);
+
+	lval_del(a);
+	return f;
+}
+
+lval* builtin_memo_stats(lenv* e, lval* a) {
+	LASSERT_NUM("memo-stats", a, 1);
+	LASSERT_TYPE("memo-stats", a, 0, LVAL_FUN);
+	lval* f = a->as.list.cell[0];
+	LASSERT(a, !f->as.fun->builtin && f->as.fun->memo,
+		"Function 'memo-stats' passed a function which isn't memoized.");
+
+	lmemo* m = f->as.fun->memo;
+	long calls = m->hits + m->misses;
+	lval* stats[] = {
+		lval_str("hits"), lval_num(m->hits),
+		lval_str("misses"), lval_num(m->misses),
+		lval_str("hit-rate"), lval_float(calls ? (double)m->hits / calls : 0),
+		lval_str("size"), lval_num(m->count),
+		lval_str("bound"), lval_num(m->bound),
+		lval_str("evictions"), lval_num(m->evictions)
+	};
+
+	lmap* r = lmap_new();
+	for(int i = 0; i < (int)(sizeof(stats) / sizeof(stats[0])); i += 2) {
+		lmap* x = lmap_assoc(r, stats[i], stats[i+1]);
+		lmap_del(r);
+		r = x;
+		lval_del(stats[i]);
+		lval_del(stats[i+1]);
+	}
+
+	lval_del(a);
+	return lval_map(r);
+}
@@ -0,0 +1,361 @@
+#include "lval.h"
+#include "hmap.h"
+
+/* Limit of nested expansions of a single form, guarding against macros expanding into themselves. */
+#define MACRO_DEPTH_MAX 64
+
+/* Builtins free of side effects, which can be safely evaluated ahead of time. */
+static lbuiltin PURE_BUILTINS[] = {
+	builtin_add, builtin_sub, builtin_mul, builtin_div,
+	builtin_eq, builtin_ne, builtin_gt, builtin_ge, builtin_lt, builtin_le,
+	builtin_neq,
+	builtin_to_float, builtin_to_int,
+	builtin_str_concat, builtin_str_len, builtin_str_sub, builtin_str_find,
+	builtin_str_split, builtin_str_replace, builtin_str_join,
+	builtin_str_to_num, builtin_num_to_str,
+	NULL
+};
+
+/* Symbols and the values they resolved to, in pairs, which the body being optimized relies on. NULL until the first one. */
+static __thread lval* FOLD_ASSUMED = NULL;
+
+/* Records that optimized code relies on symbol [s] resolving to what it does in [e] now. */
+void lval_assume(lenv* e, lval* s) {
+	if(!FOLD_ASSUMED) { FOLD_ASSUMED = lval_qexpr(); }
+	for(int i = 0; i < FOLD_ASSUMED->as.list.count; i += 2) {
+		if(lval_eq(LVAL_CELLS(FOLD_ASSUMED)[i], s)) { return; }
+	}
+	lval_add(FOLD_ASSUMED, lval_cp(s));
+	lval_add(FOLD_ASSUMED, lenv_get(e, s));
+}
+
+int lval_assumed_count(void) {
+	return FOLD_ASSUMED ? FOLD_ASSUMED->as.list.count : 0;
+}
+
+int lbuiltin_pure(lbuiltin f) {
+	for(int i = 0; PURE_BUILTINS[i]; i++) {
+		if(PURE_BUILTINS[i] == f) { return 1; }
+	}
+	return 0;
+}
+
+/* Checks if symbol [s] is a name of one of the lambda formals and therefore cannot be resolved ahead of time. */
+int lval_bound(lval* formals, lval* s) {
+	for(int i = 0; i < formals->as.list.count; i++) {
+		if(lval_eq(LVAL_CELLS(formals)[i], s)) { return 1; }
+	}
+	return 0;
+}
+
+/* Resolves symbol [s] to a builtin function it's bound to at definition time or NULL if it's not a builtin. */
+lbuiltin lval_resolve_builtin(lenv* e, lval* formals, lval* s) {
+	if(s->type != LVAL_SYM || lval_bound(formals, s)) { return NULL; }
+
+	lval* f = lenv_get(e, s);
+	lbuiltin b = (f->type == LVAL_FUN) ? f->as.fun->builtin : NULL;
+	lval_del(f);
+
+	return b;
+}
+
+/* Resolves symbol [s] to a macro it's bound to at definition time or NULL if it's not a macro. */
+lval* lval_resolve_macro(lenv* e, lval* formals, lval* s) {
+	if(s->type != LVAL_SYM || lval_bound(formals, s)) { return NULL; }
+
+	lval* f = lenv_get(e, s);
+	if(f->type == LVAL_FUN && f->as.fun->macro) { return f; }
+	lval_del(f);
+
+	return NULL;
+}
+
+int lval_const(lval* x) {
+	return x->type == LVAL_NUM || x->type == LVAL_FLOAT || x->type == LVAL_BIGNUM || x->type == LVAL_STR || x->type == LVAL_QEXPR;
+}
+
+lval* lval_fold(lenv* e, lval* formals, lval* x);
+lval* lval_fold_block(lenv* e, lval* formals, lval* x);
+
+/* Builds lambda [x] with literal formals and body ahead of time. Its body is optimized with formals of both lambdas bound. */
+lval* lval_fold_lambda(lenv* e, lval* formals, lval* x) {
+	if(x->as.list.count != 3
+			|| LVAL_CELLS(x)[1]->type != LVAL_QEXPR
+			|| LVAL_CELLS(x)[2]->type != LVAL_QEXPR) {
+		return x;
+	}
+
+	// malformed formals are left to be reported at runtime
+	lval* inner = LVAL_CELLS(x)[1];
+	for(int i = 0; i < inner->as.list.count; i++) {
+		lval* s = LVAL_CELLS(inner)[i];
+		if(s->type != LVAL_SYM) { return x; }
+		if(strcmp(s->as.sym, "&") == 0 && i != inner->as.list.count - 2) { return x; }
+	}
+
+	lval* scope = lval_qexpr();
+	for(int i = 0; i < formals->as.list.count; i++) { lval_add(scope, lval_nth(formals, i)); }
+	for(int i = 0; i < inner->as.list.count; i++) { lval_add(scope, lval_nth(inner, i)); }
+
+	// the inner lambda guards its own body, it may be called long after this one
+	lval* source = lval_nth(x, 2);
+	lval* assumed;
+	lval* body = lval_optimize(e, scope, lval_cp(source), &assumed);
+	lval* f = lval_lambda_assume(lval_lambda(lval_cp(inner), body), source, assumed);
+	lval_del(scope);
+	lval_del(x);
+	return f;
+}
+
+/* Optimizes clauses of 'case' or 'select' call [x] starting at [first]: the key or condition as an expression, the rest as a code block. */
+lval* lval_fold_clauses(lenv* e, lval* formals, lval* x, int first) {
+	for(int i = first; i < x->as.list.count; i++) {
+		lval* c = LVAL_CELLS(x)[i];
+		if(c->type != LVAL_QEXPR || c->as.list.count == 0) { return x; }
+	}
+
+	x = lval_own(x);
+	for(int i = first; i < x->as.list.count; i++) {
+		lval* c = LVAL_CELLS(x)[i];
+		lval* k = lval_nth(c, 0);
+		if(k->type == LVAL_SEXPR) { k = lval_fold(e, formals, k); }
+
+		lval* code = lval_qexpr();
+		for(int j = 1; j < c->as.list.count; j++) { lval_add(code, lval_nth(c, j)); }
+		code = lval_fold_block(e, formals, code);
+
+		lval* n = lval_add(lval_qexpr(), k);
+		for(int j = 0; j < code->as.list.count; j++) { lval_add(n, lval_nth(code, j)); }
+		lval_del(code);
+
+		lval_del(c);
+		LVAL_CELLS(x)[i] = n;
+	}
+
+	lval_list_rehash(x);
+	return x;
+}
+
+/* Compiles 'case' call [x] with literal integer or string keys into a lookup in a map from keys to clause code. */
+lval* lval_fold_case(lenv* e, lval* formals, lval* x) {
+	if(x->as.list.count < 3) { return x; }
+
+	x = lval_fold_clauses(e, formals, x, 2);
+	for(int i = 2; i < x->as.list.count; i++) {
+		lval* c = LVAL_CELLS(x)[i];
+		if(c->type != LVAL_QEXPR || c->as.list.count == 0) { return x; }
+		if(LVAL_CELLS(c)[0]->type != LVAL_NUM && LVAL_CELLS(c)[0]->type != LVAL_STR) { return x; }
+	}
+
+	lmap* table = lmap_new();
+	for(int i = 2; i < x->as.list.count; i++) {
+		lval* c = LVAL_CELLS(x)[i];
+
+		// first clause with a given key wins, as it would in a scan
+		if(lmap_get(table, LVAL_CELLS(c)[0])) { continue; }
+
+		lval* code = lval_qexpr();
+		for(int j = 1; j < c->as.list.count; j++) { lval_add(code, lval_nth(c, j)); }
+
+		lmap* t = lmap_assoc(table, LVAL_CELLS(c)[0], code);
+		lval_del(code);
+		lmap_del(table);
+		table = t;
+	}
+
+	lval* r = lval_sexpr();
+	lval_add(r, lval_nth(x, 0));
+	lval_add(r, lval_nth(x, 1));
+	lval_add(r, lval_map(table));
+	lval_del(x);
+	return r;
+}
+
+/* Folds call [x] of builtin [f]. */
+lval* lval_fold_builtin(lenv* e, lval* formals, lval* x, lbuiltin f) {
+	// (if c a b) with constant condition is reduced to the chosen branch
+	if(f == builtin_if) {
+		if(x->as.list.count != 4) { return x; }
+
+		lval* c = LVAL_CELLS(x)[1];
+		if(c->type != LVAL_NUM) { return x; }
+
+		// a branch computed at run time may turn out to be a Q-Expression, run as code then
+		int chosen = c->as.num ? 2 : 3;
+		int t = LVAL_CELLS(x)[chosen]->type;
+		if(t == LVAL_SYM || t == LVAL_SEXPR) { return x; }
+
+		x = lval_own(x);
+		lval* branch = lval_pop(x, chosen);
+		lval_del(x);
+
+		// constant branches evaluate to themselves
+		if(branch->type != LVAL_QEXPR) { return branch; }
+		branch = lval_own(branch);
+		branch->type = LVAL_SEXPR;
+		return branch;
+	}
+
+	if(f == builtin_lambda) { return lval_fold_lambda(e, formals, x); }
+	if(f == builtin_case) { return lval_fold_case(e, formals, x); }
+
+	if(!lbuiltin_pure(f)) { return x; }
+
+	lval* args = lval_sexpr();
+	for(int i = 1; i < x->as.list.count; i++) {
+		lval* arg = LVAL_CELLS(x)[i];
+		if(!lval_const(arg)) {
+			lval_del(args);
+			return x;
+		}
+		lval_add(args, lval_cp(arg));
+	}
+
+	// errors are left to be raised at runtime, as unoptimized code would do
+	lval* r = f(e, args);
+	if(r->type == LVAL_ERR) {
+		lval_del(r);
+		return x;
+	}
+
+	lval_del(x);
+	return r;
+}
+
+/* Folds a single S-Expression [x] of already optimized arguments. Returns either a folded constant or [x] itself. */
+lval* lval_fold_call(lenv* e, lval* formals, lval* x) {
+	// (f) is the value f itself, not a call
+	if(x->as.list.count < 2) { return x; }
+
+	lbuiltin f = lval_resolve_builtin(e, formals, LVAL_CELLS(x)[0]);
+	if(!f) { return x; }
+
+	// the result is only valid while the head still names the same builtin
+	lval* head = lval_cp(LVAL_CELLS(x)[0]);
+	lval* r;
+	if(f == builtin_select) {
+		// clauses treated as code matter only if anything in them got folded
+		int n = lval_assumed_count();
+		r = lval_fold_clauses(e, formals, x, 1);
+		if(lval_assumed_count() > n) { lval_assume(e, head); }
+	} else {
+		r = lval_fold_builtin(e, formals, x, f);
+		if(r != x) { lval_assume(e, head); }
+	}
+	lval_del(head);
+	return r;
+}
+
+/* Expands macro calls at the head of S-Expression [x] until it's no longer a macro call. */
+lval* lval_fold_macro(lenv* e, lval* formals, lval* x) {
+	for(int depth = 0; depth < MACRO_DEPTH_MAX; depth++) {
+		if(x->type != LVAL_SEXPR || x->as.list.count < 2) { return x; }
+
+		lval* m = lval_resolve_macro(e, formals, LVAL_CELLS(x)[0]);
+		if(!m) { return x; }
+
+		// failed expansion is left to be reported at runtime
+		lval* r = lval_expand(e, m, lval_cp(x));
+		lval_del(m);
+		if(r->type == LVAL_ERR) {
+			lval_del(r);
+			return x;
+		}
+		lval_assume(e, LVAL_CELLS(x)[0]);
+
+		lval_del(x);
+		x = r;
+	}
+	return x;
+}
+
+/* Optimizes elements of S-Expression [x]. Only nested S-Expressions and branches of 'if' are treated as code, Q-Expressions are data otherwise. */
+lval* lval_fold_cells(lenv* e, lval* formals, lval* x) {
+	int is_if = x->as.list.count > 0
+		&& lval_resolve_builtin(e, formals, LVAL_CELLS(x)[0]) == builtin_if;
+	int n = lval_assumed_count();
+
+	for(int i = 0; i < x->as.list.count; i++) {
+		lval* c = LVAL_CELLS(x)[i];
+		if(c->type == LVAL_SEXPR || (is_if && i >= 2 && c->type == LVAL_QEXPR)) {
+			x = lval_own(x);
+			LVAL_CELLS(x)[i] = lval_fold(e, formals, LVAL_CELLS(x)[i]);
+		}
+	}
+
+	// branches were folded as code, which only 'if' makes them
+	if(is_if && lval_assumed_count() > n) { lval_assume(e, LVAL_CELLS(x)[0]); }
+
+	lval_list_rehash(x);
+	return x;
+}
+
+/* Optimizes code block [x] - a Q-Expression evaluated as a single S-Expression, like lambda body or branch of 'if'. */
+lval* lval_fold_block(lenv* e, lval* formals, lval* x) {
+	if(x->as.list.count == 0) { return x; }
+
+	x = lval_own(x);
+	x->type = LVAL_SEXPR;
+	x = lval_fold(e, formals, x);
+
+	// folded block still has to be evaluable by 'eval'
+	if(x->type != LVAL_SEXPR) {
+		return lval_add(lval_qexpr(), x);
+	}
+
+	x->type = LVAL_QEXPR;
+	return x;
+}
+
+lval* lval_fold(lenv* e, lval* formals, lval* x) {
+	if(x->type == LVAL_QEXPR) { return lval_fold_block(e, formals, x); }
+	if(x->type != LVAL_SEXPR || x->as.list.count == 0) { return x; }
+
+	x = lval_fold_macro(e, formals, x);
+	if(x->type != LVAL_SEXPR || x->as.list.count == 0) { return x; }
+
+	x = lval_fold_cells(e, formals, x);
+	x = lval_fold_call(e, formals, x);
+
+	// (c) evaluates to constant c itself
+	if(x->type == LVAL_SEXPR && x->as.list.count == 1
+			&& LVAL_CELLS(x)[0]->type != LVAL_QEXPR && lval_const(LVAL_CELLS(x)[0])) {
+		return lval_take(lval_own(x), 0);
+	}
+
+	return x;
+}
+
+lval* lval_optimize(lenv* e, lval* formals, lval* body, lval** assumed) {
+	// macros expanded on the way may define lambdas of their own
+	lval* outer = FOLD_ASSUMED;
+	FOLD_ASSUMED = NULL;
+	if(body->type == LVAL_QEXPR) { body = lval_fold_block(e, formals, body); }
+	*assumed = FOLD_ASSUMED;
+	FOLD_ASSUMED = outer;
+	return body;
+}
+
+lval* lval_lambda_assume(lval* f, lval* source, lval* assumed) {
+	if(!assumed) {
+		lval_del(source);
+		return f;
+	}
+	f->as.fun->source = source;
+	f->as.fun->assumed = assumed;
+	return f;
+}
+
+int lval_assumptions_hold(lenv* e, lval* f) {
+	lval* a = f->as.fun->assumed;
+	for(int i = 0; i < a->as.list.count; i += 2) {
+		lval* h = lenv_get(e, LVAL_CELLS(a)[i]);
+		lval* x = LVAL_CELLS(a)[i + 1];
+		int same = h == x || (h->type == LVAL_FUN && x->type == LVAL_FUN
+			&& x->as.fun->builtin && h->as.fun->builtin == x->as.fun->builtin
+			&& h->as.fun->special == x->as.fun->special);
+		lval_del(h);
+		if(!same) { return 0; }
+	}
+	return 1;
+}
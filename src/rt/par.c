@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include "lval.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define PAR_CHUNKS_PER_THREAD 4
+
+/*
+ * Parallel builtins share nothing between threads: every job evaluates its
+ * chunk on a private heap, working on clones of the function and the chunk
+ * elements. Values of the caller's environment are cloned only when the job
+ * first looks them up. Sources are only read while the calling thread waits
+ * for the batch to finish, and results are cloned back onto the caller's
+ * heap before the job heaps are dropped as a whole. This way reference
+ * counters are never modified concurrently.
+ */
+
+typedef struct {
+	lenv* 		env;		/* caller environment, read only */
+	lval* 		f;			/* mapped function, read only */
+	lval* 		list;		/* source Q-Expression, read only */
+	int 		from;
+	int 		to;
+	int 		reduce;
+	mem_heap* 	heap;		/* private heap of the job */
+	lval* 		result;		/* allocated on the job heap */
+} ljob;
+
+typedef struct {
+	pthread_mutex_t busy;	/* held by the thread running a batch */
+	pthread_mutex_t lock;
+	pthread_cond_t 	work;
+	pthread_cond_t 	done;
+	int 			size;	/* number of worker threads, caller thread excluded */
+	ljob* 			jobs;
+	int 			count;
+	int 			next;
+	int 			finished;
+} lpool;
+
+static lpool POOL;
+static pthread_once_t POOL_ONCE = PTHREAD_ONCE_INIT;
+static __thread int IN_JOB = 0;
+
+/* Mirrors environment chain of [e] with empty frames, which clone values of [e] as they are looked up. */
+lenv* lenv_share_chain(lenv* e) {
+	lenv* n = lenv_new();
+	n->src = e;
+	n->par = e->par ? lenv_share_chain(e->par) : NULL;
+	return n;
+}
+
+void lenv_del_chain(lenv* e) {
+	while(e) {
+		lenv* par = e->par;
+		lenv_del(e);
+		e = par;
+	}
+}
+
+/* Copies element [i] of the job list onto the job heap. Packed integers are boxed right there, the shared list is never changed. */
+lval* ljob_arg(ljob* j, int i) {
+	lval* l = j->list;
+	return l->as.list.ints ? lval_num(l->as.list.ints[i]) : lval_clone(l->as.list.cell[i]);
+}
+
+void ljob_run(ljob* j) {
+	mem_heap* caller = HEAP;
+	j->heap = heap_new();
+	HEAP = j->heap;
+	IN_JOB++;
+
+	lenv* env = lenv_share_chain(j->env);
+	lval* f = lval_clone(j->f);
+	lval* res;
+
+	if(j->reduce) {
+		res = ljob_arg(j, j->from);
+		for(int i = j->from + 1; i < j->to && res->type != LVAL_ERR; i++) {
+			lval* args = lval_add(lval_add(lval_sexpr(), res), ljob_arg(j, i));
+			res = lval_call(env, f, args);
+		}
+	} else {
+		res = lval_qexpr();
+		for(int i = j->from; i < j->to; i++) {
+			lval* r = lval_call(env, f, lval_add(lval_sexpr(), ljob_arg(j, i)));
+			if(r->type == LVAL_ERR) {
+				lval_del(res);
+				res = r;
+				break;
+			}
+			lval_add(res, r);
+		}
+	}
+
+	// the job heap is dropped while a channel or stream would still refer to it
+	if(res->type != LVAL_ERR && lval_thread_bound(res)) {
+		lval_del(res);
+		res = lval_err("Parallel job can't return a channel or stream.");
+	}
+
+	j->result = res;
+	lval_del(f);
+	lenv_del_chain(env);
+
+	IN_JOB--;
+	HEAP = caller;
+}
+
+/* Runs jobs of the current batch until there are none left. Must be called with pool lock held. */
+void lpool_drain(lpool* p) {
+	while(p->jobs && p->next < p->count) {
+		ljob* j = &p->jobs[p->next++];
+		pthread_mutex_unlock(&p->lock);
+		ljob_run(j);
+		pthread_mutex_lock(&p->lock);
+		if(++p->finished == p->count) {
+			pthread_cond_signal(&p->done);
+		}
+	}
+}
+
+void* lpool_worker(void* arg) {
+	lpool* p = (lpool*)arg;
+	pthread_mutex_lock(&p->lock);
+	while(1) {
+		while(!p->jobs || p->next >= p->count) {
+			pthread_cond_wait(&p->work, &p->lock);
+		}
+		lpool_drain(p);
+	}
+	return NULL;
+}
+
+void lpool_init(void) {
+	lpool* p = &POOL;
+	pthread_mutex_init(&p->busy, NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->jobs = NULL;
+
+	// pool is sized to the machine, unless overridden by QSP_THREADS
+	char* env = getenv("QSP_THREADS");
+	long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+	p->size = n > 1 ? (int)n - 1 : 0;
+
+	for(int i = 0; i < p->size; i++) {
+		pthread_t t;
+		if(pthread_create(&t, NULL, lpool_worker, p) != 0) {
+			p->size = i;
+			break;
+		}
+		pthread_detach(t);
+	}
+}
+
+/* Runs all jobs to completion. Caller thread takes part in running them. */
+void lpool_run(ljob* jobs, int count) {
+	lpool* p = &POOL;
+
+	// nested or concurrent batches are run in place
+	if(IN_JOB || pthread_mutex_trylock(&p->busy) != 0) {
+		for(int i = 0; i < count; i++) { ljob_run(&jobs[i]); }
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->jobs = jobs;
+	p->count = count;
+	p->next = 0;
+	p->finished = 0;
+	pthread_cond_broadcast(&p->work);
+
+	lpool_drain(p);
+	while(p->finished < p->count) {
+		pthread_cond_wait(&p->done, &p->lock);
+	}
+	p->jobs = NULL;
+	pthread_mutex_unlock(&p->lock);
+
+	pthread_mutex_unlock(&p->busy);
+}
+
+/* Splits list [l] into chunks evaluated in parallel. Returns NULL if it's not worth it and work should be done in place. */
+ljob* lpool_split(lenv* e, lval* f, lval* l, int reduce, int* count) {
+	pthread_once(&POOL_ONCE, lpool_init);
+
+	int n = l->as.list.count;
+	int chunks = (POOL.size + 1) * PAR_CHUNKS_PER_THREAD;
+	if(chunks > n) { chunks = n; }
+	if(POOL.size == 0 || IN_JOB || chunks < 2) { return NULL; }
+
+	ljob* jobs = (ljob*)malloc(sizeof(ljob) * chunks);
+	for(int i = 0; i < chunks; i++) {
+		jobs[i].env = e;
+		jobs[i].f = f;
+		jobs[i].list = l;
+		jobs[i].from = (int)((long)n * i / chunks);
+		jobs[i].to = (int)((long)n * (i + 1) / chunks);
+		jobs[i].reduce = reduce;
+		jobs[i].heap = NULL;
+		jobs[i].result = NULL;
+	}
+
+	lpool_run(jobs, chunks);
+	*count = chunks;
+	return jobs;
+}
+
+/* Moves job result onto the caller heap and releases the job heap. */
+lval* ljob_take(ljob* j) {
+	lval* r = lval_clone(j->result);
+
+	mem_heap* caller = HEAP;
+	HEAP = j->heap;
+	heap_del(j->heap);
+	HEAP = caller;
+
+	return r;
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+	LASSERT_NUM("pmap", a, 2);
+	LASSERT_TYPE("pmap", a, 0, LVAL_FUN);
+	LASSERT_TYPE("pmap", a, 1, LVAL_QEXPR);
+	LASSERT(a, !lval_thread_bound(a->as.list.cell[0]) && !lval_thread_bound(a->as.list.cell[1]),
+		"Function 'pmap' can't pass channels or streams to other threads.");
+
+	lval* f = a->as.list.cell[0];
+	lval* l = a->as.list.cell[1];
+	lval* res = lval_qexpr();
+
+	int count;
+	ljob* jobs = lpool_split(e, f, l, 0, &count);
+
+	if(!jobs) {
+		for(int i = 0; i < l->as.list.count; i++) {
+			lval* r = lval_call(e, f, lval_add(lval_sexpr(), lval_nth(l, i)));
+			if(r->type == LVAL_ERR) {
+				lval_del(res);
+				res = r;
+				break;
+			}
+			lval_add(res, r);
+		}
+		lval_del(a);
+		return res;
+	}
+
+	// reassemble chunks in order, first failed chunk determines the error
+	for(int i = 0; i < count; i++) {
+		lval* r = ljob_take(&jobs[i]);
+		if(res->type == LVAL_ERR) {
+			lval_del(r);
+		} else if(r->type == LVAL_ERR) {
+			lval_del(res);
+			res = r;
+		} else {
+			res = lval_join(res, r);
+		}
+	}
+
+	free(jobs);
+	lval_del(a);
+	return res;
+}
+
+lval* builtin_preduce(lenv* e, lval* a) {
+	LASSERT_NUM("preduce", a, 3);
+	LASSERT_TYPE("preduce", a, 0, LVAL_FUN);
+	LASSERT_TYPE("preduce", a, 2, LVAL_QEXPR);
+	LASSERT(a, !lval_thread_bound(a->as.list.cell[0]) && !lval_thread_bound(a->as.list.cell[2]),
+		"Function 'preduce' can't pass channels or streams to other threads.");
+
+	lval* f = a->as.list.cell[0];
+	lval* l = a->as.list.cell[2];
+	lval* acc = lval_cp(a->as.list.cell[1]);
+
+	// [f] is expected to be associative: chunks are folded independently
+	// and partial results are then folded onto the initial value in order
+	int count;
+	ljob* jobs = lpool_split(e, f, l, 1, &count);
+
+	if(!jobs) {
+		for(int i = 0; i < l->as.list.count && acc->type != LVAL_ERR; i++) {
+			lval* args = lval_add(lval_add(lval_sexpr(), acc), lval_nth(l, i));
+			acc = lval_call(e, f, args);
+		}
+		lval_del(a);
+		return acc;
+	}
+
+	for(int i = 0; i < count; i++) {
+		lval* r = ljob_take(&jobs[i]);
+		if(acc->type == LVAL_ERR) {
+			lval_del(r);
+		} else if(r->type == LVAL_ERR) {
+			lval_del(acc);
+			acc = r;
+		} else {
+			acc = lval_call(e, f, lval_add(lval_add(lval_sexpr(), acc), r));
+		}
+	}
+
+	free(jobs);
+	lval_del(a);
+	return acc;
+}
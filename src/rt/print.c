@@ -0,0 +1,238 @@
+#include "lval.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Printing renders lvalues into a growable buffer, reused by every print of
+ * the thread, which is then appended to the standard output buffer shared by
+ * all threads. Standard output is written with large 'write' calls once the
+ * shared buffer fills up, at exit, or at the end of every line when it's a
+ * terminal.
+ */
+
+/* Size of the shared output buffer, also the size at which rendered output is passed on while still rendering. */
+#define LOUT_SIZE (1 << 16)
+
+static char LOUT[LOUT_SIZE];
+static int LOUT_LEN = 0;
+static int LOUT_TTY = -1;
+static pthread_mutex_t LOUT_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread lbuf LOUT_BUF = { NULL, 0, 0, 1 };
+
+void lout_write_all(const char* s, int len) {
+	while(len > 0) {
+		ssize_t n = write(STDOUT_FILENO, s, len);
+		if(n < 0) { return; }
+		s += n;
+		len -= (int)n;
+	}
+}
+
+void lout_flush_locked(void) {
+	lout_write_all(LOUT, LOUT_LEN);
+	LOUT_LEN = 0;
+}
+
+void lout_flush(void) {
+	pthread_mutex_lock(&LOUT_LOCK);
+	lout_flush_locked();
+	pthread_mutex_unlock(&LOUT_LOCK);
+}
+
+void lout_write(const char* s, int len) {
+	pthread_mutex_lock(&LOUT_LOCK);
+	if(LOUT_TTY < 0) {
+		LOUT_TTY = isatty(STDOUT_FILENO);
+		atexit(lout_flush);
+	}
+
+	if(LOUT_LEN + len > LOUT_SIZE) { lout_flush_locked(); }
+	if(len >= LOUT_SIZE) {
+		lout_write_all(s, len);
+	} else {
+		memcpy(LOUT + LOUT_LEN, s, len);
+		LOUT_LEN += len;
+	}
+
+	// terminals get complete lines right away
+	if(LOUT_TTY && memchr(s, '\n', len)) { lout_flush_locked(); }
+	pthread_mutex_unlock(&LOUT_LOCK);
+}
+
+lbuf* lout_buf(void) {
+	LOUT_BUF.len = 0;
+	return &LOUT_BUF;
+}
+
+void lout_commit(lbuf* b) {
+	lout_write(b->data, b->len);
+	b->len = 0;
+}
+
+/* Makes room for [n] more bytes in [b]. */
+char* lbuf_reserve(lbuf* b, int n) {
+	// long output is passed on in parts instead of growing the buffer
+	if(b->out && b->len >= LOUT_SIZE) { lout_commit(b); }
+
+	if(b->len + n > b->cap) {
+		b->cap = b->cap ? b->cap : 256;
+		while(b->len + n > b->cap) { b->cap *= 2; }
+		b->data = (char*)realloc(b->data, b->cap);
+	}
+	return b->data + b->len;
+}
+
+void lbuf_put(lbuf* b, const char* s, int len) {
+	memcpy(lbuf_reserve(b, len), s, len);
+	b->len += len;
+}
+
+void lbuf_puts(lbuf* b, const char* s) {
+	lbuf_put(b, s, (int)strlen(s));
+}
+
+void lbuf_putc(lbuf* b, char c) {
+	*lbuf_reserve(b, 1) = c;
+	b->len++;
+}
+
+static const char DIGIT_PAIRS[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+void lbuf_put_long(lbuf* b, long x) {
+	char tmp[24];
+	char* p = tmp + sizeof(tmp);
+	unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+
+	// two digits at a time, from the end
+	while(u >= 100) {
+		int d = (int)(u % 100) * 2;
+		u /= 100;
+		*--p = DIGIT_PAIRS[d + 1];
+		*--p = DIGIT_PAIRS[d];
+	}
+	if(u >= 10) {
+		int d = (int)u * 2;
+		*--p = DIGIT_PAIRS[d + 1];
+		*--p = DIGIT_PAIRS[d];
+	} else {
+		*--p = (char)('0' + u);
+	}
+	if(x < 0) { *--p = '-'; }
+
+	lbuf_put(b, p, (int)(tmp + sizeof(tmp) - p));
+}
+
+/* Escape sequences of characters, same as used by the parser to read strings. */
+const char* lbuf_escape(char c) {
+	switch(c) {
+		case '\a': return "\\a";
+		case '\b': return "\\b";
+		case '\f': return "\\f";
+		case '\n': return "\\n";
+		case '\r': return "\\r";
+		case '\t': return "\\t";
+		case '\v': return "\\v";
+		case '\\': return "\\\\";
+		case '\'': return "\\'";
+		case '"': return "\\\"";
+		case '\0': return "\\0";
+		default: return NULL;
+	}
+}
+
+/* Writes escaped content of [s] right into the buffer, walking parts of the rope without flattening it. */
+void lbuf_put_escaped(lbuf* b, lstr* s) {
+	while(s->kind == LSTR_CAT) {
+		lbuf_put_escaped(b, s->left);
+		s = s->right;
+	}
+
+	char* out = lbuf_reserve(b, s->len * 2);
+	char* p = out;
+	for(int i = 0; i < s->len; i++) {
+		const char* esc = lbuf_escape(s->data[i]);
+		if(esc) {
+			*p++ = esc[0];
+			*p++ = esc[1];
+		} else {
+			*p++ = s->data[i];
+		}
+	}
+	b->len += (int)(p - out);
+}
+
+void lval_expr_render(lbuf* b, lval* v, char open, char close) {
+	lbuf_putc(b, open);
+
+	for(int i = 0; i < v->as.list.count; i++) {
+		if(v->as.list.ints) {
+			lbuf_put_long(b, v->as.list.ints[i]);
+		} else {
+			lval_render(b, v->as.list.cell[i]);
+		}
+		if(i != (v->as.list.count-1)){
+			lbuf_putc(b, ' ');
+		}
+	}
+
+	lbuf_putc(b, close);
+}
+
+void lval_render(lbuf* b, lval* v) {
+	switch (v->type) {
+		case LVAL_NUM: lbuf_put_long(b, v->as.num); break;
+		case LVAL_FLOAT: {
+			char buf[32];
+			lval_fmt_float(v->as.flt, buf);
+			lbuf_puts(b, buf);
+			break;
+		}
+		case LVAL_BIGNUM: {
+			char* s = lbig_to_str(v->as.big);
+			lbuf_puts(b, s);
+			free(s);
+			break;
+		}
+		case LVAL_STR:
+			lbuf_putc(b, '"');
+			lbuf_put_escaped(b, v->as.str);
+			lbuf_putc(b, '"');
+			break;
+		case LVAL_SYM: lbuf_puts(b, v->as.sym); break;
+		case LVAL_FUN: if(v->as.fun->builtin) {
+				lbuf_puts(b, "<builtin>");
+			} else {
+				lbuf_puts(b, "(\\");
+				lval_render(b, v->as.fun->formals);
+				lbuf_putc(b, ' ');
+				lval_render(b, LFUN_SOURCE(v->as.fun));
+				lbuf_putc(b, ')');
+			}
+			break;
+		case LVAL_QEXPR: lval_expr_render(b, v, '{', '}'); break;
+		case LVAL_SEXPR: lval_expr_render(b, v, '(', ')'); break;
+		case LVAL_ERR: lbuf_puts(b, "Error: "); lbuf_puts(b, v->as.err); break;
+		case LVAL_CHAN: lbuf_puts(b, "<channel>"); break;
+		case LVAL_STREAM: lbuf_puts(b, "<stream>"); break;
+		case LVAL_MAP: lmap_render(b, v->as.map); break;
+		case LVAL_I64VEC:
+		case LVAL_F64VEC: lvec_render(b, v); break;
+	}
+}
+
+void lval_print(lval* v) {
+	lbuf* b = lout_buf();
+	lval_render(b, v);
+	lout_commit(b);
+}
+
+void lval_println(lval* v) {
+	lbuf* b = lout_buf();
+	lval_render(b, v);
+	lbuf_putc(b, '\n');
+	lout_commit(b);
+}
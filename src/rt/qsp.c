@@ -0,0 +1,402 @@
+#include "qsp.h"
+#include "../proto/mpc.h"
+#include <errno.h>
+#include <ctype.h>
+
+struct qsp_vm {
+	mem_heap* 		heap;
+	lenv* 			env;
+
+	mpc_parser_t* 	Number;
+	mpc_parser_t* 	String;
+	mpc_parser_t* 	Symbol;
+	mpc_parser_t* 	Comment;
+	mpc_parser_t* 	Qexpr;
+	mpc_parser_t* 	Map;
+	mpc_parser_t* 	Sexpr;
+	mpc_parser_t* 	Expr;
+	mpc_parser_t* 	Qsp;
+};
+
+static __thread qsp_vm* QSP_VM = NULL;
+
+/* Top level evaluations in progress on the calling thread, 'load' nests them. */
+static __thread int QSP_DEPTH = 0;
+
+lval* lval_read_num_str(const char* s) {
+  // same syntax as number literals: -?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?
+  const char* p = s;
+  if (*p == '-') { p++; }
+  if (!isdigit((unsigned char)*p)) { return lval_err("invalid number"); }
+  while (isdigit((unsigned char)*p)) { p++; }
+  if (*p == '.') {
+    p++;
+    if (!isdigit((unsigned char)*p)) { return lval_err("invalid number"); }
+    while (isdigit((unsigned char)*p)) { p++; }
+  }
+  if (*p == 'e' || *p == 'E') {
+    p++;
+    if (*p == '-' || *p == '+') { p++; }
+    if (!isdigit((unsigned char)*p)) { return lval_err("invalid number"); }
+    while (isdigit((unsigned char)*p)) { p++; }
+  }
+  if (*p != '\0') { return lval_err("invalid number"); }
+
+  // out of range floats round the way arithmetic does, to inf or towards 0
+  if (strpbrk(s, ".eE")) { return lval_float(strtod(s, NULL)); }
+
+  // literals too large for a machine word are read as big integers
+  errno = 0;
+  long x = strtol(s, NULL, 10);
+  return errno != ERANGE ? lval_num(x) : lval_bignum(lbig_from_str(s));
+}
+
+lval* lval_read_num(mpc_ast_t* t) {
+  return lval_read_num_str(t->contents);
+}
+
+lval* lval_read_str(mpc_ast_t* t) {
+	t->contents[strlen(t->contents) - 1] = '\0'; // cut off final '"' character
+	char* unesc = (char*)malloc(strlen(t->contents)+1);
+	strcpy(unesc, t->contents+1);
+
+	unesc = mpcf_unescape(unesc);
+
+	lval* str = lval_str(unesc);
+
+	free(unesc);
+	return str;
+}
+
+/* Builds map literal from forms [l] read between '#{' and '}'. Like elements of a Q-Expression, keys and values aren't evaluated. */
+lval* lval_read_map(lval* l) {
+  if (l->as.list.count % 2 != 0) {
+    lval_del(l);
+    return lval_err("Map literal has a key without value.");
+  }
+
+  lmap* m = lmap_new();
+  for (int i = 0; i < l->as.list.count; i += 2) {
+    lmap* x = lmap_assoc(m, LVAL_CELLS(l)[i], LVAL_CELLS(l)[i + 1]);
+    lmap_del(m);
+    m = x;
+  }
+
+  lval_del(l);
+  return lval_map(m);
+}
+
+lval* lval_read(mpc_ast_t* t){
+  if (strstr(t->tag, "number")) { return lval_read_num(t); }
+  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+  if (strstr(t->tag, "string")) { return lval_read_str(t); }
+
+  lval* x = NULL;
+  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
+  else if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
+  else if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
+  else if (strstr(t->tag, "map")) { x = lval_sexpr(); }
+
+  for (int i = 0; i < t->children_num; ++i)
+  {
+	mpc_ast_t* child = t->children[i];
+
+    if (strcmp(child->contents, "(") == 0) { continue; }
+    if (strcmp(child->contents, ")") == 0) { continue; }
+    if (strcmp(child->contents, "}") == 0) { continue; }
+    if (strcmp(child->contents, "{") == 0) { continue; }
+    if (strcmp(child->contents, "#{") == 0) { continue; }
+    if (strcmp(child->tag,  "regex") == 0) { continue; }
+    if (strstr(child->tag, "comment")) { continue; }
+
+    lval* parsed = lval_read(child);
+    x = lval_add(x, parsed);
+  }
+
+  return strstr(t->tag, "map") ? lval_read_map(x) : x;
+}
+
+/* Converts parser result into a list of all top level forms or an error. */
+lval* qsp_read_result(int ok, mpc_result_t* r) {
+	if(ok) {
+		lval* expr = lval_read(r->output);
+		mpc_ast_delete(r->output);
+		return expr;
+	}
+
+	char* err_msg = mpc_err_string(r->error);
+	mpc_err_delete(r->error);
+
+	lval* err = lval_err("%s", err_msg);
+	free(err_msg);
+	return err;
+}
+
+/* Compacts the heap between top level forms, once it grew since the last time. Nothing but the heap itself
+ * may hold values without counting them then, so not while any green thread is suspended or any form nested. */
+static void qsp_safepoint(lenv* e) {
+	if(QSP_DEPTH > 0 || !QSP_VM || e != QSP_VM->env || HEAP != QSP_VM->heap) { return; }
+	if(!heap_compact_on() || green_alive() > 0) { return; }
+	if(HEAP->nslabs > HEAP->compacted) { heap_compact(HEAP, e); }
+}
+
+/* Evaluates all forms of [expr] one by one. If [errors] is given errors are printed, counted there and evaluation continues, otherwise first error is returned. */
+lval* qsp_eval_forms(lenv* e, lval* expr, int* errors) {
+	lval* last = lval_sexpr();
+
+	for(int i = 0; i < expr->as.list.count; i++) {
+		QSP_DEPTH++;
+		lval* x = lval_eval(e, lval_nth(expr, i));
+		green_run();
+		QSP_DEPTH--;
+		qsp_safepoint(e);
+		if(x->type == LVAL_ERR && errors) {
+			lval_println(x);
+			(*errors)++;
+		} else if(x->type == LVAL_ERR) {
+			lval_del(last);
+			lval_del(expr);
+			return x;
+		}
+		lval_del(last);
+		last = x;
+	}
+
+	lval_del(expr);
+	return last;
+}
+
+lval* builtin_load(lenv* e, lval* a) {
+	LASSERT_NUM("load", a, 1);
+	LASSERT_TYPE("load", a, 0, LVAL_STR);
+
+	// parse file given by string name
+	mpc_result_t r;
+	int ok = mpc_parse_contents(lstr_cstr(a->as.list.cell[0]->as.str), QSP_VM->Qsp, &r);
+	lval* expr = qsp_read_result(ok, &r);
+	lval_del(a);
+
+	if(expr->type == LVAL_ERR) {
+		lval* err = lval_err("Could not load library %s", expr->as.err);
+		lval_del(expr);
+		return err;
+	}
+
+	int errors = 0;
+	lval_del(qsp_eval_forms(e, expr, &errors));
+	return lval_sexpr();
+}
+
+qsp_vm* qsp_new(void) {
+	qsp_vm* vm = (qsp_vm*)malloc(sizeof(qsp_vm));
+
+	vm->Number 	= mpc_new("number");
+	vm->String 	= mpc_new("string");
+	vm->Symbol 	= mpc_new("symbol");
+	vm->Comment = mpc_new("comment");
+	vm->Qexpr 	= mpc_new("qexpr");
+	vm->Map 	= mpc_new("map");
+	vm->Sexpr 	= mpc_new("sexpr");
+	vm->Expr 	= mpc_new("expr");
+	vm->Qsp 	= mpc_new("qsp");
+
+	mpca_lang(MPC_LANG_DEFAULT,
+		  "                                              \
+		    number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
+		    symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+/ ; \
+		    string  : /\"(\\\\.|[^\"])*\"/ ;             \
+		    comment : /;[^\\r\\n]*/ ;                    \
+		    sexpr   : '(' <expr>* ')' ;                  \
+		    qexpr   : '{' <expr>* '}' ;                  \
+		    map     : \"#{\" <expr>* '}' ;               \
+		    expr    : <number>  | <symbol> | <string>    \
+		            | <comment> | <sexpr>  | <qexpr>     \
+		            | <map> ;                            \
+		    qsp  : /^/ <expr>* /$/ ;                     \
+		  ",
+		vm->Number, vm->String, vm->Comment, vm->Symbol, vm->Sexpr, vm->Qexpr, vm->Map, vm->Expr, vm->Qsp);
+
+	vm->heap = heap_new();
+	qsp_use(vm);
+
+	vm->env = lenv_new();
+	lenv_add_builtins(vm->env);
+	lenv_add_builtin(vm->env, "load", builtin_load);
+
+	return vm;
+}
+
+void qsp_del(qsp_vm* vm) {
+	qsp_use(vm);
+	lenv_del(vm->env);
+	heap_del(vm->heap);
+
+	mpc_cleanup(9, vm->Number, vm->String, vm->Comment, vm->Symbol,
+		vm->Sexpr, vm->Qexpr, vm->Map, vm->Expr, vm->Qsp);
+
+	free(vm);
+	QSP_VM = NULL;
+	HEAP = NULL;
+}
+
+void qsp_use(qsp_vm* vm) {
+	QSP_VM = vm;
+	HEAP = vm->heap;
+}
+
+qsp_vm* qsp_current(void) {
+	return QSP_VM;
+}
+
+void qsp_set_max_heap(qsp_vm* vm, long cells) {
+	vm->heap->max = cells < 0 ? 0 : cells;
+}
+
+lenv* qsp_env(qsp_vm* vm) {
+	return vm->env;
+}
+
+lval* qsp_read(qsp_vm* vm, const char* name, const char* src) {
+	qsp_use(vm);
+
+	mpc_result_t r;
+	int ok = mpc_parse(name, src, vm->Qsp, &r);
+	return qsp_read_result(ok, &r);
+}
+
+lval* qsp_eval(qsp_vm* vm, lval* x) {
+	qsp_use(vm);
+	QSP_DEPTH++;
+	x = lval_eval(vm->env, x);
+	green_run();
+	QSP_DEPTH--;
+	qsp_safepoint(vm->env);
+	return x;
+}
+
+lval* qsp_eval_string(qsp_vm* vm, const char* src) {
+	lval* expr = qsp_read(vm, "<string>", src);
+	if(expr->type == LVAL_ERR) { return expr; }
+
+	return qsp_eval_forms(vm->env, expr, NULL);
+}
+
+lval* qsp_eval_file(qsp_vm* vm, const char* path) {
+	qsp_use(vm);
+
+	mpc_result_t r;
+	int ok = mpc_parse_contents(path, vm->Qsp, &r);
+	lval* expr = qsp_read_result(ok, &r);
+	if(expr->type == LVAL_ERR) { return expr; }
+
+	return qsp_eval_forms(vm->env, expr, NULL);
+}
+
+int qsp_run_compiled(qsp_vm* vm, const qsp_source* srcs, int nsrcs, const ljit_native* natives, int nnatives) {
+	char* attached = (char*)calloc(nnatives + 1, 1);
+	int status = 0;
+
+	for(int s = 0; s < nsrcs && status == 0; s++) {
+		lval* expr = qsp_read(vm, srcs[s].name, srcs[s].src);
+		if(expr->type == LVAL_ERR) {
+			lval_println(expr);
+			lval_del(expr);
+			status = 1;
+			break;
+		}
+
+		int script = (s == nsrcs - 1);
+		for(int i = 0; i < expr->as.list.count && status == 0; i++) {
+			QSP_DEPTH++;
+			lval* x = lval_eval(vm->env, lval_nth(expr, i));
+			green_run();
+			QSP_DEPTH--;
+			qsp_safepoint(vm->env);
+			if(x->type == LVAL_ERR && script) {
+				lval_println(x);
+				status = 1;
+			} else if(x->type == LVAL_ERR) {
+				lval_print(x);
+			}
+			lval_del(x);
+
+			// natives wait until everything they call is defined
+			for(int k = 0; k < nnatives; k++) {
+				if(!attached[k]) { attached[k] = ljit_install(vm->env, &natives[k]); }
+			}
+		}
+		lval_del(expr);
+	}
+
+	free(attached);
+	return status;
+}
+
+/* Parses and evaluates top level forms of [src], printing errors. Returns number of errors. */
+int qsp_eval_chunk(qsp_vm* vm, const char* src) {
+	lval* expr = qsp_read(vm, "<stdin>", src);
+	if(expr->type == LVAL_ERR) {
+		lval_println(expr);
+		lval_del(expr);
+		return 1;
+	}
+
+	int errors = 0;
+	lval_del(qsp_eval_forms(vm->env, expr, &errors));
+	return errors;
+}
+
+int qsp_eval_stream(qsp_vm* vm, FILE* f) {
+	int errors = 0;
+	int cap = 4096, len = 0;
+	char* buf = (char*)malloc(cap);
+
+	// state of scanner splitting input into top level forms
+	int depth = 0, started = 0, in_str = 0, esc = 0, in_comment = 0;
+
+	int c;
+	while((c = getc(f)) != EOF) {
+		if(len + 1 >= cap) {
+			cap *= 2;
+			buf = (char*)realloc(buf, cap);
+		}
+		buf[len++] = (char)c;
+
+		int done = 0;
+		if(in_comment) {
+			in_comment = c != '\n';
+		} else if(in_str) {
+			if(esc) { esc = 0; }
+			else if(c == '\\') { esc = 1; }
+			else if(c == '"') { in_str = 0; done = depth == 0; }
+		} else {
+			switch(c) {
+				case ';': in_comment = 1; break;
+				case '"': in_str = 1; started = 1; break;
+				case '(': case '{': depth++; started = 1; break;
+				case ')': case '}': depth--; done = depth <= 0; break;
+				case ' ': case '\t': case '\r': case '\n':
+					done = depth == 0 && started;
+					// nothing but whitespace and comments so far, no need to keep it
+					if(!started) { len = 0; }
+					break;
+				default: started = 1; break;
+			}
+		}
+
+		if(done) {
+			buf[len] = '\0';
+			errors += qsp_eval_chunk(vm, buf);
+			len = 0;
+			depth = 0;
+			started = 0;
+		}
+	}
+
+	if(started) {
+		buf[len] = '\0';
+		errors += qsp_eval_chunk(vm, buf);
+	}
+	free(buf);
+	return errors;
+}
@@ -0,0 +1,63 @@
+#ifndef QSP_H
+#define QSP_H
+
+#include "lval.h"
+#include <stdio.h>
+
+/*
+ * Embedding API. Every interpreter instance owns its heap, parser and root
+ * environment, so independent instances can run side by side - one per
+ * thread. Calls taking a [qsp_vm] make it current for the calling thread;
+ * returned lvalues live on its heap and should be released with lval_del
+ * while it is still current.
+ */
+
+struct qsp_vm;
+typedef struct qsp_vm qsp_vm;
+
+/* Creates a new interpreter with all builtins defined and makes it current. */
+qsp_vm* qsp_new(void);
+
+/* Releases interpreter with all lvalues allocated on its heap. */
+void qsp_del(qsp_vm* vm);
+
+/* Makes [vm] current interpreter of the calling thread. */
+void qsp_use(qsp_vm* vm);
+
+/* Returns current interpreter of the calling thread. */
+qsp_vm* qsp_current(void);
+
+/* Limits heap of the interpreter to [cells] values, 0 for no limit. Evaluation past the limit fails with an error. */
+void qsp_set_max_heap(qsp_vm* vm, long cells);
+
+/* Root environment of the interpreter. */
+lenv* qsp_env(qsp_vm* vm);
+
+/* Parses [src] into an S-Expression of all top level forms or an error. [name] is used in error messages. */
+lval* qsp_read(qsp_vm* vm, const char* name, const char* src);
+
+/* Evaluates expression [x] in root environment. Takes ownership of [x]. */
+lval* qsp_eval(qsp_vm* vm, lval* x);
+
+/* Evaluates all forms of [src] in order. Returns result of the last one or the first error. */
+lval* qsp_eval_string(qsp_vm* vm, const char* src);
+
+/* Builtin 'load' - evaluates all forms of a file, printing errors as they occur. */
+lval* builtin_load(lenv* e, lval* a);
+
+/* Evaluates all forms of file [path] in order. Returns result of the last one or the first error. */
+lval* qsp_eval_file(qsp_vm* vm, const char* path);
+
+/* Source embedded into a program compiled by qspc. */
+typedef struct {
+	const char* name;
+	const char* src;
+} qsp_source;
+
+/* Runs a program compiled by qspc: all but the last of [srcs] are loaded like 'load', the last one like a script stopping at the first error. Natively compiled [natives] are attached to their lambdas as soon as these are defined. Returns exit status. */
+int qsp_run_compiled(qsp_vm* vm, const qsp_source* srcs, int nsrcs, const ljit_native* natives, int nnatives);
+
+/* Reads top level forms from [f] and evaluates each one as soon as it's complete, printing errors. Memory use doesn't grow with the length of input. Returns number of errors. */
+int qsp_eval_stream(qsp_vm* vm, FILE* f);
+
+#endif
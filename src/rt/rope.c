@@ -0,0 +1,286 @@
+#include "rope.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Strings up to this length are copied into a flat buffer rather than linked. */
+#define ROPE_LEAF_MAX 256
+
+unsigned int lstr_pow31(int n) {
+	unsigned int r = 1, b = 31;
+	while(n > 0) {
+		if(n & 1) { r *= b; }
+		b *= b;
+		n >>= 1;
+	}
+	return r;
+}
+
+unsigned int lstr_hash_bytes(const char* s, int len) {
+	unsigned int h = 0;
+	for(int i = 0; i < len; i++) {
+		h = 31 * h + (unsigned int)s[i];
+	}
+	return h;
+}
+
+lstr* lstr_alloc(int kind, int len) {
+	lstr* s = (lstr*)calloc(1, sizeof(lstr));
+	s->ref_count = 1;
+	s->kind = kind;
+	s->len = len;
+	return s;
+}
+
+lstr* lstr_new(const char* s, int len) {
+	lstr* x = lstr_alloc(LSTR_FLAT, len);
+	x->data = (char*)malloc(len + 1);
+	memcpy(x->data, s, len);
+	x->data[len] = '\0';
+	x->hash = lstr_hash_bytes(s, len);
+	x->pow = lstr_pow31(len);
+	return x;
+}
+
+lstr* lstr_from(const char* s) {
+	return lstr_new(s, (int)strlen(s));
+}
+
+lstr* lstr_map_file(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) { return NULL; }
+
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if(st.st_size > INT_MAX) {
+		close(fd);
+		errno = EFBIG;
+		return NULL;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return lstr_new("", 0);
+	}
+
+	char* data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) { return NULL; }
+
+	lstr* x = lstr_alloc(LSTR_MMAP, (int)st.st_size);
+	x->data = data;
+	x->hash = lstr_hash_bytes(data, x->len);
+	x->pow = lstr_pow31(x->len);
+	return x;
+}
+
+lstr* lstr_ref(lstr* s) {
+	s->ref_count++;
+	return s;
+}
+
+void lstr_del(lstr* s) {
+	if(--s->ref_count > 0) { return; }
+
+	switch(s->kind) {
+		case LSTR_FLAT: free(s->data); break;
+		case LSTR_SLICE: lstr_del(s->left); break;
+		case LSTR_CAT: lstr_del(s->left); lstr_del(s->right); break;
+		case LSTR_MMAP: munmap(s->data, s->len); break;
+	}
+	free(s->cstr);
+	free(s);
+}
+
+/* View into flat or mmap string [base]. */
+lstr* lstr_slice(lstr* base, int start, int len) {
+	lstr* x = lstr_alloc(LSTR_SLICE, len);
+	x->left = lstr_ref(base);
+	x->data = base->data + start;
+	x->hash = lstr_hash_bytes(x->data, len);
+	x->pow = lstr_pow31(len);
+	return x;
+}
+
+/* Links [l] and [r] without rebalancing. Takes ownership of both. */
+lstr* lstr_node(lstr* l, lstr* r) {
+	lstr* x = lstr_alloc(LSTR_CAT, l->len + r->len);
+	x->left = l;
+	x->right = r;
+	x->height = (l->height > r->height ? l->height : r->height) + 1;
+	x->hash = l->hash * r->pow + r->hash;
+	x->pow = l->pow * r->pow;
+	return x;
+}
+
+/* Concatenates [a] and [b] keeping the result height balanced, like joining two AVL trees. Takes ownership of both. */
+lstr* lstr_join(lstr* a, lstr* b) {
+	if(a->height > b->height + 1 && a->kind == LSTR_CAT) {
+		lstr* l = lstr_ref(a->left);
+		lstr* t = lstr_join(lstr_ref(a->right), b);
+		lstr_del(a);
+		if(t->height <= l->height + 1 || t->kind != LSTR_CAT) { return lstr_node(l, t); }
+
+		// right side grew too tall, rotate
+		lstr* tl = lstr_ref(t->left);
+		lstr* tr = lstr_ref(t->right);
+		lstr_del(t);
+		if(tr->height >= tl->height || tl->kind != LSTR_CAT) {
+			return lstr_node(lstr_node(l, tl), tr);
+		}
+		lstr* x = lstr_node(lstr_node(l, lstr_ref(tl->left)), lstr_node(lstr_ref(tl->right), tr));
+		lstr_del(tl);
+		return x;
+	}
+
+	if(b->height > a->height + 1 && b->kind == LSTR_CAT) {
+		lstr* r = lstr_ref(b->right);
+		lstr* t = lstr_join(a, lstr_ref(b->left));
+		lstr_del(b);
+		if(t->height <= r->height + 1 || t->kind != LSTR_CAT) { return lstr_node(t, r); }
+
+		lstr* tl = lstr_ref(t->left);
+		lstr* tr = lstr_ref(t->right);
+		lstr_del(t);
+		if(tl->height >= tr->height || tr->kind != LSTR_CAT) {
+			return lstr_node(tl, lstr_node(tr, r));
+		}
+		lstr* x = lstr_node(lstr_node(tl, lstr_ref(tr->left)), lstr_node(lstr_ref(tr->right), r));
+		lstr_del(tr);
+		return x;
+	}
+
+	return lstr_node(a, b);
+}
+
+void lstr_copy_to(lstr* s, char* buf) {
+	while(s->kind == LSTR_CAT) {
+		lstr_copy_to(s->left, buf);
+		buf += s->left->len;
+		s = s->right;
+	}
+	memcpy(buf, s->data, s->len);
+}
+
+lstr* lstr_clone(lstr* s) {
+	lstr* x = lstr_alloc(LSTR_FLAT, s->len);
+	x->data = (char*)malloc(x->len + 1);
+	lstr_copy_to(s, x->data);
+	x->data[x->len] = '\0';
+	x->hash = s->hash;
+	x->pow = s->pow;
+	return x;
+}
+
+/* Flat copy of [a] followed by [b]. */
+lstr* lstr_concat_flat(lstr* a, lstr* b) {
+	lstr* x = lstr_alloc(LSTR_FLAT, a->len + b->len);
+	x->data = (char*)malloc(x->len + 1);
+	lstr_copy_to(a, x->data);
+	lstr_copy_to(b, x->data + a->len);
+	x->data[x->len] = '\0';
+	x->hash = a->hash * b->pow + b->hash;
+	x->pow = a->pow * b->pow;
+	return x;
+}
+
+lstr* lstr_cat(lstr* a, lstr* b) {
+	if(b->len == 0) { return lstr_ref(a); }
+	if(a->len == 0) { return lstr_ref(b); }
+	if(a->len + b->len <= ROPE_LEAF_MAX) { return lstr_concat_flat(a, b); }
+
+	// appending short pieces one by one grows the last leaf instead of the tree
+	if(a->kind == LSTR_CAT && a->right->kind != LSTR_CAT && a->right->len + b->len <= ROPE_LEAF_MAX) {
+		return lstr_join(lstr_ref(a->left), lstr_concat_flat(a->right, b));
+	}
+
+	return lstr_join(lstr_ref(a), lstr_ref(b));
+}
+
+lstr* lstr_sub(lstr* s, int start, int len) {
+	if(start == 0 && len == s->len) { return lstr_ref(s); }
+	if(len <= 0) { return lstr_new("", 0); }
+
+	switch(s->kind) {
+		case LSTR_CAT: {
+			int ll = s->left->len;
+			if(start + len <= ll) { return lstr_sub(s->left, start, len); }
+			if(start >= ll) { return lstr_sub(s->right, start - ll, len); }
+
+			lstr* l = lstr_sub(s->left, start, ll - start);
+			lstr* r = lstr_sub(s->right, 0, start + len - ll);
+			lstr* x = lstr_cat(l, r);
+			lstr_del(l);
+			lstr_del(r);
+			return x;
+		}
+		case LSTR_SLICE:
+			// views into mapped files are never copied, however short
+			if(len <= ROPE_LEAF_MAX && s->left->kind != LSTR_MMAP) { return lstr_new(s->data + start, len); }
+			return lstr_slice(s->left, (int)(s->data - s->left->data) + start, len);
+		case LSTR_MMAP:
+			return lstr_slice(s, start, len);
+		default:
+			if(len <= ROPE_LEAF_MAX) { return lstr_new(s->data + start, len); }
+			return lstr_slice(s, start, len);
+	}
+}
+
+const char* lstr_cstr(lstr* s) {
+	if(s->kind == LSTR_FLAT) { return s->data; }
+
+	// views may point into the mapping, so it's never replaced
+	if(s->kind == LSTR_MMAP || (s->kind == LSTR_SLICE && s->left->kind == LSTR_MMAP)) {
+		if(!s->cstr) {
+			s->cstr = (char*)malloc(s->len + 1);
+			memcpy(s->cstr, s->data, s->len);
+			s->cstr[s->len] = '\0';
+		}
+		return s->cstr;
+	}
+
+	// replace the structure with a flat buffer, content stays the same
+	char* buf = (char*)malloc(s->len + 1);
+	lstr_copy_to(s, buf);
+	buf[s->len] = '\0';
+
+	if(s->kind == LSTR_CAT) { lstr_del(s->right); }
+	lstr_del(s->left);
+	s->kind = LSTR_FLAT;
+	s->data = buf;
+	s->left = NULL;
+	s->right = NULL;
+	s->height = 0;
+	return buf;
+}
+
+/* Returns contiguous content of [s], not necessarily NUL terminated. Only concatenations need to be flattened. */
+const char* lstr_data(lstr* s) {
+	return s->kind == LSTR_CAT ? lstr_cstr(s) : s->data;
+}
+
+int lstr_eq(lstr* a, lstr* b) {
+	if(a == b) { return 1; }
+	if(a->len != b->len || a->hash != b->hash) { return 0; }
+	return memcmp(lstr_data(a), lstr_data(b), a->len) == 0;
+}
+
+int lstr_find(lstr* s, lstr* needle, int from) {
+	const char* h = lstr_data(s);
+	const char* n = lstr_data(needle);
+	int nl = needle->len;
+
+	for(int i = from; i + nl <= s->len; i++) {
+		if(h[i] == n[0] || nl == 0) {
+			if(memcmp(h + i, n, nl) == 0) { return i; }
+		}
+	}
+	return -1;
+}
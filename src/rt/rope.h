@@ -0,0 +1,65 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+/*
+ * Immutable reference counted strings. A string is either a flat buffer, a
+ * view into part of another flat string or a concatenation of two strings
+ * kept height balanced, so appending to a long string costs O(log n) instead
+ * of copying it. Strings are flattened on demand when contiguous characters
+ * are needed. Functions below borrow their arguments and return a new
+ * reference, which must be released with lstr_del.
+ */
+
+struct lstr;
+typedef struct lstr lstr;
+
+enum {
+	LSTR_FLAT,
+	LSTR_SLICE,
+	LSTR_CAT,
+	LSTR_MMAP
+};
+
+struct lstr {
+	int 			ref_count;
+	int 			kind;
+	int 			len;
+	int 			height;
+	unsigned int 	hash;	/* same as hmap_str_h of the content */
+	unsigned int 	pow;	/* 31^len, used to combine hashes of concatenated strings */
+	char* 			data;	/* flat: NUL terminated buffer, slice: start of the view, mmap: mapped file */
+	lstr* 			left;	/* cat: left part, slice: viewed flat or mmap string */
+	lstr* 			right;	/* cat: right part */
+	char* 			cstr;	/* mmap and its slices: NUL terminated copy made by lstr_cstr */
+};
+
+/* Creates flat string from [len] bytes of [s]. */
+lstr* lstr_new(const char* s, int len);
+lstr* lstr_from(const char* s);
+
+/* Creates string of the whole content of file [path], mapped into memory rather than read. Substrings of it are views sharing the mapping, which is unmapped once no longer referenced. Returns NULL with errno set on failure. */
+lstr* lstr_map_file(const char* path);
+
+lstr* lstr_ref(lstr* s);
+void lstr_del(lstr* s);
+
+lstr* lstr_cat(lstr* a, lstr* b);
+
+/* Returns [len] bytes starting at [start]. Long substrings share memory with [s]. */
+lstr* lstr_sub(lstr* s, int start, int len);
+
+/* Creates flat copy of [s] without touching it in any way, not even its reference counter. */
+lstr* lstr_clone(lstr* s);
+
+/* Returns NUL terminated content of [s], flattening it first if needed. Mapped files and views into them are left as they are and return a copy, kept until [s] is released. */
+const char* lstr_cstr(lstr* s);
+
+/* Copies content of [s] into [buf] without flattening it. */
+void lstr_copy_to(lstr* s, char* buf);
+
+int lstr_eq(lstr* a, lstr* b);
+
+/* Returns position of [needle] in [s] at or after [from], or -1. */
+int lstr_find(lstr* s, lstr* needle, int from);
+
+#endif
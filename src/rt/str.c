@@ -0,0 +1,180 @@
+#include "lval.h"
+
+/*
+ * String builtins. Strings are ropes, so concatenation and substrings share
+ * memory with their arguments instead of copying them; searching flattens
+ * the searched string once and keeps it flat.
+ */
+
+lval* builtin_str_concat(lenv* e, lval* a) {
+	for(int i = 0; i < a->as.list.count; i++) { LASSERT_TYPE("str-concat", a, i, LVAL_STR); }
+
+	lstr* s = lstr_new("", 0);
+	for(int i = 0; i < a->as.list.count; i++) {
+		lstr* x = lstr_cat(s, a->as.list.cell[i]->as.str);
+		lstr_del(s);
+		s = x;
+	}
+
+	lval_del(a);
+	return lval_lstr(s);
+}
+
+lval* builtin_str_len(lenv* e, lval* a) {
+	LASSERT_NUM("str-len", a, 1);
+	LASSERT_TYPE("str-len", a, 0, LVAL_STR);
+
+	lval* x = lval_num(a->as.list.cell[0]->as.str->len);
+	lval_del(a);
+	return x;
+}
+
+lval* builtin_str_sub(lenv* e, lval* a) {
+	LASSERT_NUM("str-sub", a, 3);
+	LASSERT_TYPE("str-sub", a, 0, LVAL_STR);
+	LASSERT_TYPE("str-sub", a, 1, LVAL_NUM);
+	LASSERT_TYPE("str-sub", a, 2, LVAL_NUM);
+
+	lstr* s = a->as.list.cell[0]->as.str;
+	long start = a->as.list.cell[1]->as.num;
+	long len = a->as.list.cell[2]->as.num;
+	LASSERT(a, start >= 0 && len >= 0 && start + len <= s->len,
+		"Function 'str-sub' passed range %li..%li out of string of length %i.", start, start + len, s->len);
+
+	lval* x = lval_lstr(lstr_sub(s, (int)start, (int)len));
+	lval_del(a);
+	return x;
+}
+
+lval* builtin_str_find(lenv* e, lval* a) {
+	LASSERT_NUM("str-find", a, 2);
+	LASSERT_TYPE("str-find", a, 0, LVAL_STR);
+	LASSERT_TYPE("str-find", a, 1, LVAL_STR);
+
+	lval* x = lval_num(lstr_find(a->as.list.cell[0]->as.str, a->as.list.cell[1]->as.str, 0));
+	lval_del(a);
+	return x;
+}
+
+lval* builtin_str_split(lenv* e, lval* a) {
+	LASSERT_NUM("str-split", a, 2);
+	LASSERT_TYPE("str-split", a, 0, LVAL_STR);
+	LASSERT_TYPE("str-split", a, 1, LVAL_STR);
+
+	lstr* s = a->as.list.cell[0]->as.str;
+	lstr* sep = a->as.list.cell[1]->as.str;
+	LASSERT(a, sep->len > 0, "Function 'str-split' passed empty separator.");
+
+	lval* parts = lval_qexpr();
+	int start = 0, i;
+	while((i = lstr_find(s, sep, start)) >= 0) {
+		// long inputs would run past the heap reserve
+		if(HEAP->oom) {
+			lval_del(parts);
+			lval_del(a);
+			return heap_oom(HEAP);
+		}
+		parts = lval_add(parts, lval_lstr(lstr_sub(s, start, i - start)));
+		start = i + sep->len;
+	}
+	parts = lval_add(parts, lval_lstr(lstr_sub(s, start, s->len - start)));
+
+	lval_del(a);
+	return parts;
+}
+
+lval* builtin_str_replace(lenv* e, lval* a) {
+	LASSERT_NUM("str-replace", a, 3);
+	LASSERT_TYPE("str-replace", a, 0, LVAL_STR);
+	LASSERT_TYPE("str-replace", a, 1, LVAL_STR);
+	LASSERT_TYPE("str-replace", a, 2, LVAL_STR);
+
+	lstr* s = a->as.list.cell[0]->as.str;
+	lstr* from = a->as.list.cell[1]->as.str;
+	lstr* to = a->as.list.cell[2]->as.str;
+	LASSERT(a, from->len > 0, "Function 'str-replace' passed empty pattern.");
+
+	// result is built from slices of the original string and shared replacement
+	lstr* r = lstr_new("", 0);
+	int start = 0, i;
+	while((i = lstr_find(s, from, start)) >= 0) {
+		lstr* part = lstr_sub(s, start, i - start);
+		lstr* x = lstr_cat(r, part);
+		lstr* y = lstr_cat(x, to);
+		lstr_del(part);
+		lstr_del(x);
+		lstr_del(r);
+		r = y;
+		start = i + from->len;
+	}
+	lstr* rest = lstr_sub(s, start, s->len - start);
+	lstr* x = lstr_cat(r, rest);
+	lstr_del(rest);
+	lstr_del(r);
+
+	lval_del(a);
+	return lval_lstr(x);
+}
+
+lval* builtin_str_join(lenv* e, lval* a) {
+	LASSERT_NUM("str-join", a, 2);
+	LASSERT_TYPE("str-join", a, 0, LVAL_STR);
+	LASSERT_TYPE("str-join", a, 1, LVAL_QEXPR);
+
+	lval* l = a->as.list.cell[1];
+	for(int i = 0; i < l->as.list.count; i++) {
+		LASSERT(a, LVAL_CELLS(l)[i]->type == LVAL_STR,
+			"Function 'str-join' passed list with %s at position %i, expected String.",
+			ltype_name(LVAL_CELLS(l)[i]->type), i);
+	}
+
+	lstr* sep = a->as.list.cell[0]->as.str;
+	lstr* s = lstr_new("", 0);
+	for(int i = 0; i < l->as.list.count; i++) {
+		lstr* x = i > 0 ? lstr_cat(s, sep) : lstr_ref(s);
+		lstr* y = lstr_cat(x, LVAL_CELLS(l)[i]->as.str);
+		lstr_del(x);
+		lstr_del(s);
+		s = y;
+	}
+
+	lval_del(a);
+	return lval_lstr(s);
+}
+
+lval* builtin_str_to_num(lenv* e, lval* a) {
+	LASSERT_NUM("str->num", a, 1);
+	LASSERT_TYPE("str->num", a, 0, LVAL_STR);
+
+	lval* x = lval_read_num_str(lstr_cstr(a->as.list.cell[0]->as.str));
+	lval_del(a);
+	return x;
+}
+
+lval* builtin_num_to_str(lenv* e, lval* a) {
+	LASSERT_NUM("num->str", a, 1);
+	LASSERT_NUMERIC("num->str", a, 0);
+
+	lval* v = a->as.list.cell[0];
+	lval* x;
+	char buf[32];
+	switch(v->type) {
+		case LVAL_FLOAT:
+			lval_fmt_float(v->as.flt, buf);
+			x = lval_str(buf);
+			break;
+		case LVAL_BIGNUM: {
+			char* s = lbig_to_str(v->as.big);
+			x = lval_str(s);
+			free(s);
+			break;
+		}
+		default:
+			snprintf(buf, sizeof(buf), "%li", v->as.num);
+			x = lval_str(buf);
+			break;
+	}
+
+	lval_del(a);
+	return x;
+}
@@ -0,0 +1,332 @@
+#include "lval.h"
+#include "hmap.h"
+#include <limits.h>
+
+/*
+ * Streams produce values one at a time on request, so data larger than the
+ * heap, like lines of a big file, can be processed without ever holding all
+ * of it. Every value is released before the next one is produced, unless
+ * the consumer keeps it.
+ */
+
+lstream* lstream_new(lval* (*next)(lenv*, lstream*), void (*release)(lstream*), void* state) {
+	lstream* s = (lstream*)malloc(sizeof(lstream));
+	s->ref_count = 1;
+	s->next = next;
+	s->release = release;
+	s->state = state;
+	return s;
+}
+
+lstream* lstream_cp(lstream* s) {
+	s->ref_count++;
+	return s;
+}
+
+void lstream_del(lstream* s) {
+	if(--s->ref_count > 0) { return; }
+	if(s->release) { s->release(s); }
+	free(s);
+}
+
+/* Create a new stream type lval. Takes ownership of [s] */
+lval* lval_stream(lstream* s) {
+	lval* v = lval_new();
+	v->type = LVAL_STREAM;
+	v->hash = hmap_int_h((int)(long)s);
+	v->as.stream = s;
+	return v;
+}
+
+lval* lstream_fold(lenv* e, lstream* s, lval* f, lval* init) {
+	lval* acc = init;
+	lval* x;
+	while(acc->type != LVAL_ERR && (x = s->next(e, s))) {
+		if(x->type == LVAL_ERR) {
+			lval_del(acc);
+			return x;
+		}
+		acc = lval_call(e, f, lval_add(lval_add(lval_sexpr(), acc), x));
+	}
+	return acc;
+}
+
+lval* builtin_next(lenv* e, lval* a) {
+	LASSERT_NUM("next", a, 1);
+	LASSERT_TYPE("next", a, 0, LVAL_STREAM);
+
+	lstream* s = a->as.list.cell[0]->as.stream;
+	lval* x = s->next(e, s);
+	lval_del(a);
+
+	if(!x) { return lval_qexpr(); }
+	if(x->type == LVAL_ERR) { return x; }
+	return lval_add(lval_qexpr(), x);
+}
+
+/*
+ * Lazy sequences are streams wrapping other streams. Every operator pulls
+ * values from its source only as they're requested, so a pipeline runs as a
+ * single loop over its source without building intermediate lists, and stops
+ * pulling as soon as its consumer is done. Q-Expressions are accepted as
+ * sources too.
+ */
+
+typedef struct {
+	long 	cur;
+	long 	end;
+	long 	step;
+	int 	bounded;
+} lrange;
+
+lval* lrange_next(lenv* e, lstream* s) {
+	lrange* r = (lrange*)s->state;
+	if(r->bounded && (r->step > 0 ? r->cur >= r->end : r->cur <= r->end)) { return NULL; }
+
+	lval* x = lval_num(r->cur);
+	// stepping past machine word range ends the sequence
+	if(__builtin_add_overflow(r->cur, r->step, &r->cur)) {
+		r->bounded = 1;
+		r->end = r->cur = r->step > 0 ? LONG_MAX : LONG_MIN;
+	}
+	return x;
+}
+
+void lstate_free(lstream* s) {
+	free(s->state);
+}
+
+/* Source and function of an operator, shared by lazy-map, lazy-filter and iterate. */
+typedef struct {
+	lstream* 	src;
+	lval* 		f;
+	lval* 		x;		/* iterate: next value */
+	long 		n;		/* lazy-take: values left */
+} lop;
+
+lop* lop_new(lstream* src, lval* f) {
+	lop* o = (lop*)calloc(1, sizeof(lop));
+	o->src = src;
+	o->f = f;
+	return o;
+}
+
+void lop_free(lstream* s) {
+	lop* o = (lop*)s->state;
+	if(o->src) { lstream_del(o->src); }
+	if(o->f) { lval_del(o->f); }
+	if(o->x) { lval_del(o->x); }
+	free(o);
+}
+
+lval* lop_call(lenv* e, lval* f, lval* x) {
+	return lval_call(e, f, lval_add(lval_sexpr(), x));
+}
+
+lval* lmap_next(lenv* e, lstream* s) {
+	lop* o = (lop*)s->state;
+	lval* x = o->src->next(e, o->src);
+	if(!x || x->type == LVAL_ERR) { return x; }
+	return lop_call(e, o->f, x);
+}
+
+lval* lfilter_next(lenv* e, lstream* s) {
+	lop* o = (lop*)s->state;
+	lval* x;
+	while((x = o->src->next(e, o->src)) && x->type != LVAL_ERR) {
+		lval* keep = lop_call(e, o->f, lval_cp(x));
+		if(keep->type == LVAL_ERR) {
+			lval_del(x);
+			return keep;
+		}
+		if(keep->type != LVAL_NUM) {
+			lval* err = lval_err("Function 'lazy-filter' predicate returned %s, expected %s.",
+				ltype_name(keep->type), ltype_name(LVAL_NUM));
+			lval_del(keep);
+			lval_del(x);
+			return err;
+		}
+
+		int hit = keep->as.num != 0;
+		lval_del(keep);
+		if(hit) { return x; }
+		lval_del(x);
+	}
+	return x;
+}
+
+lval* ltake_next(lenv* e, lstream* s) {
+	lop* o = (lop*)s->state;
+	if(o->n <= 0) { return NULL; }
+	o->n--;
+	return o->src->next(e, o->src);
+}
+
+lval* literate_next(lenv* e, lstream* s) {
+	lop* o = (lop*)s->state;
+	if(o->x->type == LVAL_ERR) { return lval_cp(o->x); }
+
+	lval* x = o->x;
+	o->x = lop_call(e, o->f, lval_cp(x));
+	return x;
+}
+
+typedef struct {
+	lval* 	list;
+	int 	at;
+} llist_iter;
+
+lval* llist_next(lenv* e, lstream* s) {
+	llist_iter* l = (llist_iter*)s->state;
+	if(l->at >= l->list->as.list.count) { return NULL; }
+	return lval_nth(l->list, l->at++);
+}
+
+void llist_free(lstream* s) {
+	llist_iter* l = (llist_iter*)s->state;
+	lval_del(l->list);
+	free(l);
+}
+
+lstream* lval_to_stream(lval* v) {
+	if(v->type == LVAL_STREAM) { return lstream_cp(v->as.stream); }
+
+	llist_iter* l = (llist_iter*)malloc(sizeof(llist_iter));
+	l->list = lval_cp(v);
+	l->at = 0;
+	return lstream_new(llist_next, llist_free, l);
+}
+
+#define LASSERT_SEQ(func, args, index) 													\
+	LASSERT(args, (args->as.list.cell[index]->type == LVAL_STREAM || args->as.list.cell[index]->type == LVAL_QEXPR), \
+		"Function '%s' passed incorrect type for argument %i. Got %s, expected Stream or Q-Expression.",	\
+		func, index, ltype_name(args->as.list.cell[index]->type))
+
+lval* builtin_range(lenv* e, lval* a) {
+	LASSERT(a, a->as.list.count >= 1 && a->as.list.count <= 3,
+		"Function 'range' passed incorrect number of arguments. Got %i, expected 1 to 3.", a->as.list.count);
+	for(int i = 0; i < a->as.list.count; i++) { LASSERT_TYPE("range", a, i, LVAL_NUM); }
+
+	lrange* r = (lrange*)malloc(sizeof(lrange));
+	r->cur = a->as.list.cell[0]->as.num;
+	r->bounded = a->as.list.count >= 2;
+	r->end = r->bounded ? a->as.list.cell[1]->as.num : 0;
+	r->step = a->as.list.count == 3 ? a->as.list.cell[2]->as.num : 1;
+	if(r->step == 0) {
+		free(r);
+		LASSERT(a, 0, "Function 'range' passed step 0.");
+	}
+
+	lval_del(a);
+	return lval_stream(lstream_new(lrange_next, lstate_free, r));
+}
+
+lval* builtin_iterate(lenv* e, lval* a) {
+	LASSERT_NUM("iterate", a, 2);
+	LASSERT_TYPE("iterate", a, 0, LVAL_FUN);
+
+	lop* o = lop_new(NULL, lval_cp(a->as.list.cell[0]));
+	o->x = lval_cp(a->as.list.cell[1]);
+	lval_del(a);
+	return lval_stream(lstream_new(literate_next, lop_free, o));
+}
+
+lval* builtin_lazy_map(lenv* e, lval* a) {
+	LASSERT_NUM("lazy-map", a, 2);
+	LASSERT_TYPE("lazy-map", a, 0, LVAL_FUN);
+	LASSERT_SEQ("lazy-map", a, 1);
+
+	lop* o = lop_new(lval_to_stream(a->as.list.cell[1]), lval_cp(a->as.list.cell[0]));
+	lval_del(a);
+	return lval_stream(lstream_new(lmap_next, lop_free, o));
+}
+
+lval* builtin_lazy_filter(lenv* e, lval* a) {
+	LASSERT_NUM("lazy-filter", a, 2);
+	LASSERT_TYPE("lazy-filter", a, 0, LVAL_FUN);
+	LASSERT_SEQ("lazy-filter", a, 1);
+
+	lop* o = lop_new(lval_to_stream(a->as.list.cell[1]), lval_cp(a->as.list.cell[0]));
+	lval_del(a);
+	return lval_stream(lstream_new(lfilter_next, lop_free, o));
+}
+
+lval* builtin_lazy_take(lenv* e, lval* a) {
+	LASSERT_NUM("lazy-take", a, 2);
+	LASSERT_TYPE("lazy-take", a, 0, LVAL_NUM);
+	LASSERT_SEQ("lazy-take", a, 1);
+
+	lop* o = lop_new(lval_to_stream(a->as.list.cell[1]), NULL);
+	o->n = a->as.list.cell[0]->as.num;
+	lval_del(a);
+	return lval_stream(lstream_new(ltake_next, lop_free, o));
+}
+
+lval* builtin_collect(lenv* e, lval* a) {
+	LASSERT_NUM("collect", a, 1);
+	LASSERT_SEQ("collect", a, 0);
+
+	lstream* s = lval_to_stream(a->as.list.cell[0]);
+	lval_del(a);
+
+	// integers are packed while nothing else shows up, so long sequences of them don't fill the heap
+	int cap = 16;
+	int n = 0;
+	long* ints = (long*)malloc(sizeof(long) * cap);
+	lval** cells = NULL;
+	lval* x;
+	while((x = s->next(e, s))) {
+		if(x->type == LVAL_ERR) {
+			for(int i = 0; cells && i < n; i++) { lval_del(cells[i]); }
+			free(cells);
+			free(ints);
+			lstream_del(s);
+			return x;
+		}
+
+		if(n == cap) {
+			cap *= 2;
+			if(ints) { ints = (long*)realloc(ints, sizeof(long) * cap); }
+			else { cells = (lval**)realloc(cells, sizeof(lval*) * cap); }
+		}
+
+		if(ints && x->type != LVAL_NUM) {
+			cells = (lval**)malloc(sizeof(lval*) * cap);
+			for(int i = 0; i < n; i++) { cells[i] = lval_num(ints[i]); }
+			free(ints);
+			ints = NULL;
+		}
+
+		if(ints) {
+			ints[n++] = x->as.num;
+			lval_del(x);
+		} else {
+			cells[n++] = x;
+		}
+	}
+	lstream_del(s);
+
+	lval* l = lval_qexpr();
+	l->as.list.count = n;
+	if(n == 0) {
+		free(ints);
+	} else if(ints) {
+		l->as.list.ints = ints;
+	} else {
+		l->as.list.cell = cells;
+	}
+	lval_list_rehash(l);
+	return l;
+}
+
+lval* builtin_fold_stream(lenv* e, lval* a) {
+	LASSERT_NUM("fold-stream", a, 3);
+	LASSERT_TYPE("fold-stream", a, 0, LVAL_FUN);
+	LASSERT_SEQ("fold-stream", a, 2);
+
+	lstream* s = lval_to_stream(a->as.list.cell[2]);
+	lval* r = lstream_fold(e, s, a->as.list.cell[0], lval_cp(a->as.list.cell[1]));
+	lstream_del(s);
+	lval_del(a);
+	return r;
+}
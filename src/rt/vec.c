@@ -0,0 +1,714 @@
+#include "lval.h"
+#include <limits.h>
+
+/*
+ * Typed vectors keep machine integers or floats in one contiguous array
+ * instead of a cell per element, so numeric reductions and elementwise
+ * arithmetic run as tight loops over memory. Vectors are immutable and
+ * shared by reference like maps. Hot loops have AVX2 versions picked at
+ * runtime when the CPU supports them, with portable scalar loops otherwise.
+ *
+ * Integer kernels report overflow instead of wrapping around: reductions then
+ * fall back to big integers, elementwise arithmetic fails with an error since
+ * its result must stay a vector of machine words. Float reductions sum in
+ * several lanes at once, so their rounding may differ from a left fold.
+ */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LVEC_AVX2 1
+#endif
+
+struct lvec {
+	int 			ref_count;
+	int 			count;
+	unsigned int 	hash;
+	union {
+		long* 		i;
+		double* 	f;
+	} data;
+};
+
+/* Kernels. Operands of elementwise kernels are broadcast when their stride is 0. */
+typedef struct {
+	int 	(*sum_i64)(const long* x, int n, long* r);		/* returns 1 on overflow */
+	double 	(*sum_f64)(const double* x, int n);
+	double 	(*dot_f64)(const double* x, const double* y, int n);
+	long 	(*min_i64)(const long* x, int n);
+	long 	(*max_i64)(const long* x, int n);
+	double 	(*min_f64)(const double* x, int n);
+	double 	(*max_f64)(const double* x, int n);
+	int 	(*add_i64)(const long* x, int xs, const long* y, int ys, long* r, int n);
+	int 	(*sub_i64)(const long* x, int xs, const long* y, int ys, long* r, int n);
+	void 	(*add_f64)(const double* x, int xs, const double* y, int ys, double* r, int n);
+	void 	(*sub_f64)(const double* x, int xs, const double* y, int ys, double* r, int n);
+	void 	(*mul_f64)(const double* x, int xs, const double* y, int ys, double* r, int n);
+	void 	(*div_f64)(const double* x, int xs, const double* y, int ys, double* r, int n);
+} lvec_kernels;
+
+/* Scalar kernels */
+
+int lvec_sum_i64(const long* x, int n, long* r) {
+	long s = 0;
+	for(int i = 0; i < n; i++) {
+		if(__builtin_add_overflow(s, x[i], &s)) { return 1; }
+	}
+	*r = s;
+	return 0;
+}
+
+double lvec_sum_f64(const double* x, int n) {
+	double s = 0;
+	for(int i = 0; i < n; i++) { s += x[i]; }
+	return s;
+}
+
+double lvec_dot_f64(const double* x, const double* y, int n) {
+	double s = 0;
+	for(int i = 0; i < n; i++) { s += x[i] * y[i]; }
+	return s;
+}
+
+#define LVEC_SCALAR_EXTREME(name, type, cmp)			\
+	type name(const type* x, int n) {					\
+		type m = x[0];									\
+		for(int i = 1; i < n; i++) {					\
+			if(x[i] cmp m) { m = x[i]; }				\
+		}												\
+		return m;										\
+	}
+
+LVEC_SCALAR_EXTREME(lvec_min_i64, long, <)
+LVEC_SCALAR_EXTREME(lvec_max_i64, long, >)
+LVEC_SCALAR_EXTREME(lvec_min_f64, double, <)
+LVEC_SCALAR_EXTREME(lvec_max_f64, double, >)
+
+#define LVEC_SCALAR_INT_OP(name, builtin)										\
+	int name(const long* x, int xs, const long* y, int ys, long* r, int n) {	\
+		for(int i = 0; i < n; i++) {											\
+			if(builtin(x[i * xs], y[i * ys], &r[i])) { return 1; }				\
+		}																		\
+		return 0;																\
+	}
+
+LVEC_SCALAR_INT_OP(lvec_add_i64, __builtin_add_overflow)
+LVEC_SCALAR_INT_OP(lvec_sub_i64, __builtin_sub_overflow)
+LVEC_SCALAR_INT_OP(lvec_mul_i64, __builtin_mul_overflow)
+
+#define LVEC_SCALAR_FLOAT_OP(name, op)												\
+	void name(const double* x, int xs, const double* y, int ys, double* r, int n) {	\
+		for(int i = 0; i < n; i++) { r[i] = x[i * xs] op y[i * ys]; }				\
+	}
+
+LVEC_SCALAR_FLOAT_OP(lvec_add_f64, +)
+LVEC_SCALAR_FLOAT_OP(lvec_sub_f64, -)
+LVEC_SCALAR_FLOAT_OP(lvec_mul_f64, *)
+LVEC_SCALAR_FLOAT_OP(lvec_div_f64, /)
+
+static const lvec_kernels LVEC_SCALAR = {
+	lvec_sum_i64, lvec_sum_f64, lvec_dot_f64,
+	lvec_min_i64, lvec_max_i64, lvec_min_f64, lvec_max_f64,
+	lvec_add_i64, lvec_sub_i64,
+	lvec_add_f64, lvec_sub_f64, lvec_mul_f64, lvec_div_f64
+};
+
+#ifdef LVEC_AVX2
+
+/* AVX2 kernels, processing 4 elements at a time and finishing the rest with scalar code */
+
+#define LVEC_AVX2_FN __attribute__((target("avx2")))
+
+/* Sign bit of every lane is set if adding [a] and [b] into [r] overflowed. */
+#define LVEC_OVERFLOW_ADD(a, b, r) _mm256_and_si256(_mm256_xor_si256(a, r), _mm256_xor_si256(b, r))
+#define LVEC_OVERFLOW_SUB(a, b, r) _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, r))
+#define LVEC_ANY_SIGN(v) _mm256_movemask_pd(_mm256_castsi256_pd(v))
+
+LVEC_AVX2_FN int lvec_sum_i64_avx2(const long* x, int n, long* r) {
+	__m256i acc = _mm256_setzero_si256();
+	__m256i ovf = _mm256_setzero_si256();
+	int i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+		__m256i s = _mm256_add_epi64(acc, v);
+		ovf = _mm256_or_si256(ovf, LVEC_OVERFLOW_ADD(acc, v, s));
+		acc = s;
+	}
+	// a lane overflowing doesn't mean the total does, callers redo the sum exactly
+	if(LVEC_ANY_SIGN(ovf)) { return 1; }
+
+	long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	long s = 0;
+	for(int k = 0; k < 4; k++) {
+		if(__builtin_add_overflow(s, lanes[k], &s)) { return 1; }
+	}
+	for(; i < n; i++) {
+		if(__builtin_add_overflow(s, x[i], &s)) { return 1; }
+	}
+	*r = s;
+	return 0;
+}
+
+LVEC_AVX2_FN double lvec_hsum_avx2(__m256d v) {
+	double lanes[4];
+	_mm256_storeu_pd(lanes, v);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+LVEC_AVX2_FN double lvec_sum_f64_avx2(const double* x, int n) {
+	// two accumulators hide latency of dependent additions
+	__m256d a = _mm256_setzero_pd();
+	__m256d b = _mm256_setzero_pd();
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		a = _mm256_add_pd(a, _mm256_loadu_pd(x + i));
+		b = _mm256_add_pd(b, _mm256_loadu_pd(x + i + 4));
+	}
+	for(; i + 4 <= n; i += 4) { a = _mm256_add_pd(a, _mm256_loadu_pd(x + i)); }
+
+	double s = lvec_hsum_avx2(_mm256_add_pd(a, b));
+	for(; i < n; i++) { s += x[i]; }
+	return s;
+}
+
+LVEC_AVX2_FN double lvec_dot_f64_avx2(const double* x, const double* y, int n) {
+	__m256d a = _mm256_setzero_pd();
+	__m256d b = _mm256_setzero_pd();
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+		b = _mm256_add_pd(b, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+	}
+	for(; i + 4 <= n; i += 4) {
+		a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+	}
+
+	double s = lvec_hsum_avx2(_mm256_add_pd(a, b));
+	for(; i < n; i++) { s += x[i] * y[i]; }
+	return s;
+}
+
+/* Blend mask [pick] selects lanes of v holding a new extreme over m. */
+#define LVEC_AVX2_EXTREME_I64(name, pick, scalar)								\
+	LVEC_AVX2_FN long name(const long* x, int n) {								\
+		if(n < 4) { return scalar(x, n); }										\
+		__m256i m = _mm256_loadu_si256((const __m256i*)x);						\
+		int i = 4;																\
+		for(; i + 4 <= n; i += 4) {												\
+			__m256i v = _mm256_loadu_si256((const __m256i*)(x + i));			\
+			m = _mm256_blendv_epi8(m, v, pick);									\
+		}																		\
+		long lanes[4];															\
+		_mm256_storeu_si256((__m256i*)lanes, m);								\
+		long r = scalar(lanes, 4);												\
+		long rest = i < n ? scalar(x + i, n - i) : r;							\
+		return scalar((long[]){ r, rest }, 2);									\
+	}
+
+LVEC_AVX2_EXTREME_I64(lvec_min_i64_avx2, _mm256_cmpgt_epi64(m, v), lvec_min_i64)
+LVEC_AVX2_EXTREME_I64(lvec_max_i64_avx2, _mm256_cmpgt_epi64(v, m), lvec_max_i64)
+
+#define LVEC_AVX2_EXTREME_F64(name, intrinsic, scalar)							\
+	LVEC_AVX2_FN double name(const double* x, int n) {							\
+		if(n < 4) { return scalar(x, n); }										\
+		__m256d m = _mm256_loadu_pd(x);											\
+		int i = 4;																\
+		for(; i + 4 <= n; i += 4) { m = intrinsic(m, _mm256_loadu_pd(x + i)); }	\
+		double lanes[4];														\
+		_mm256_storeu_pd(lanes, m);												\
+		double r = scalar(lanes, 4);											\
+		double rest = i < n ? scalar(x + i, n - i) : r;							\
+		return scalar((double[]){ r, rest }, 2);								\
+	}
+
+LVEC_AVX2_EXTREME_F64(lvec_min_f64_avx2, _mm256_min_pd, lvec_min_f64)
+LVEC_AVX2_EXTREME_F64(lvec_max_f64_avx2, _mm256_max_pd, lvec_max_f64)
+
+/* Loads 4 elements of an operand at [i], or its single element broadcast when its stride is 0. */
+#define LVEC_LOAD_I64(p, s, i) ((s) ? _mm256_loadu_si256((const __m256i*)((p) + (i))) : _mm256_set1_epi64x(*(p)))
+#define LVEC_LOAD_F64(p, s, i) ((s) ? _mm256_loadu_pd((p) + (i)) : _mm256_set1_pd(*(p)))
+
+#define LVEC_AVX2_INT_OP(name, intrinsic, overflow, scalar)							\
+	LVEC_AVX2_FN int name(const long* x, int xs, const long* y, int ys, long* r, int n) { \
+		__m256i ovf = _mm256_setzero_si256();										\
+		int i = 0;																	\
+		for(; i + 4 <= n; i += 4) {													\
+			__m256i a = LVEC_LOAD_I64(x, xs, i);									\
+			__m256i b = LVEC_LOAD_I64(y, ys, i);									\
+			__m256i v = intrinsic(a, b);											\
+			ovf = _mm256_or_si256(ovf, overflow(a, b, v));							\
+			_mm256_storeu_si256((__m256i*)(r + i), v);								\
+		}																			\
+		if(LVEC_ANY_SIGN(ovf)) { return 1; }										\
+		return scalar(x + i * xs, xs, y + i * ys, ys, r + i, n - i);				\
+	}
+
+LVEC_AVX2_INT_OP(lvec_add_i64_avx2, _mm256_add_epi64, LVEC_OVERFLOW_ADD, lvec_add_i64)
+LVEC_AVX2_INT_OP(lvec_sub_i64_avx2, _mm256_sub_epi64, LVEC_OVERFLOW_SUB, lvec_sub_i64)
+
+#define LVEC_AVX2_FLOAT_OP(name, intrinsic, scalar)										\
+	LVEC_AVX2_FN void name(const double* x, int xs, const double* y, int ys, double* r, int n) { \
+		int i = 0;																		\
+		for(; i + 4 <= n; i += 4) {														\
+			_mm256_storeu_pd(r + i, intrinsic(LVEC_LOAD_F64(x, xs, i), LVEC_LOAD_F64(y, ys, i))); \
+		}																				\
+		scalar(x + i * xs, xs, y + i * ys, ys, r + i, n - i);							\
+	}
+
+LVEC_AVX2_FLOAT_OP(lvec_add_f64_avx2, _mm256_add_pd, lvec_add_f64)
+LVEC_AVX2_FLOAT_OP(lvec_sub_f64_avx2, _mm256_sub_pd, lvec_sub_f64)
+LVEC_AVX2_FLOAT_OP(lvec_mul_f64_avx2, _mm256_mul_pd, lvec_mul_f64)
+LVEC_AVX2_FLOAT_OP(lvec_div_f64_avx2, _mm256_div_pd, lvec_div_f64)
+
+static const lvec_kernels LVEC_AVX2_KERNELS = {
+	lvec_sum_i64_avx2, lvec_sum_f64_avx2, lvec_dot_f64_avx2,
+	lvec_min_i64_avx2, lvec_max_i64_avx2, lvec_min_f64_avx2, lvec_max_f64_avx2,
+	lvec_add_i64_avx2, lvec_sub_i64_avx2,
+	lvec_add_f64_avx2, lvec_sub_f64_avx2, lvec_mul_f64_avx2, lvec_div_f64_avx2
+};
+
+#endif
+
+/* Returns kernels for the running CPU, chosen on first use. Set QSP_NO_SIMD to force the scalar ones. */
+const lvec_kernels* lvec_kern(void) {
+	static const lvec_kernels* k = NULL;
+	if(k) { return k; }
+
+	const lvec_kernels* found = &LVEC_SCALAR;
+#ifdef LVEC_AVX2
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && !getenv("QSP_NO_SIMD")) { found = &LVEC_AVX2_KERNELS; }
+#endif
+	k = found;
+	return k;
+}
+
+/* Vectors */
+
+lvec* lvec_new(int count) {
+	lvec* v = (lvec*)malloc(sizeof(lvec));
+	v->ref_count = 1;
+	v->count = count;
+	v->hash = 0;
+	v->data.i = (long*)malloc(sizeof(long) * (count ? count : 1));
+	return v;
+}
+
+lvec* lvec_cp(lvec* v) {
+	v->ref_count++;
+	return v;
+}
+
+void lvec_del(lvec* v) {
+	if(--v->ref_count > 0) { return; }
+	free(v->data.i);
+	free(v);
+}
+
+lvec* lvec_clone(lvec* v) {
+	lvec* x = lvec_new(v->count);
+	memcpy(x->data.i, v->data.i, sizeof(long) * v->count);
+	x->hash = v->hash;
+	return x;
+}
+
+int lvec_count(lvec* v) {
+	return v->count;
+}
+
+int lvec_eq(lvec* x, lvec* y, int type) {
+	if(x->count != y->count) { return 0; }
+	for(int i = 0; i < x->count; i++) {
+		if(type == LVAL_I64VEC ? x->data.i[i] != y->data.i[i] : x->data.f[i] != y->data.f[i]) { return 0; }
+	}
+	return 1;
+}
+
+/* Create a new vector type lval of [type], either LVAL_I64VEC or LVAL_F64VEC. Takes ownership of [v] */
+lval* lval_vec(int type, lvec* v) {
+	unsigned int h = 31;
+	for(int i = 0; i < v->count; i++) {
+		// 0.0 and -0.0 are equal
+		long bits = 0;
+		if(type == LVAL_I64VEC) { bits = v->data.i[i]; }
+		else if(v->data.f[i] != 0) { memcpy(&bits, &v->data.f[i], sizeof(bits)); }
+		h = 31 * h + hmap_int_h((int)(bits ^ (bits >> 32)));
+	}
+	v->hash = h;
+
+	lval* x = lval_new();
+	x->type = type;
+	x->hash = (int)h;
+	x->as.vec = v;
+	return x;
+}
+
+void lvec_render(lbuf* b, lval* v) {
+	lbuf_puts(b, v->type == LVAL_I64VEC ? "#i64{" : "#f64{");
+	for(int i = 0; i < v->as.vec->count; i++) {
+		if(i) { lbuf_putc(b, ' '); }
+		if(v->type == LVAL_I64VEC) {
+			lbuf_put_long(b, v->as.vec->data.i[i]);
+		} else {
+			char buf[32];
+			lval_fmt_float(v->as.vec->data.f[i], buf);
+			lbuf_puts(b, buf);
+		}
+	}
+	lbuf_putc(b, '}');
+}
+
+int lval_is_vec(lval* v) {
+	return v->type == LVAL_I64VEC || v->type == LVAL_F64VEC;
+}
+
+/* Returns float vector with elements of vector [v], a new reference if it's one already. */
+lvec* lvec_to_f64(lval* v) {
+	if(v->type == LVAL_F64VEC) { return lvec_cp(v->as.vec); }
+
+	lvec* x = lvec_new(v->as.vec->count);
+	for(int i = 0; i < x->count; i++) { x->data.f[i] = (double)v->as.vec->data.i[i]; }
+	return x;
+}
+
+/* Stores element [x] at [i] of vector [v] of [type], or returns an error if it's not a number fitting it. */
+lval* lvec_set(lvec* v, int type, int i, lval* x) {
+	if(type == LVAL_F64VEC && (x->type == LVAL_NUM || x->type == LVAL_FLOAT || x->type == LVAL_BIGNUM)) {
+		v->data.f[i] = lval_to_double(x);
+		return NULL;
+	}
+	if(type == LVAL_I64VEC && x->type == LVAL_NUM) {
+		v->data.i[i] = x->as.num;
+		return NULL;
+	}
+	return lval_err("Element %i of %s is %s, expected %s.", i, ltype_name(type), ltype_name(x->type),
+		type == LVAL_I64VEC ? "integer fitting 64 bits" : ltype_name(LVAL_NUM));
+}
+
+/* Builds vector of [type] from [src] - a Q-Expression, a stream or another vector. */
+lval* lval_to_vec(lenv* e, int type, lval* src) {
+	if(lval_is_vec(src)) {
+		if(src->type == type) { return lval_cp(src); }
+		if(type == LVAL_F64VEC) { return lval_vec(type, lvec_to_f64(src)); }
+
+		// floats are truncated towards zero, as 'int' does
+		lvec* v = lvec_new(src->as.vec->count);
+		for(int i = 0; i < v->count; i++) {
+			double f = src->as.vec->data.f[i];
+			if(!(f > (double)LONG_MIN && f < (double)LONG_MAX)) {
+				lvec_del(v);
+				return lval_err("Element %i of %s doesn't fit 64 bits.", i, ltype_name(src->type));
+			}
+			v->data.i[i] = (long)f;
+		}
+		return lval_vec(type, v);
+	}
+
+	if(src->type == LVAL_QEXPR && src->as.list.ints && type == LVAL_I64VEC) {
+		lvec* v = lvec_new(src->as.list.count);
+		memcpy(v->data.i, src->as.list.ints, sizeof(long) * v->count);
+		return lval_vec(type, v);
+	}
+
+	if(src->type == LVAL_QEXPR) {
+		lvec* v = lvec_new(src->as.list.count);
+		for(int i = 0; i < v->count; i++) {
+			lval* x = lval_nth(src, i);
+			lval* err = lvec_set(v, type, i, x);
+			lval_del(x);
+			if(err) {
+				lvec_del(v);
+				return err;
+			}
+		}
+		return lval_vec(type, v);
+	}
+
+	lstream* s = lval_to_stream(src);
+	int cap = 1024;
+	lvec* v = lvec_new(cap);
+	v->count = 0;
+	lval* x;
+	while((x = s->next(e, s))) {
+		lval* err = x->type == LVAL_ERR ? lval_cp(x) : NULL;
+		if(!err && v->count == cap) {
+			cap *= 2;
+			v->data.i = (long*)realloc(v->data.i, sizeof(long) * cap);
+		}
+		if(!err) { err = lvec_set(v, type, v->count++, x); }
+		lval_del(x);
+		if(err) {
+			lvec_del(v);
+			lstream_del(s);
+			return err;
+		}
+	}
+	lstream_del(s);
+	return lval_vec(type, v);
+}
+
+/* Combines [x] and [y] elementwise by [op], at least one of them being a vector and the other a vector of the same length or a number. Borrows both. */
+lval* lvec_binop(lval* x, lval* y, char* op) {
+	int n = lval_is_vec(x) ? x->as.vec->count : y->as.vec->count;
+	if(lval_is_vec(x) && lval_is_vec(y) && x->as.vec->count != y->as.vec->count) {
+		return lval_err("Function '%s' passed vectors of different lengths. Got %i and %i.",
+			op, x->as.vec->count, y->as.vec->count);
+	}
+
+	const lvec_kernels* k = lvec_kern();
+	int floats = x->type == LVAL_F64VEC || x->type == LVAL_FLOAT || y->type == LVAL_F64VEC || y->type == LVAL_FLOAT;
+
+	// numbers take part as a single element with stride 0
+	lvec* xv;
+	lvec* yv;
+	lvec* r = lvec_new(n);
+	if(floats) {
+		double xf = lval_is_vec(x) ? 0 : lval_to_double(x);
+		double yf = lval_is_vec(y) ? 0 : lval_to_double(y);
+		xv = lval_is_vec(x) ? lvec_to_f64(x) : NULL;
+		yv = lval_is_vec(y) ? lvec_to_f64(y) : NULL;
+		const double* xp = xv ? xv->data.f : &xf;
+		const double* yp = yv ? yv->data.f : &yf;
+
+		// division by zero is an error, as it is for numbers and i64 vectors
+		if(strcmp(op, "/") == 0) {
+			for(int i = 0; i < (yv ? n : 1); i++) {
+				if(yp[i] != 0) { continue; }
+				if(xv) { lvec_del(xv); }
+				if(yv) { lvec_del(yv); }
+				lvec_del(r);
+				return lval_err("Division by zero!");
+			}
+		}
+
+		void (*f)(const double*, int, const double*, int, double*, int) = k->add_f64;
+		if(strcmp(op, "-") == 0) { f = k->sub_f64; }
+		if(strcmp(op, "*") == 0) { f = k->mul_f64; }
+		if(strcmp(op, "/") == 0) { f = k->div_f64; }
+		f(xp, xv != NULL, yp, yv != NULL, r->data.f, n);
+
+		if(xv) { lvec_del(xv); }
+		if(yv) { lvec_del(yv); }
+		return lval_vec(LVAL_F64VEC, r);
+	}
+
+	if((!lval_is_vec(x) && x->type != LVAL_NUM) || (!lval_is_vec(y) && y->type != LVAL_NUM)) {
+		lvec_del(r);
+		return lval_err("Function '%s' passed number not fitting 64 bits for %s.", op, ltype_name(LVAL_I64VEC));
+	}
+
+	xv = lval_is_vec(x) ? x->as.vec : NULL;
+	yv = lval_is_vec(y) ? y->as.vec : NULL;
+	const long* xp = xv ? xv->data.i : &x->as.num;
+	const long* yp = yv ? yv->data.i : &y->as.num;
+	int xs = xv != NULL;
+	int ys = yv != NULL;
+
+	int overflow = 0;
+	if(strcmp(op, "+") == 0) { overflow = k->add_i64(xp, xs, yp, ys, r->data.i, n); }
+	if(strcmp(op, "-") == 0) { overflow = k->sub_i64(xp, xs, yp, ys, r->data.i, n); }
+	if(strcmp(op, "*") == 0) { overflow = lvec_mul_i64(xp, xs, yp, ys, r->data.i, n); }
+	if(strcmp(op, "/") == 0) {
+		for(int i = 0; i < n && !overflow; i++) {
+			long a = xp[i * xs];
+			long b = yp[i * ys];
+			if(b == 0) {
+				lvec_del(r);
+				return lval_err("Division by zero!");
+			}
+			overflow = (a == LONG_MIN && b == -1);
+			if(!overflow) { r->data.i[i] = a / b; }
+		}
+	}
+
+	if(overflow) {
+		lvec_del(r);
+		return lval_err("Function '%s' overflowed 64 bits in %s arithmetic.", op, ltype_name(LVAL_I64VEC));
+	}
+	return lval_vec(LVAL_I64VEC, r);
+}
+
+lval* lvec_op(lenv* e, lval* a, char* op) {
+	for(int i = 0; i < a->as.list.count; i++) {
+		lval* x = a->as.list.cell[i];
+		LASSERT(a, lval_is_vec(x) || x->type == LVAL_NUM || x->type == LVAL_FLOAT || x->type == LVAL_BIGNUM,
+			"Function '%s' passed incorrect type for argument %i. Got %s, expected %s.",
+			op, i, ltype_name(x->type), ltype_name(LVAL_NUM));
+	}
+
+	// negation of a single vector
+	if(a->as.list.count == 1 && strcmp(op, "-") == 0) {
+		lval* zero = lval_num(0);
+		lval* r = lvec_binop(zero, a->as.list.cell[0], op);
+		lval_del(zero);
+		lval_del(a);
+		return r;
+	}
+
+	lval* x = lval_pop(a, 0);
+	while(a->as.list.count > 0) {
+		lval* y = lval_pop(a, 0);
+		lval* r;
+		if(lval_is_vec(x) || lval_is_vec(y)) {
+			r = lvec_binop(x, y, op);
+		} else {
+			// leading numbers are combined by scalar arithmetic
+			r = builtin_op(e, lval_add(lval_add(lval_sexpr(), lval_cp(x)), lval_cp(y)), op);
+		}
+		lval_del(x);
+		lval_del(y);
+		x = r;
+		if(x->type == LVAL_ERR) { break; }
+	}
+
+	lval_del(a);
+	return x;
+}
+
+#define LASSERT_VEC(func, args, index)												\
+	LASSERT(args, lval_is_vec(args->as.list.cell[index]),							\
+		"Function '%s' passed incorrect type for argument %i. Got %s, expected %s or %s.",	\
+		func, index, ltype_name(args->as.list.cell[index]->type), ltype_name(LVAL_I64VEC), ltype_name(LVAL_F64VEC))
+
+lval* builtin_vec_of(lenv* e, lval* a, char* func, int type) {
+	LASSERT_NUM(func, a, 1);
+	lval* src = a->as.list.cell[0];
+	LASSERT(a, lval_is_vec(src) || src->type == LVAL_QEXPR || src->type == LVAL_STREAM,
+		"Function '%s' passed incorrect type for argument 0. Got %s, expected Q-Expression, Stream or vector.",
+		func, ltype_name(src->type));
+
+	lval* r = lval_to_vec(e, type, src);
+	lval_del(a);
+	return r;
+}
+
+lval* builtin_i64vec(lenv* e, lval* a) { return builtin_vec_of(e, a, "i64vec", LVAL_I64VEC); }
+lval* builtin_f64vec(lenv* e, lval* a) { return builtin_vec_of(e, a, "f64vec", LVAL_F64VEC); }
+
+lval* builtin_vec_list(lenv* e, lval* a) {
+	LASSERT_NUM("vec-list", a, 1);
+	LASSERT_VEC("vec-list", a, 0);
+
+	lval* v = a->as.list.cell[0];
+	lval* l = lval_qexpr();
+	l->as.list.count = v->as.vec->count;
+
+	// integers end up packed, as they would by adding them one by one
+	if(v->type == LVAL_I64VEC && l->as.list.count > 0) {
+		l->as.list.ints = (long*)malloc(sizeof(long) * l->as.list.count);
+		memcpy(l->as.list.ints, v->as.vec->data.i, sizeof(long) * l->as.list.count);
+	} else {
+		l->as.list.cell = (lval**)malloc(sizeof(lval*) * (l->as.list.count ? l->as.list.count : 1));
+		for(int i = 0; i < l->as.list.count; i++) {
+			l->as.list.cell[i] = lval_float(v->as.vec->data.f[i]);
+			// long vectors would run past the heap reserve
+			if(HEAP->oom) {
+				l->as.list.count = i + 1;
+				lval_del(l);
+				lval_del(a);
+				return heap_oom(HEAP);
+			}
+		}
+	}
+	lval_list_rehash(l);
+
+	lval_del(a);
+	return l;
+}
+
+lval* builtin_vsum(lenv* e, lval* a) {
+	LASSERT_NUM("vsum", a, 1);
+	LASSERT_VEC("vsum", a, 0);
+
+	lval* v = a->as.list.cell[0];
+	lval* r;
+	if(v->type == LVAL_F64VEC) {
+		r = lval_float(lvec_kern()->sum_f64(v->as.vec->data.f, v->as.vec->count));
+	} else {
+		long s;
+		if(!lvec_kern()->sum_i64(v->as.vec->data.i, v->as.vec->count, &s)) {
+			r = lval_num(s);
+		} else {
+			// sum doesn't fit a machine word, redo it in big integers
+			lbig* b = lbig_from_long(0);
+			for(int i = 0; i < v->as.vec->count; i++) {
+				lbig* x = lbig_from_long(v->as.vec->data.i[i]);
+				lbig* t = lbig_add(b, x);
+				lbig_del(x);
+				lbig_del(b);
+				b = t;
+			}
+			r = lval_integer(b);
+		}
+	}
+
+	lval_del(a);
+	return r;
+}
+
+lval* builtin_vdot(lenv* e, lval* a) {
+	LASSERT_NUM("vdot", a, 2);
+	LASSERT_VEC("vdot", a, 0);
+	LASSERT_VEC("vdot", a, 1);
+
+	lval* x = a->as.list.cell[0];
+	lval* y = a->as.list.cell[1];
+	LASSERT(a, x->as.vec->count == y->as.vec->count,
+		"Function 'vdot' passed vectors of different lengths. Got %i and %i.", x->as.vec->count, y->as.vec->count);
+
+	lval* r;
+	if(x->type == LVAL_I64VEC && y->type == LVAL_I64VEC) {
+		// exact as long as it fits, big integers once it doesn't
+		long s = 0;
+		lbig* b = NULL;
+		for(int i = 0; i < x->as.vec->count; i++) {
+			long p;
+			long xi = x->as.vec->data.i[i];
+			long yi = y->as.vec->data.i[i];
+			if(!b && !__builtin_mul_overflow(xi, yi, &p) && !__builtin_add_overflow(s, p, &s)) { continue; }
+
+			if(!b) { b = lbig_from_long(s); }
+			lbig* bx = lbig_from_long(xi);
+			lbig* by = lbig_from_long(yi);
+			lbig* bp = lbig_mul(bx, by);
+			lbig* t = lbig_add(b, bp);
+			lbig_del(bx); lbig_del(by); lbig_del(bp); lbig_del(b);
+			b = t;
+		}
+		r = b ? lval_integer(b) : lval_num(s);
+	} else {
+		lvec* xf = lvec_to_f64(x);
+		lvec* yf = lvec_to_f64(y);
+		r = lval_float(lvec_kern()->dot_f64(xf->data.f, yf->data.f, xf->count));
+		lvec_del(xf);
+		lvec_del(yf);
+	}
+
+	lval_del(a);
+	return r;
+}
+
+lval* builtin_vextreme(lenv* e, lval* a, char* func, int max) {
+	LASSERT_NUM(func, a, 1);
+	LASSERT_VEC(func, a, 0);
+
+	lval* v = a->as.list.cell[0];
+	LASSERT(a, v->as.vec->count > 0, "Function '%s' passed empty vector.", func);
+
+	const lvec_kernels* k = lvec_kern();
+	lval* r;
+	if(v->type == LVAL_I64VEC) {
+		r = lval_num((max ? k->max_i64 : k->min_i64)(v->as.vec->data.i, v->as.vec->count));
+	} else {
+		r = lval_float((max ? k->max_f64 : k->min_f64)(v->as.vec->data.f, v->as.vec->count));
+	}
+
+	lval_del(a);
+	return r;
+}
+
+lval* builtin_vmin(lenv* e, lval* a) { return builtin_vextreme(e, a, "vmin", 0); }
+lval* builtin_vmax(lenv* e, lval* a) { return builtin_vextreme(e, a, "vmax", 1); }
+
+lval* builtin_vadd(lenv* e, lval* a) { return lvec_op(e, a, "+"); }
+lval* builtin_vmul(lenv* e, lval* a) { return lvec_op(e, a, "*"); }